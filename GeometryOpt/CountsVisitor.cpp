@@ -12,13 +12,165 @@
 #include <osg/MatrixTransform>
 #include <osg/Geode>
 #include <osg/Geometry>
+#include <osg/StateSet>
+#include <osg/Texture>
+#include <osg/Image>
 #include <osgSim/DOFTransform>
 #include <osgText/Text>
 #include <iostream>
+#include <algorithm>
+
+
+PointerSet::PointerSet()
+  : _shift( 64 ),
+    _size( 0 ),
+    _hasNull( false )
+{
+}
+
+void
+PointerSet::reserve( unsigned int n )
+{
+    unsigned int capacity( 16 );
+    while( capacity < n * 2 )
+        capacity <<= 1;
+    if( capacity > _slots.size() )
+        rehash( capacity );
+}
+
+bool
+PointerSet::insert( const void* ptr )
+{
+    if( ptr == NULL )
+    {
+        const bool inserted( !_hasNull );
+        _hasNull = true;
+        return( inserted );
+    }
+
+    if( ( _size + 1 ) * 2 > _slots.size() )
+        rehash( _slots.empty() ? 16 : _slots.size() * 2 );
+
+    // Fibonacci hashing: the top bits of a 64-bit multiply depend on
+    // every bit of the pointer, unlike the low bits, which depend only
+    // on its low (mostly alignment) bits.
+    const unsigned int mask( _slots.size() - 1 );
+    unsigned int slot( (unsigned int)( ( (unsigned long long)(size_t)ptr * 0x9e3779b97f4a7c15ULL ) >> _shift ) );
+    while( _slots[ slot ] != NULL )
+    {
+        if( _slots[ slot ] == ptr )
+            return( false );
+        slot = ( slot + 1 ) & mask;
+    }
+    _slots[ slot ] = ptr;
+    ++_size;
+    return( true );
+}
+
+unsigned int
+PointerSet::size() const
+{
+    return( _size + ( _hasNull ? 1 : 0 ) );
+}
+
+void
+PointerSet::clear()
+{
+    std::fill( _slots.begin(), _slots.end(), (const void*)NULL );
+    _size = 0;
+    _hasNull = false;
+}
+
+void
+PointerSet::rehash( unsigned int capacity )
+{
+    std::vector< const void* > old;
+    old.swap( _slots );
+    _slots.resize( capacity, NULL );
+    _size = 0;
+    // capacity is a power of two; the hash keeps its log2 top bits.
+    _shift = 64;
+    while( capacity > 1 )
+    {
+        capacity >>= 1;
+        --_shift;
+    }
+
+    std::vector< const void* >::const_iterator it;
+    for( it = old.begin(); it != old.end(); ++it )
+    {
+        if( *it != NULL )
+            insert( *it );
+    }
+}
+
+
+ObjectSet::ObjectSet()
+  : _fast( false )
+{
+}
+
+void
+ObjectSet::setFastMode( bool fast, unsigned int expected )
+{
+    clear();
+    _fast = fast;
+    if( _fast )
+        _pointers.reserve( expected );
+}
+
+bool
+ObjectSet::insert( const osg::Object* obj )
+{
+    if( _fast )
+        return( _pointers.insert( obj ) );
+    return( _objects.insert( const_cast< osg::Object* >( obj ) ).second );
+}
+
+unsigned int
+ObjectSet::size() const
+{
+    if( _fast )
+        return( _pointers.size() );
+    return( _objects.size() );
+}
+
+void
+ObjectSet::clear()
+{
+    _objects.clear();
+    _pointers.clear();
+}
+
+
+CountsVisitor::SubgraphCost::SubgraphCost( const std::string& path, int depth )
+  : _path( path ),
+    _depth( depth ),
+    _vertices( 0 ),
+    _drawables( 0 ),
+    _stateSets( 0 ),
+    _textureBytes( 0 )
+{
+}
+
+unsigned long long
+CountsVisitor::SubgraphCost::get( SubgraphSortKey key ) const
+{
+    switch( key )
+    {
+    case SORT_DRAWABLES: return( _drawables );
+    case SORT_STATESETS: return( _stateSets );
+    case SORT_TEXTURE_BYTES: return( _textureBytes );
+    case SORT_VERTICES:
+    default: return( _vertices );
+    }
+}
 
 
 CountsVisitor::CountsVisitor( osg::NodeVisitor::TraversalMode mode )
-  : osg::NodeVisitor( mode )
+  : osg::NodeVisitor( mode ),
+    _subgraphDepth( 0 ),
+    _fast( false )
 {
     reset();
 }
@@ -39,6 +191,45 @@ CountsVisitor::getDrawArrays() const
     return( _drawArrays );
 }
 
+void
+CountsVisitor::setFastMode( bool fast, unsigned int expectedObjects )
+{
+    _fast = fast;
+
+    // Presize only the sets that grow with the scene graph. The rest
+    // would each allocate expectedObjects slots for a few entries.
+    _uNodes.setFastMode( fast, expectedObjects );
+    _uGeodes.setFastMode( fast, expectedObjects );
+    _uDrawables.setFastMode( fast, expectedObjects );
+    _uVertices.setFastMode( fast, expectedObjects );
+    _uNormals.setFastMode( fast, expectedObjects );
+    _uColors.setFastMode( fast, expectedObjects );
+    _uTexCoords.setFastMode( fast, expectedObjects );
+
+    _uGroups.setFastMode( fast );
+    _uLods.setFastMode( fast );
+    _uPagedLods.setFastMode( fast );
+    _uSwitches.setFastMode( fast );
+    _uSequences.setFastMode( fast );
+    _uTransforms.setFastMode( fast );
+    _uMatrixTransforms.setFastMode( fast );
+    _uDofTransforms.setFastMode( fast );
+    _uGeometries.setFastMode( fast );
+    _uTexts.setFastMode( fast );
+    _uStateSets.setFastMode( fast );
+    _uTextures.setFastMode( fast );
+    _uPrimitiveSets.setFastMode( fast );
+    _uDrawArrays.setFastMode( fast );
+    _uOtherArrays.setFastMode( fast );
+    _uImages.setFastMode( fast );
+}
+
+bool
+CountsVisitor::getFastMode() const
+{
+    return( _fast );
+}
+
 void
 CountsVisitor::reset()
 {
@@ -86,197 +277,509 @@ CountsVisitor::reset()
     _uTextures.clear();
     _uPrimitiveSets.clear();
     _uDrawArrays.clear();
+    _uNormals.clear();
+    _uColors.clear();
+    _uTexCoords.clear();
+    _uOtherArrays.clear();
+    _uImages.clear();
+
+    for( unsigned int idx=0; idx<NUM_BYTE_CATEGORIES; ++idx )
+        _totalBytes[ idx ] = _uniqueBytes[ idx ] = 0;
+
+    _subgraphs.clear();
+    _subgraphStack.clear();
+}
+
+void
+CountsVisitor::setSubgraphDepth( unsigned int depth )
+{
+    _subgraphDepth = depth;
+}
+
+unsigned int
+CountsVisitor::getSubgraphDepth() const
+{
+    return( _subgraphDepth );
+}
+
+bool
+CountsVisitor::pushSubgraph( osg::Node& node )
+{
+    // _depth is the parent's depth here; the root node is at depth 1.
+    if( ( _depth >= (int)_subgraphDepth ) || node.getName().empty() )
+        return( false );
+
+    std::string path( node.getName() );
+    if( !_subgraphStack.empty() )
+        path = _subgraphs[ _subgraphStack.back() ]._path + "/" + path;
+    _subgraphStack.push_back( _subgraphs.size() );
+    _subgraphs.push_back( SubgraphCost( path, _depth + 1 ) );
+    return( true );
+}
+
+void
+CountsVisitor::popSubgraph( const bool pushed )
+{
+    if( !pushed )
+        return;
+
+    // Roll this subgraph's totals up into the enclosing named subgraph.
+    const SubgraphCost& cost( _subgraphs[ _subgraphStack.back() ] );
+    _subgraphStack.pop_back();
+    if( !_subgraphStack.empty() )
+    {
+        SubgraphCost& parent( _subgraphs[ _subgraphStack.back() ] );
+        parent._vertices += cost._vertices;
+        parent._drawables += cost._drawables;
+        parent._stateSets += cost._stateSets;
+        parent._textureBytes += cost._textureBytes;
+    }
+}
+
+void
+CountsVisitor::addSubgraphCost( unsigned int vertices, unsigned int drawables,
+                               unsigned int stateSets, unsigned long long textureBytes )
+{
+    if( _subgraphStack.empty() )
+        return;
+
+    SubgraphCost& cost( _subgraphs[ _subgraphStack.back() ] );
+    cost._vertices += vertices;
+    cost._drawables += drawables;
+    cost._stateSets += stateSets;
+    cost._textureBytes += textureBytes;
 }
 
+struct SubgraphCostGreater
+{
+    SubgraphCostGreater( CountsVisitor::SubgraphSortKey key ) : _key( key ) {}
+    bool operator()( const CountsVisitor::SubgraphCost* lhs, const CountsVisitor::SubgraphCost* rhs ) const
+    {
+        return( lhs->get( _key ) > rhs->get( _key ) );
+    }
+    CountsVisitor::SubgraphSortKey _key;
+};
+
 void
-CountsVisitor::dump()
-{
-    std::cout << std::endl;
-    std::cout << "      OSG Object \tCount\tUnique" << std::endl;
-    std::cout << "      ---------- \t-----\t------" << std::endl;
-    std::cout << "           Nodes \t" << _nodes << "\t" << _uNodes.size() << std::endl;
-    std::cout << "          Groups \t" << _groups << "\t" << _uGroups.size() << std::endl;
-    std::cout << "            LODs \t" << _lods << "\t" << _uLods.size() << std::endl;
-    std::cout << "       PagedLODs \t" << _pagedLods << "\t" << _uPagedLods.size() << std::endl;
-    std::cout << "        Switches \t" << _switches << "\t" << _uSwitches.size() << std::endl;
-    std::cout << "       Sequences \t" << _sequences << "\t" << _uSequences.size() << std::endl;
-    std::cout << "      Transforms \t" << _transforms << "\t" << _uTransforms.size() << std::endl;
-    std::cout << "MatrixTransforms \t" << _matrixTransforms << "\t" << _uMatrixTransforms.size() << std::endl;
-    std::cout << "   DOFTransforms \t" << _dofTransforms << "\t" << _uDofTransforms.size() << std::endl;
-    std::cout << "          Geodes \t" << _geodes << "\t" << _uGeodes.size() << std::endl;
-    std::cout << "       Drawables \t" << _drawables << "\t" << _uDrawables.size() << std::endl;
-    std::cout << "      Geometries \t" << _geometries << "\t" << _uGeometries.size() << std::endl;
-    std::cout << "           Texts \t" << _texts << "\t" << _uTexts.size() << std::endl;
-    std::cout << "   PrimitiveSets \t" << _primitiveSets << "\t" << _uPrimitiveSets.size() << std::endl;
-    std::cout << "      DrawArrays \t" << _drawArrays << "\t" << _uDrawArrays.size() << std::endl;
-    std::cout << " NULL Geometries \t" << _nullGeometries << std::endl;
+CountsVisitor::dumpSubgraphs( std::ostream& ostr, unsigned int topN, SubgraphSortKey key )
+{
+    std::vector< const SubgraphCost* > sorted;
+    sorted.reserve( _subgraphs.size() );
+    SubgraphCostList::const_iterator it;
+    for( it = _subgraphs.begin(); it != _subgraphs.end(); ++it )
+        sorted.push_back( &( *it ) );
+    topN = osg::minimum< unsigned int >( topN, sorted.size() );
+    std::partial_sort( sorted.begin(), sorted.begin() + topN, sorted.end(), SubgraphCostGreater( key ) );
+
+    ostr << std::endl;
+    ostr << "Top " << topN << " of " << _subgraphs.size() <<
+        " named subgraphs (depth <= " << _subgraphDepth << "):" << std::endl;
+    ostr << "Vertices\tDrawables\tStateSets\tTexBytes\tDepth\tPath" << std::endl;
+    for( unsigned int idx=0; idx<topN; ++idx )
+    {
+        const SubgraphCost& cost( *( sorted[ idx ] ) );
+        ostr << cost._vertices << "\t" << cost._drawables << "\t" << cost._stateSets << "\t" <<
+            cost._textureBytes << "\t" << cost._depth << "\t" << cost._path << std::endl;
+    }
+}
+
+unsigned long long
+CountsVisitor::getTotalBytes( ByteCategory category ) const
+{
+    return( _totalBytes[ category ] );
+}
+
+unsigned long long
+CountsVisitor::getUniqueBytes( ByteCategory category ) const
+{
+    return( _uniqueBytes[ category ] );
+}
+
+static const char* byteCategoryNames[] = {
+    "VertexBytes",
+    "NormalBytes",
+    "ColorBytes",
+    "TexCoordBytes",
+    "OtherArrayBytes",
+    "UByteIndexBytes",
+    "UShortIndexBytes",
+    "UIntIndexBytes",
+    "ImageBytes"
+};
+
+void
+CountsVisitor::dump( std::ostream& ostr )
+{
+    ostr << std::endl;
+    ostr << "      OSG Object \tCount\tUnique" << std::endl;
+    ostr << "      ---------- \t-----\t------" << std::endl;
+    ostr << "           Nodes \t" << _nodes << "\t" << _uNodes.size() << std::endl;
+    ostr << "          Groups \t" << _groups << "\t" << _uGroups.size() << std::endl;
+    ostr << "            LODs \t" << _lods << "\t" << _uLods.size() << std::endl;
+    ostr << "       PagedLODs \t" << _pagedLods << "\t" << _uPagedLods.size() << std::endl;
+    ostr << "        Switches \t" << _switches << "\t" << _uSwitches.size() << std::endl;
+    ostr << "       Sequences \t" << _sequences << "\t" << _uSequences.size() << std::endl;
+    ostr << "      Transforms \t" << _transforms << "\t" << _uTransforms.size() << std::endl;
+    ostr << "MatrixTransforms \t" << _matrixTransforms << "\t" << _uMatrixTransforms.size() << std::endl;
+    ostr << "   DOFTransforms \t" << _dofTransforms << "\t" << _uDofTransforms.size() << std::endl;
+    ostr << "          Geodes \t" << _geodes << "\t" << _uGeodes.size() << std::endl;
+    ostr << "       Drawables \t" << _drawables << "\t" << _uDrawables.size() << std::endl;
+    ostr << "      Geometries \t" << _geometries << "\t" << _uGeometries.size() << std::endl;
+    ostr << "           Texts \t" << _texts << "\t" << _uTexts.size() << std::endl;
+    ostr << "       StateSets \t" << _stateSets << "\t" << _uStateSets.size() << std::endl;
+    ostr << "        Textures \t" << _textures << "\t" << _uTextures.size() << std::endl;
+    ostr << "   PrimitiveSets \t" << _primitiveSets << "\t" << _uPrimitiveSets.size() << std::endl;
+    ostr << "      DrawArrays \t" << _drawArrays << "\t" << _uDrawArrays.size() << std::endl;
+    ostr << " NULL Geometries \t" << _nullGeometries << std::endl;
 
     if (_slowPathGeometries)
-        std::cout << "Slow path Geometries: " << _slowPathGeometries << std::endl;
+        ostr << "Slow path Geometries: " << _slowPathGeometries << std::endl;
     float avgChildren = (float)_totalChildren / (float)(_nodes+_groups+_lods+_pagedLods+_switches+_sequences+_transforms+_matrixTransforms+_dofTransforms);
-    std::cout << "Average children per node: " << avgChildren << std::endl;
+    ostr << "Average children per node: " << avgChildren << std::endl;
+
+    ostr << "Total vertices: " << _vertices << std::endl;
+    ostr << "Max depth: " << _maxDepth << std::endl;
+
+    // Memory footprint. "Shared" is the total minus the unique bytes,
+    // i.e. what sharing saves over a graph with no sharing.
+    unsigned long long total( 0 ), unique( 0 );
+    ostr << std::endl;
+    ostr << "     Memory (bytes) \tTotal\tUnique\tShared" << std::endl;
+    ostr << "     -------------- \t-----\t------\t------" << std::endl;
+    for( unsigned int idx=0; idx<NUM_BYTE_CATEGORIES; ++idx )
+    {
+        ostr << std::string( 19 - std::string( byteCategoryNames[ idx ] ).length(), ' ' ) <<
+            byteCategoryNames[ idx ] << " \t" << _totalBytes[ idx ] << "\t" <<
+            _uniqueBytes[ idx ] << "\t" << _totalBytes[ idx ] - _uniqueBytes[ idx ] << std::endl;
+        total += _totalBytes[ idx ];
+        unique += _uniqueBytes[ idx ];
+    }
+    ostr << "              Total \t" << total << "\t" << unique << "\t" << total - unique << std::endl;
+}
 
-    std::cout << "Total vertices: " << _vertices << std::endl;
-    std::cout << "Max depth: " << _maxDepth << std::endl;
+void
+CountsVisitor::getRows( CountRowList& rows ) const
+{
+    rows.push_back( CountRow( "Nodes", _nodes, _uNodes.size() ) );
+    rows.push_back( CountRow( "Groups", _groups, _uGroups.size() ) );
+    rows.push_back( CountRow( "LODs", _lods, _uLods.size() ) );
+    rows.push_back( CountRow( "PagedLODs", _pagedLods, _uPagedLods.size() ) );
+    rows.push_back( CountRow( "Switches", _switches, _uSwitches.size() ) );
+    rows.push_back( CountRow( "Sequences", _sequences, _uSequences.size() ) );
+    rows.push_back( CountRow( "Transforms", _transforms, _uTransforms.size() ) );
+    rows.push_back( CountRow( "MatrixTransforms", _matrixTransforms, _uMatrixTransforms.size() ) );
+    rows.push_back( CountRow( "DOFTransforms", _dofTransforms, _uDofTransforms.size() ) );
+    rows.push_back( CountRow( "Geodes", _geodes, _uGeodes.size() ) );
+    rows.push_back( CountRow( "Drawables", _drawables, _uDrawables.size() ) );
+    rows.push_back( CountRow( "Geometries", _geometries, _uGeometries.size() ) );
+    rows.push_back( CountRow( "Texts", _texts, _uTexts.size() ) );
+    rows.push_back( CountRow( "StateSets", _stateSets, _uStateSets.size() ) );
+    rows.push_back( CountRow( "Textures", _textures, _uTextures.size() ) );
+    rows.push_back( CountRow( "PrimitiveSets", _primitiveSets, _uPrimitiveSets.size() ) );
+    rows.push_back( CountRow( "DrawArrays", _drawArrays, _uDrawArrays.size() ) );
+    rows.push_back( CountRow( "NullGeometries", _nullGeometries, _nullGeometries ) );
+    rows.push_back( CountRow( "Vertices", _vertices, _vertices ) );
+    for( unsigned int idx=0; idx<NUM_BYTE_CATEGORIES; ++idx )
+        rows.push_back( CountRow( byteCategoryNames[ idx ], _totalBytes[ idx ], _uniqueBytes[ idx ] ) );
+}
+
+void
+CountsVisitor::dumpCSV( std::ostream& ostr )
+{
+    CountRowList rows;
+    getRows( rows );
+
+    ostr << "Category,Count,Unique" << std::endl;
+    CountRowList::const_iterator it;
+    for( it = rows.begin(); it != rows.end(); ++it )
+        ostr << it->_name << "," << it->_count << "," << it->_unique << std::endl;
+}
+
+void
+CountsVisitor::dumpJSON( std::ostream& ostr )
+{
+    CountRowList rows;
+    getRows( rows );
+
+    ostr << "{" << std::endl;
+    CountRowList::const_iterator it;
+    for( it = rows.begin(); it != rows.end(); ++it )
+    {
+        ostr << "  \"" << it->_name << "\": { \"count\": " << it->_count <<
+            ", \"unique\": " << it->_unique << " }," << std::endl;
+    }
+    ostr << "  \"maxDepth\": " << _maxDepth << std::endl;
+    ostr << "}" << std::endl;
+}
+
+void
+CountsVisitor::addBytes( ByteCategory category, const unsigned long long bytes, const bool unique )
+{
+    _totalBytes[ category ] += bytes;
+    if( unique )
+        _uniqueBytes[ category ] += bytes;
+}
+
+void
+CountsVisitor::addArrayBytes( ByteCategory category, ObjectSet& uSet, const osg::Array* array )
+{
+    if( array == NULL )
+        return;
+    const bool unique( uSet.insert( array ) );
+    addBytes( category, array->getTotalDataSize(), unique );
+}
+
+void
+CountsVisitor::applyStateSet( osg::StateSet* ss )
+{
+    if( ss == NULL )
+        return;
+
+    _stateSets++;
+    _uStateSets.insert( ss );
+    addSubgraphCost( 0, 0, 1, 0 );
+
+    const osg::StateSet::TextureAttributeList& tal( ss->getTextureAttributeList() );
+    osg::StateSet::TextureAttributeList::const_iterator talit;
+    for( talit = tal.begin(); talit != tal.end(); ++talit )
+    {
+        osg::StateSet::AttributeList::const_iterator alit;
+        for( alit = talit->begin(); alit != talit->end(); ++alit )
+        {
+            const osg::Texture* tex( alit->second.first->asTexture() );
+            if( tex == NULL )
+                continue;
+
+            _textures++;
+            _uTextures.insert( tex );
+            for( unsigned int idx=0; idx<tex->getNumImages(); ++idx )
+            {
+                const osg::Image* image( tex->getImage( idx ) );
+                if( image == NULL )
+                    continue;
+
+                unsigned long long bytes( image->getTotalSizeInBytesIncludingMipmaps() );
+                // Mipmaps generated at load time add about a third.
+                const osg::Texture::FilterMode minFilter( tex->getFilter( osg::Texture::MIN_FILTER ) );
+                if( !image->isMipmap() &&
+                    ( minFilter != osg::Texture::LINEAR ) && ( minFilter != osg::Texture::NEAREST ) )
+                    bytes += bytes / 3;
+                addBytes( IMAGE_BYTES, bytes, _uImages.insert( image ) );
+                addSubgraphCost( 0, 0, 0, bytes );
+            }
+        }
+    }
 }
 
 void
 CountsVisitor::apply( osg::Node& node )
 {
+    const bool subgraph( pushSubgraph( node ) );
+
     _nodes++;
-    osg::ref_ptr<osg::Object> rp = (osg::Object*)&node;
-    _uNodes.insert( rp );
+    _uNodes.insert( &node );
+
+    applyStateSet( node.getStateSet() );
 
     if (++_depth > _maxDepth)
         _maxDepth = _depth;
     traverse( node );
     _depth--;
+
+    popSubgraph( subgraph );
 }
 
 void
 CountsVisitor::apply( osg::Group& node )
 {
+    const bool subgraph( pushSubgraph( node ) );
+
     _groups++;
-    osg::ref_ptr<osg::Object> rp = (osg::Object*)&node;
-    _uGroups.insert( rp );
+    _uGroups.insert( &node );
     _totalChildren += node.getNumChildren();
 
+    applyStateSet( node.getStateSet() );
+
     if (++_depth > _maxDepth)
         _maxDepth = _depth;
     traverse( (osg::Node&)node );
     _depth--;
+
+    popSubgraph( subgraph );
 }
 
 void
 CountsVisitor::apply( osg::LOD& node )
 {
+    const bool subgraph( pushSubgraph( node ) );
+
     _lods++;
-    osg::ref_ptr<osg::Object> rp = (osg::Object*)&node;
-    _uLods.insert( rp );
+    _uLods.insert( &node );
     _totalChildren += node.getNumChildren();
 
+    applyStateSet( node.getStateSet() );
+
     if (++_depth > _maxDepth)
         _maxDepth = _depth;
     traverse( (osg::Node&)node );
     _depth--;
+
+    popSubgraph( subgraph );
 }
 
 void
 CountsVisitor::apply( osg::PagedLOD& node )
 {
+    const bool subgraph( pushSubgraph( node ) );
+
     osg::Group* grp = node.getParent(0);
     osg::Group* gPar = NULL;
     if (grp)
         gPar = grp->getParent(0);
 
     _pagedLods++;
-    osg::ref_ptr<osg::Object> rp = (osg::Object*)&node;
-    _uPagedLods.insert( rp );
+    _uPagedLods.insert( &node );
     _totalChildren += node.getNumChildren();
 
+    applyStateSet( node.getStateSet() );
+
     if (++_depth > _maxDepth)
         _maxDepth = _depth;
     traverse( (osg::Node&)node );
     _depth--;
+
+    popSubgraph( subgraph );
 }
 
 void
 CountsVisitor::apply( osg::Switch& node )
 {
+    const bool subgraph( pushSubgraph( node ) );
+
     _switches++;
-    osg::ref_ptr<osg::Object> rp = (osg::Object*)&node;
-    _uSwitches.insert( rp );
+    _uSwitches.insert( &node );
     _totalChildren += node.getNumChildren();
 
+    applyStateSet( node.getStateSet() );
+
     if (++_depth > _maxDepth)
         _maxDepth = _depth;
     traverse( (osg::Node&)node );
     _depth--;
+
+    popSubgraph( subgraph );
 }
 
 void
 CountsVisitor::apply( osg::Sequence& node )
 {
+    const bool subgraph( pushSubgraph( node ) );
+
     _sequences++;
-    osg::ref_ptr<osg::Object> rp = (osg::Object*)&node;
-    _uSequences.insert( rp );
+    _uSequences.insert( &node );
     _totalChildren += node.getNumChildren();
 
+    applyStateSet( node.getStateSet() );
+
     if (++_depth > _maxDepth)
         _maxDepth = _depth;
     traverse( (osg::Node&)node );
     _depth--;
+
+    popSubgraph( subgraph );
 }
 
 void
 CountsVisitor::apply( osg::Transform& node )
 {
+    const bool subgraph( pushSubgraph( node ) );
+
     if (dynamic_cast<osgSim::DOFTransform*>( &node ) != NULL)
     {
         _dofTransforms++;
-        osg::ref_ptr<osg::Object> rp = (osg::Object*)&node;
-        _uDofTransforms.insert( rp );
+        _uDofTransforms.insert( &node );
     }
     else
     {
         _transforms++;
-        osg::ref_ptr<osg::Object> rp = (osg::Object*)&node;
-        _uTransforms.insert( rp );
+        _uTransforms.insert( &node );
     }
     _totalChildren += node.getNumChildren();
 
+    applyStateSet( node.getStateSet() );
+
     if (++_depth > _maxDepth)
         _maxDepth = _depth;
     traverse( (osg::Node&)node );
     _depth--;
+
+    popSubgraph( subgraph );
 }
 
 void
 CountsVisitor::apply( osg::MatrixTransform& node )
 {
+    const bool subgraph( pushSubgraph( node ) );
+
     _matrixTransforms++;
-    osg::ref_ptr<osg::Object> rp = (osg::Object*)&node;
-    _uMatrixTransforms.insert( rp );
+    _uMatrixTransforms.insert( &node );
     _totalChildren += node.getNumChildren();
 
+    applyStateSet( node.getStateSet() );
+
     if (++_depth > _maxDepth)
         _maxDepth = _depth;
     traverse( (osg::Node&)node );
     _depth--;
+
+    popSubgraph( subgraph );
 }
 
 void
 CountsVisitor::apply( osg::Geode& node )
 {
+    const bool subgraph( pushSubgraph( node ) );
+
     _geodes++;
-    osg::ref_ptr<osg::Object> rp = (osg::Object*)&node;
-    _uGeodes.insert( rp );
+    _uGeodes.insert( &node );
 
     unsigned int idx;
     for (idx=0; idx<node.getNumDrawables(); idx++)
     {
+        applyStateSet( node.getDrawable( idx )->getStateSet() );
+        addSubgraphCost( 0, 1, 0, 0 );
+
         osg::Geometry* geom;
         if (dynamic_cast<osgText::Text*>( node.getDrawable( idx ) ) != NULL)
         {
             _texts++;
-            osg::ref_ptr<osg::Object> rp = (osg::Object*)node.getDrawable( idx );
-            _uTexts.insert( rp );
+            _uTexts.insert( node.getDrawable( idx ) );
         }
         else if ( (geom = dynamic_cast<osg::Geometry*>( node.getDrawable( idx ) )) != NULL)
         {
             _geometries++;
-            osg::ref_ptr<osg::Object> rp = (osg::Object*)geom;
-            _uGeometries.insert( rp );
+            _uGeometries.insert( geom );
 
             if (!geom->areFastPathsUsed())
                 _slowPathGeometries++;
 
             if (geom->getVertexArray())
+            {
                 _vertices += geom->getVertexArray()->getNumElements();
+                addSubgraphCost( geom->getVertexArray()->getNumElements(), 0, 0, 0 );
+            }
             else
                 _nullGeometries++;
-            osg::ref_ptr<osg::Object> rpv = (osg::Object*)( geom->getVertexArray() );
-            _uVertices.insert( rpv );
+            addArrayBytes( VERTEX_BYTES, _uVertices, geom->getVertexArray() );
+            addArrayBytes( NORMAL_BYTES, _uNormals, geom->getNormalArray() );
+            addArrayBytes( COLOR_BYTES, _uColors, geom->getColorArray() );
+            addArrayBytes( OTHER_ARRAY_BYTES, _uOtherArrays, geom->getSecondaryColorArray() );
+            addArrayBytes( OTHER_ARRAY_BYTES, _uOtherArrays, geom->getFogCoordArray() );
+            unsigned int unit;
+            for( unit=0; unit<geom->getNumTexCoordArrays(); ++unit )
+                addArrayBytes( TEXCOORD_BYTES, _uTexCoords, geom->getTexCoordArray( unit ) );
+            for( unit=0; unit<geom->getNumVertexAttribArrays(); ++unit )
+                addArrayBytes( OTHER_ARRAY_BYTES, _uOtherArrays, geom->getVertexAttribArray( unit ) );
 
             if( geom->getNumPrimitiveSets() > 0 )
             {
@@ -285,14 +788,26 @@ CountsVisitor::apply( osg::Geode& node )
                 osg::Geometry::PrimitiveSetList::const_iterator pslit;
                 for( pslit = psl.begin(); pslit != psl.end(); pslit++ )
                 {
-                    osg::ref_ptr<osg::Object> rpps = (osg::Object*)( pslit->get() );
-                    _uPrimitiveSets.insert( rpps );
+                    const bool uniquePS( _uPrimitiveSets.insert( pslit->get() ) );
+                    switch( (*pslit)->getType() )
+                    {
+                    case osg::PrimitiveSet::DrawElementsUBytePrimitiveType:
+                        addBytes( UBYTE_INDEX_BYTES, (*pslit)->getTotalDataSize(), uniquePS );
+                        break;
+                    case osg::PrimitiveSet::DrawElementsUShortPrimitiveType:
+                        addBytes( USHORT_INDEX_BYTES, (*pslit)->getTotalDataSize(), uniquePS );
+                        break;
+                    case osg::PrimitiveSet::DrawElementsUIntPrimitiveType:
+                        addBytes( UINT_INDEX_BYTES, (*pslit)->getTotalDataSize(), uniquePS );
+                        break;
+                    default:
+                        break;
+                    }
                     const osg::DrawArrays* da = dynamic_cast< const osg::DrawArrays* >( pslit->get() );
                     if( da )
                     {
                         _drawArrays++;
-                        osg::ref_ptr<osg::Object> rpda = (osg::Object*)( da );
-                        _uDrawArrays.insert( rpda );
+                        _uDrawArrays.insert( da );
                     }
                 }
             }
@@ -300,13 +815,16 @@ CountsVisitor::apply( osg::Geode& node )
         else
         {
             _drawables++;
-            osg::ref_ptr<osg::Object> rp = (osg::Object*)node.getDrawable( idx );
-            _uDrawables.insert( rp );
+            _uDrawables.insert( node.getDrawable( idx ) );
         }
     }
 
+    applyStateSet( node.getStateSet() );
+
     if (++_depth > _maxDepth)
         _maxDepth = _depth;
     traverse( (osg::Node&)node );
     _depth--;
+
+    popSubgraph( subgraph );
 }
@@ -8,6 +8,59 @@
 
 #include <osg/NodeVisitor>
 #include <set>
+#include <vector>
+#include <iostream>
+#include <string>
+
+
+/** \brief Open-addressing hash set of raw pointers.
+\details Linear probing in a single power-of-two slot array that doubles
+at 50% load. reserve() presizes the slot array so a traversal of known
+size never rehashes, and clear() keeps the allocation for reuse. */
+class PointerSet
+{
+public:
+    PointerSet();
+
+    void reserve( unsigned int n );
+    /** Returns true if \c ptr was not already in the set. */
+    bool insert( const void* ptr );
+    unsigned int size() const;
+    void clear();
+
+protected:
+    void rehash( unsigned int capacity );
+
+    std::vector< const void* > _slots;
+    /** 64 minus log2 of the slot count. */
+    unsigned int _shift;
+    unsigned int _size;
+    bool _hasNull;
+};
+
+/** \brief Set of unique osg::Objects.
+\details By default, holds a ref_ptr to each Object in a std::set. In
+fast mode, holds raw pointers in a PointerSet instead, which avoids a
+tree node allocation and a reference count bump per insert. Fast mode
+assumes the scene graph outlives the set. */
+class ObjectSet
+{
+public:
+    ObjectSet();
+
+    void setFastMode( bool fast, unsigned int expected=0 );
+
+    /** Returns true if \c obj was not already in the set. */
+    bool insert( const osg::Object* obj );
+    unsigned int size() const;
+    void clear();
+
+protected:
+    bool _fast;
+    std::set< osg::ref_ptr< osg::Object > > _objects;
+    PointerSet _pointers;
+};
+
 
 class CountsVisitor : public osg::NodeVisitor
 {
@@ -17,7 +70,19 @@ public:
 
     void reset();
 
-    void dump();
+    /** Track unique objects in hash sets of raw pointers rather than
+    std::sets of ref_ptrs. \c expectedObjects presizes the node, Geode,
+    Drawable and vertex, normal, color and texture coordinate array sets;
+    pass the approximate node count of the scene graph. Call before
+    traversing. */
+    void setFastMode( bool fast, unsigned int expectedObjects=0 );
+    bool getFastMode() const;
+
+    void dump( std::ostream& ostr=std::cout );
+    /** Machine-readable versions of dump(). Both list every object
+    count and byte total with its unique (shared-once) counterpart. */
+    void dumpCSV( std::ostream& ostr );
+    void dumpJSON( std::ostream& ostr );
 
     void apply( osg::Node& node );
     void apply( osg::Group& node );
@@ -32,7 +97,83 @@ public:
     int getVertices() const;
     int getDrawArrays() const;
 
+    /** Memory footprint categories. Array categories count the array
+    data; index categories count DrawElements data by index type;
+    ImageBytes counts Texture Image data including mipmaps. */
+    enum ByteCategory {
+        VERTEX_BYTES,
+        NORMAL_BYTES,
+        COLOR_BYTES,
+        TEXCOORD_BYTES,
+        OTHER_ARRAY_BYTES,
+        UBYTE_INDEX_BYTES,
+        USHORT_INDEX_BYTES,
+        UINT_INDEX_BYTES,
+        IMAGE_BYTES,
+        NUM_BYTE_CATEGORIES
+    };
+    /** Bytes referenced in the scene graph, counting shared
+    data once per reference. */
+    unsigned long long getTotalBytes( ByteCategory category ) const;
+    /** Bytes referenced in the scene graph, counting shared data once. */
+    unsigned long long getUniqueBytes( ByteCategory category ) const;
+
+    /** Attribute costs to named subgraphs. Every named node at
+    \c depth or above (the root is at depth 1) collects the vertices,
+    Drawables, StateSets and texture bytes of its subgraph, including
+    nested named subgraphs. Shared subgraphs are charged once per
+    instance. 0 disables the attribution. Default: 0. */
+    void setSubgraphDepth( unsigned int depth );
+    unsigned int getSubgraphDepth() const;
+
+    enum SubgraphSortKey {
+        SORT_VERTICES,
+        SORT_DRAWABLES,
+        SORT_STATESETS,
+        SORT_TEXTURE_BYTES
+    };
+    /** Write the \c topN most expensive named subgraphs, by \c key. */
+    void dumpSubgraphs( std::ostream& ostr, unsigned int topN=10, SubgraphSortKey key=SORT_VERTICES );
+
+    struct SubgraphCost
+    {
+        SubgraphCost( const std::string& path, int depth );
+        unsigned long long get( SubgraphSortKey key ) const;
+
+        std::string _path;
+        int _depth;
+        unsigned int _vertices;
+        unsigned int _drawables;
+        unsigned int _stateSets;
+        unsigned long long _textureBytes;
+    };
+
 protected:
+    void applyStateSet( osg::StateSet* ss );
+    void addArrayBytes( ByteCategory category, ObjectSet& uSet, const osg::Array* array );
+    void addBytes( ByteCategory category, const unsigned long long bytes, const bool unique );
+
+    bool pushSubgraph( osg::Node& node );
+    void popSubgraph( const bool pushed );
+    void addSubgraphCost( unsigned int vertices, unsigned int drawables,
+        unsigned int stateSets, unsigned long long textureBytes );
+
+    unsigned int _subgraphDepth;
+    typedef std::vector< SubgraphCost > SubgraphCostList;
+    SubgraphCostList _subgraphs;
+    std::vector< unsigned int > _subgraphStack;
+
+    struct CountRow
+    {
+        CountRow( const std::string& name, unsigned long long count, unsigned long long unique )
+          : _name( name ), _count( count ), _unique( unique ) {}
+        std::string _name;
+        unsigned long long _count;
+        unsigned long long _unique;
+    };
+    typedef std::vector< CountRow > CountRowList;
+    void getRows( CountRowList& rows ) const;
+
     int _depth;
     int _maxDepth;
 
@@ -59,7 +200,11 @@ protected:
     int _totalChildren;
     int _slowPathGeometries;
 
-    typedef std::set< osg::ref_ptr<osg::Object> > ObjectSet;
+    unsigned long long _totalBytes[ NUM_BYTE_CATEGORIES ];
+    unsigned long long _uniqueBytes[ NUM_BYTE_CATEGORIES ];
+
+    bool _fast;
+
     ObjectSet _uNodes;
     ObjectSet _uGroups;
     ObjectSet _uLods;
@@ -78,6 +223,11 @@ protected:
     ObjectSet _uTextures;
     ObjectSet _uPrimitiveSets;
     ObjectSet _uDrawArrays;
+    ObjectSet _uNormals;
+    ObjectSet _uColors;
+    ObjectSet _uTexCoords;
+    ObjectSet _uOtherArrays;
+    ObjectSet _uImages;
 };
 
 #endif
@@ -5,6 +5,7 @@
 
 #include "CountsVisitor.h"
 #include "OptVisitor.h"
+#include "WeldVisitor.h"
 #include <osgViewer/Viewer>
 #include <osgViewer/ViewerEventHandlers>
 #include <osgDB/ReadFile>
@@ -12,8 +13,11 @@
 
 #include <osg/io_utils>
 #include <iostream>
+#include <fstream>
 
-void optimizeForDrawElements( osg::Node& root, const float ratioThreshold=.05f )
+void optimizeForDrawElements( osg::Node& root, const float ratioThreshold=.05f, const int numThreads=1,
+                              const bool smallestIndexType=false, const bool weld=false,
+                              const bool strips=false, const bool primitiveRestart=true )
 {
     CountsVisitor cv;
     root.accept( cv );
@@ -29,11 +33,29 @@ void optimizeForDrawElements( osg::Node& root, const float ratioThreshold=.05f )
     osg::notify( osg::INFO ) << "Converting DrawArrays to DrawElementsUInt." << std::endl;
     OptVisitor ov;
     ov.changeDAtoDEUI_ = true;
+    ov.smallestIndexType_ = smallestIndexType;
+    ov.stripOutput_ = strips;
+    ov.primitiveRestart_ = primitiveRestart;
     ov.changeDLtoVBO_ = true;
     ov.changeVBOtoDL_ = false;
     ov.changeDynamicToStatic_ = false;
+    if( numThreads != 1 )
+    {
+        // Collect unique Geometries, then convert them in parallel.
+        ov.deferConversion_ = true;
+        ov.numThreads_ = ( numThreads < 0 ) ? 0 : numThreads;
+    }
     root.accept( ov );
+    ov.processGeometries();
     ov.dump( osg::notify( osg::ALWAYS ) );
+
+    if( weld )
+    {
+        osg::notify( osg::INFO ) << "Welding duplicate vertices." << std::endl;
+        WeldVisitor wv;
+        root.accept( wv );
+        wv.dump( osg::notify( osg::ALWAYS ) );
+    }
 }
 
 void convertToDL( osg::Node& root )
@@ -70,13 +92,39 @@ void convertToVBO( osg::Node& root )
 
 int main( int argc, char** argv )
 {
-    if( argc != 2 )
+    osg::ArgumentParser arguments( &argc, argv );
+
+    // --deui converts DrawArrays to DrawElementsUInt instead of DLs to VBOs.
+    // --threads <n> runs the conversion on n threads; 0 uses all processors.
+    // --smallest-index emits UByte/UShort indices when the vertex count allows.
+    const bool deui( arguments.read( "--deui" ) );
+    int numThreads( 1 );
+    arguments.read( "--threads", numThreads );
+    const bool smallestIndex( arguments.read( "--smallest-index" ) );
+    // --weld collapses duplicate vertices after the conversion.
+    // --strips merges TriStrips with primitive restart; --degenerate
+    // stitches them with degenerate triangles instead.
+    const bool weld( arguments.read( "--weld" ) );
+    const bool degenerate( arguments.read( "--degenerate" ) );
+    const bool strips( arguments.read( "--strips" ) || degenerate );
+    // --counts-csv <file> and --counts-json <file> write object counts
+    // and memory footprint of the output scene graph.
+    std::string csvFile, jsonFile;
+    arguments.read( "--counts-csv", csvFile );
+    arguments.read( "--counts-json", jsonFile );
+    // --hotspots <depth> lists the most expensive named subgraphs down
+    // to <depth> in the input scene graph; --top <n> sets how many.
+    unsigned int hotspotDepth( 0 ), topN( 10 );
+    arguments.read( "--hotspots", hotspotDepth );
+    arguments.read( "--top", topN );
+
+    if( arguments.argc() != 2 )
     {
         osg::notify( osg::FATAL ) << "Must specify input file." << std::endl;
         return( 1 );
     }
 
-    std::string inFile( argv[ 1 ] );
+    std::string inFile( arguments[ 1 ] );
     std::string outFile( "out.ive" );
 
     osg::ref_ptr< osg::Node > root = osgDB::readNodeFile( inFile );
@@ -86,12 +134,39 @@ int main( int argc, char** argv )
         return 1;
     }
 
-    //optimizeForDrawElements( *root, 0. );
+    if( hotspotDepth > 0 )
+    {
+        CountsVisitor cv;
+        cv.setSubgraphDepth( hotspotDepth );
+        root->accept( cv );
+        cv.dumpSubgraphs( std::cout, topN );
+    }
+
     //convertToDL( *root );
-    convertToVBO( *root );
+    if( deui )
+        optimizeForDrawElements( *root, 0., numThreads, smallestIndex, weld,
+            strips, !degenerate );
+    else
+        convertToVBO( *root );
 
     osgDB::writeNodeFile( *root, outFile );
 
+    if( !csvFile.empty() || !jsonFile.empty() )
+    {
+        CountsVisitor cv;
+        root->accept( cv );
+        if( !csvFile.empty() )
+        {
+            std::ofstream ostr( csvFile.c_str() );
+            cv.dumpCSV( ostr );
+        }
+        if( !jsonFile.empty() )
+        {
+            std::ofstream ostr( jsonFile.c_str() );
+            cv.dumpJSON( ostr );
+        }
+    }
+
     osgViewer::Viewer viewer;
     viewer.addEventHandler( new osgViewer::StatsHandler );
     viewer.setSceneData( root.get() );
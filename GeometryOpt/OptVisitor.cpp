@@ -6,22 +6,115 @@
 #include "OptVisitor.h"
 #include <osg/Geode>
 #include <osg/Geometry>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
 
 #include <osg/io_utils>
+#include <algorithm>
 #include <iostream>
 #include <set>
 
 
+#ifndef GL_PRIMITIVE_RESTART_FIXED_INDEX
+#  define GL_PRIMITIVE_RESTART_FIXED_INDEX 0x8D69
+#endif
+
+
+OptVisitor::ConversionCounts::ConversionCounts()
+  : triangles_( 0 ),
+    triFans_( 0 ),
+    triStrips_( 0 ),
+    newDEUIs_( 0 ),
+    newDEUSs_( 0 ),
+    newDEUBs_( 0 ),
+    indexBytesSaved_( 0 ),
+    newStripDEs_( 0 ),
+    stripIndicesAsTriangles_( 0 ),
+    stripIndicesOut_( 0 ),
+    restartGeometries_( 0 )
+{
+}
+
+void
+OptVisitor::ConversionCounts::add( const ConversionCounts& rhs )
+{
+    triangles_ += rhs.triangles_;
+    triFans_ += rhs.triFans_;
+    triStrips_ += rhs.triStrips_;
+    newDEUIs_ += rhs.newDEUIs_;
+    newDEUSs_ += rhs.newDEUSs_;
+    newDEUBs_ += rhs.newDEUBs_;
+    indexBytesSaved_ += rhs.indexBytesSaved_;
+    newStripDEs_ += rhs.newStripDEs_;
+    stripIndicesAsTriangles_ += rhs.stripIndicesAsTriangles_;
+    stripIndicesOut_ += rhs.stripIndicesOut_;
+    restartGeometries_ += rhs.restartGeometries_;
+}
+
+
+// Worker for processGeometries(). Each worker owns one contiguous chunk
+// of the Geometry list and claims Geometries from it through an atomic
+// cursor. Once its own chunk is drained, it steals from the other chunks
+// the same way, so a worker stuck on a few huge Geometries doesn't hold
+// up the rest. Counts accumulate per worker and are summed after join(),
+// so the totals need no locking and match a serial run.
+class OptVisitor::ConversionThread : public OpenThreads::Thread
+{
+public:
+    struct Chunk
+    {
+        Chunk() : begin_( 0 ), end_( 0 ) {}
+
+        unsigned int begin_;
+        unsigned int end_;
+        OpenThreads::Atomic claimed_;
+    };
+
+    ConversionThread( OptVisitor* ov, Chunk* chunks, unsigned int numChunks, unsigned int home )
+      : ov_( ov ),
+        chunks_( chunks ),
+        numChunks_( numChunks ),
+        home_( home )
+    {
+    }
+
+    virtual void run()
+    {
+        for( unsigned int idx=0; idx<numChunks_; ++idx )
+        {
+            Chunk& chunk( chunks_[ ( home_ + idx ) % numChunks_ ] );
+            unsigned int geomIdx;
+            while( ( geomIdx = chunk.begin_ + ( ++chunk.claimed_ ) - 1 ) < chunk.end_ )
+                ov_->convertGeometry( *( ov_->geometries_[ geomIdx ] ), counts_ );
+        }
+    }
+
+    ConversionCounts counts_;
+
+protected:
+    OptVisitor* ov_;
+    Chunk* chunks_;
+    unsigned int numChunks_;
+    unsigned int home_;
+};
+
+
+const GLuint OptVisitor::restartIndex_( 0xffffffff );
+
+
 OptVisitor::OptVisitor()
   : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ),
     changeDLtoVBO_( false ),
     changeVBOtoDL_( false ),
     changeDynamicToStatic_( false ),
     changeDAtoDEUI_( false ),
-    triangles_( 0 ),
-    triFans_( 0 ),
-    triStrips_( 0 ),
-    newDEUIs_( 0 ),
+    smallestIndexType_( false ),
+    stripOutput_( false ),
+    primitiveRestart_( true ),
+    deferConversion_( false ),
+    numThreads_( 0 ),
     DLtoVBO_( 0 ),
     VBOtoDL_( 0 )
 {
@@ -64,49 +157,238 @@ OptVisitor::apply( osg::Geode& geode )
         osg::Geometry* geom = dynamic_cast< osg::Geometry* >( draw );
         if( ( geom != NULL ) && changeDAtoDEUI_ )
         {
-            osg::ref_ptr< osg::DrawElementsUInt > deui = new osg::DrawElementsUInt( GL_TRIANGLES );
+            if( !deferConversion_ )
+                convertGeometry( *geom, counts_ );
+            else if( uniqueGeometries_.insert( geom ).second )
+                geometries_.push_back( geom );
+        }
+    }
+}
+
+void
+OptVisitor::processGeometries()
+{
+    const unsigned int numGeoms( geometries_.size() );
+    unsigned int numThreads( numThreads_ );
+    if( numThreads == 0 )
+        numThreads = OpenThreads::GetNumberOfProcessors();
+    numThreads = osg::minimum( numThreads, numGeoms );
 
-            unsigned int numPS( geom->getNumPrimitiveSets() );
-            while( numPS > 0 )
+    if( numThreads <= 1 )
+    {
+        GeometryList::const_iterator it;
+        for( it = geometries_.begin(); it != geometries_.end(); ++it )
+            convertGeometry( *( it->get() ), counts_ );
+    }
+    else
+    {
+        osg::notify( osg::INFO ) << "OptVisitor: Converting " << numGeoms <<
+            " Geometries on " << numThreads << " threads." << std::endl;
+
+        ConversionThread::Chunk* chunks = new ConversionThread::Chunk[ numThreads ];
+        std::vector< ConversionThread* > threads;
+        unsigned int idx;
+        for( idx=0; idx<numThreads; ++idx )
+        {
+            chunks[ idx ].begin_ = numGeoms * idx / numThreads;
+            chunks[ idx ].end_ = numGeoms * ( idx+1 ) / numThreads;
+        }
+        for( idx=0; idx<numThreads; ++idx )
+        {
+            threads.push_back( new ConversionThread( this, chunks, numThreads, idx ) );
+            threads.back()->start();
+        }
+        for( idx=0; idx<numThreads; ++idx )
+        {
+            threads[ idx ]->join();
+            counts_.add( threads[ idx ]->counts_ );
+            delete threads[ idx ];
+        }
+        delete[] chunks;
+    }
+
+    geometries_.clear();
+    uniqueGeometries_.clear();
+}
+
+void
+OptVisitor::convertGeometry( osg::Geometry& geom, ConversionCounts& counts )
+{
+    osg::ref_ptr< osg::DrawElementsUInt > deui = new osg::DrawElementsUInt( GL_TRIANGLES );
+    osg::ref_ptr< osg::DrawElementsUInt > strip = new osg::DrawElementsUInt( GL_TRIANGLE_STRIP );
+
+    // Fixed-index restart turns the maximum index of every type into a
+    // restart marker for the whole Geometry, so don't use it if an
+    // existing DrawElements already draws that index.
+    const bool restart( stripOutput_ && primitiveRestart_ && !usesMaxIndex( geom ) );
+
+    unsigned int numPS( geom.getNumPrimitiveSets() );
+    while( numPS > 0 )
+    {
+        numPS--;
+        osg::PrimitiveSet* ps( geom.getPrimitiveSet( numPS ) );
+        if( ps->getType() == osg::PrimitiveSet::DrawArraysPrimitiveType )
+        {
+            osg::DrawArrays* da = dynamic_cast< osg::DrawArrays* >( ps );
+            if( ps->getMode() == osg::PrimitiveSet::TRIANGLES )
+            {
+                processTriangles( *da, *deui );
+                ++counts.triangles_;
+                geom.removePrimitiveSet( numPS );
+            }
+            else if( ps->getMode() == osg::PrimitiveSet::TRIANGLE_FAN )
+            {
+                processTriFan( *da, *deui );
+                ++counts.triFans_;
+                geom.removePrimitiveSet( numPS );
+            }
+            else if( ps->getMode() == osg::PrimitiveSet::TRIANGLE_STRIP )
             {
-                numPS--;
-                osg::PrimitiveSet* ps( geom->getPrimitiveSet( numPS ) );
-                if( ps->getType() == osg::PrimitiveSet::DrawArraysPrimitiveType )
+                if( stripOutput_ )
                 {
-                    osg::DrawArrays* da = dynamic_cast< osg::DrawArrays* >( ps );
-                    if( ps->getMode() == osg::PrimitiveSet::TRIANGLES )
-                    {
-                        processTriangles( *da, *deui );
-                        geom->removePrimitiveSet( numPS );
-                    }
-                    else if( ps->getMode() == osg::PrimitiveSet::TRIANGLE_FAN )
-                    {
-                        processTriFan( *da, *deui );
-                        geom->removePrimitiveSet( numPS );
-                    }
-                    else if( ps->getMode() == osg::PrimitiveSet::TRIANGLE_STRIP )
-                    {
-                        processTriStrip( *da, *deui );
-                        geom->removePrimitiveSet( numPS );
-                    }
+                    appendTriStrip( *da, *strip, restart );
+                    if( da->getCount() >= 3 )
+                        counts.stripIndicesAsTriangles_ += ( da->getCount() - 2 ) * 3;
                 }
+                else
+                    processTriStrip( *da, *deui );
+                ++counts.triStrips_;
+                geom.removePrimitiveSet( numPS );
             }
+        }
+    }
 
-            // Create the new DEUI.
-            if( deui->size() > 0 )
-            {
-                geom->addPrimitiveSet( deui.get() );
-                newDEUIs_++;
-            }
+    // Restart is enabled only if the merged strip actually needs it.
+    // Every DrawElements generated for that Geometry must then keep
+    // clear of the maximum index of its type.
+    bool restartUsed( false );
+    if( restart )
+        restartUsed = ( std::find( strip->begin(), strip->end(), restartIndex_ ) != strip->end() );
+
+    // Create the new DEUI.
+    if( deui->size() > 0 )
+    {
+        if( smallestIndexType_ )
+            geom.addPrimitiveSet( createSmallestDrawElements( geom, *deui, restartUsed, counts ) );
+        else
+        {
+            geom.addPrimitiveSet( deui.get() );
+            ++counts.newDEUIs_;
         }
     }
+
+    // Create the merged strip.
+    if( strip->size() > 0 )
+    {
+        counts.stripIndicesOut_ += strip->size();
+        ++counts.newStripDEs_;
+        if( smallestIndexType_ )
+            geom.addPrimitiveSet( createSmallestDrawElements( geom, *strip, restartUsed, counts ) );
+        else
+        {
+            geom.addPrimitiveSet( strip.get() );
+            ++counts.newDEUIs_;
+        }
+    }
+
+    if( restartUsed )
+    {
+        enableRestart( geom );
+        ++counts.restartGeometries_;
+    }
+}
+
+bool
+OptVisitor::usesMaxIndex( const osg::Geometry& geom )
+{
+    for( unsigned int idx=0; idx<geom.getNumPrimitiveSets(); ++idx )
+    {
+        const osg::PrimitiveSet* ps( geom.getPrimitiveSet( idx ) );
+        unsigned int maxIndex;
+        switch( ps->getType() )
+        {
+        case osg::PrimitiveSet::DrawElementsUBytePrimitiveType: maxIndex = 0xff; break;
+        case osg::PrimitiveSet::DrawElementsUShortPrimitiveType: maxIndex = 0xffff; break;
+        case osg::PrimitiveSet::DrawElementsUIntPrimitiveType: maxIndex = 0xffffffff; break;
+        default: continue;
+        }
+        for( unsigned int jdx=0; jdx<ps->getNumIndices(); ++jdx )
+        {
+            if( ps->index( jdx ) == maxIndex )
+                return( true );
+        }
+    }
+    return( false );
 }
 
 void
-OptVisitor::processTriangles( const osg::DrawArrays& da, osg::VectorGLuint& indices )
+OptVisitor::enableRestart( osg::Geometry& geom )
+{
+    // Geometries may be converted on several threads, and they
+    // may share a StateSet.
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( restartMutex_ );
+
+    // Scope the mode to this Geometry. A StateSet shared with other
+    // Drawables is copied, so restart doesn't leak into their indices.
+    osg::StateSet* ss( geom.getStateSet() );
+    if( ss == NULL )
+        ss = geom.getOrCreateStateSet();
+    else if( ss->getNumParents() > 1 )
+    {
+        ss = new osg::StateSet( *ss );
+        geom.setStateSet( ss );
+    }
+    ss->setMode( GL_PRIMITIVE_RESTART_FIXED_INDEX, osg::StateAttribute::ON );
+}
+
+osg::DrawElements*
+OptVisitor::createSmallestDrawElements( const osg::Geometry& geom,
+        osg::DrawElementsUInt& deui, const bool restart, ConversionCounts& counts )
 {
-    ++triangles_;
+    // The index type must address every vertex, not just the
+    // ones referenced by this primitive set. With restart enabled
+    // on the Geometry, the maximum value of the type is reserved,
+    // whether or not this primitive set contains a restart.
+    unsigned int numVerts( 0 );
+    if( geom.getVertexArray() != NULL )
+        numVerts = geom.getVertexArray()->getNumElements();
+    osg::DrawElementsUInt::const_iterator it;
+    for( it = deui.begin(); it != deui.end(); ++it )
+    {
+        if( *it != restartIndex_ )
+            numVerts = osg::maximum( numVerts, *it + 1 );
+    }
+    if( restart )
+        ++numVerts;
+
+    if( numVerts <= 256 )
+    {
+        osg::DrawElementsUByte* deub = new osg::DrawElementsUByte( deui.getMode() );
+        deub->reserve( deui.size() );
+        for( it = deui.begin(); it != deui.end(); ++it )
+            deub->push_back( ( *it == restartIndex_ ) ? 0xff : (GLubyte)( *it ) );
+        ++counts.newDEUBs_;
+        counts.indexBytesSaved_ += deui.size() * ( sizeof( GLuint ) - sizeof( GLubyte ) );
+        return( deub );
+    }
+    else if( numVerts <= 65536 )
+    {
+        osg::DrawElementsUShort* deus = new osg::DrawElementsUShort( deui.getMode() );
+        deus->reserve( deui.size() );
+        for( it = deui.begin(); it != deui.end(); ++it )
+            deus->push_back( ( *it == restartIndex_ ) ? 0xffff : (GLushort)( *it ) );
+        ++counts.newDEUSs_;
+        counts.indexBytesSaved_ += deui.size() * ( sizeof( GLuint ) - sizeof( GLushort ) );
+        return( deus );
+    }
 
+    ++counts.newDEUIs_;
+    return( &deui );
+}
+
+void
+OptVisitor::processTriangles( const osg::DrawArrays& da, osg::VectorGLuint& indices )
+{
     GLint first = da.getFirst();
     GLsizei count = da.getCount();
 
@@ -124,8 +406,6 @@ OptVisitor::processTriangles( const osg::DrawArrays& da, osg::VectorGLuint& indi
 void
 OptVisitor::processTriFan( const osg::DrawArrays& da, osg::VectorGLuint& indices )
 {
-    ++triFans_;
-
     GLint first = da.getFirst();
     GLsizei count = da.getCount();
 
@@ -143,8 +423,6 @@ OptVisitor::processTriFan( const osg::DrawArrays& da, osg::VectorGLuint& indices
 void
 OptVisitor::processTriStrip( const osg::DrawArrays& da, osg::VectorGLuint& indices )
 {
-    ++triStrips_;
-
     GLint first = da.getFirst();
     GLsizei count = da.getCount();
 
@@ -160,14 +438,58 @@ OptVisitor::processTriStrip( const osg::DrawArrays& da, osg::VectorGLuint& indic
     }
 }
 
+void
+OptVisitor::appendTriStrip( const osg::DrawArrays& da, osg::VectorGLuint& indices, const bool restart )
+{
+    GLint first = da.getFirst();
+    GLsizei count = da.getCount();
+    if( count < 3 )
+        return;
+
+    if( !indices.empty() )
+    {
+        if( restart )
+            indices.push_back( restartIndex_ );
+        else
+        {
+            // Stitch with degenerate triangles. If the strip so far has
+            // an odd index count, add one more so the next strip starts
+            // on an even triangle and keeps its winding.
+            const bool odd( ( indices.size() & 0x1 ) != 0 );
+            const GLuint last( indices.back() );
+            indices.push_back( last );
+            indices.push_back( first );
+            if( odd )
+                indices.push_back( first );
+        }
+    }
+
+    for( GLsizei idx=0; idx<count; ++idx )
+        indices.push_back( first + idx );
+}
+
 void
 OptVisitor::dump( std::ostream& ostr )
 {
     ostr << "Converted from DrawArrays to DrawElementsUInt:" << std::endl;
-    ostr << "\tTriangles:\t" << triangles_ << std::endl;
-    ostr << "\tTriFans:\t" << triFans_ << std::endl;
-    ostr << "\tTriStripss:\t" << triStrips_ << std::endl;
-    ostr << "Total DrawElementsUInt created: " << newDEUIs_ << std::endl;
+    ostr << "\tTriangles:\t" << counts_.triangles_ << std::endl;
+    ostr << "\tTriFans:\t" << counts_.triFans_ << std::endl;
+    ostr << "\tTriStripss:\t" << counts_.triStrips_ << std::endl;
+    ostr << "Total DrawElementsUInt created: " << counts_.newDEUIs_ << std::endl;
+    if( smallestIndexType_ )
+    {
+        ostr << "Total DrawElementsUShort created: " << counts_.newDEUSs_ << std::endl;
+        ostr << "Total DrawElementsUByte created: " << counts_.newDEUBs_ << std::endl;
+        ostr << "Index bytes saved by smaller index types: " << counts_.indexBytesSaved_ << std::endl;
+    }
+    if( stripOutput_ )
+    {
+        ostr << "Merged TriStrip DrawElements created: " << counts_.newStripDEs_ << std::endl;
+        ostr << "\tStrip indices as triangles:\t" << counts_.stripIndicesAsTriangles_ << std::endl;
+        ostr << "\tStrip indices merged:\t" << counts_.stripIndicesOut_ << std::endl;
+        ostr << "\tIndex count delta:\t" << (int)counts_.stripIndicesOut_ - (int)counts_.stripIndicesAsTriangles_ << std::endl;
+        ostr << "\tGeometries with primitive restart:\t" << counts_.restartGeometries_ << std::endl;
+    }
     if( changeDLtoVBO_ )
         ostr << "DLs converted to VBOs: " << DLtoVBO_ << std::endl;
     if( changeVBOtoDL_ )
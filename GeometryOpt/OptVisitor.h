@@ -9,7 +9,10 @@
 
 #include <osg/NodeVisitor>
 #include <osg/Geometry>
+#include <OpenThreads/Mutex>
 #include <iostream>
+#include <vector>
+#include <set>
 #include <osgwTools/Version.h>
 
 
@@ -31,20 +34,79 @@ public:
     bool changeVBOtoDL_;
     bool changeDynamicToStatic_;
     bool changeDAtoDEUI_;
+    /** If true, the DrawArrays conversion emits DrawElementsUByte or
+    DrawElementsUShort instead of DrawElementsUInt when the Geometry's
+    vertex count allows it. Default: false. */
+    bool smallestIndexType_;
+    /** If true, the DrawArrays conversion merges all TRIANGLE_STRIPs of a
+    Geometry into a single TRIANGLE_STRIP DrawElements instead of expanding
+    them to independent triangles. Default: false. */
+    bool stripOutput_;
+    /** Separate merged strips with the primitive restart index (the maximum
+    value of the index type) when true, or stitch them with degenerate
+    triangles when false. Each Geometry with a restart-separated strip gets
+    GL_PRIMITIVE_RESTART_FIXED_INDEX in its own StateSet, and its other
+    generated DrawElements avoid the maximum index; see restartIndex_.
+    Geometries whose existing DrawElements use the maximum index are
+    stitched with degenerate triangles instead. Default: true. */
+    bool primitiveRestart_;
+
+    /** Restart index used in DrawElementsUInt strips. Smaller index types
+    use the maximum value of their type. */
+    static const GLuint restartIndex_;
+
+    /** If true, apply() only collects unique Geometries for the DrawArrays
+    to DrawElementsUInt conversion. Call processGeometries() after the
+    traversal to convert them on numThreads_ worker threads. Default: false. */
+    bool deferConversion_;
+    /** Worker thread count for processGeometries(). 0 uses one thread
+    per processor. Default: 0. */
+    unsigned int numThreads_;
+
+    void processGeometries();
 
     void dump( std::ostream& ostr );
 
 protected:
+    struct ConversionCounts
+    {
+        ConversionCounts();
+        void add( const ConversionCounts& rhs );
+
+        unsigned int triangles_;
+        unsigned int triFans_;
+        unsigned int triStrips_;
+        unsigned int newDEUIs_;
+        unsigned int newDEUSs_;
+        unsigned int newDEUBs_;
+        unsigned int indexBytesSaved_;
+        unsigned int newStripDEs_;
+        unsigned int stripIndicesAsTriangles_;
+        unsigned int stripIndicesOut_;
+        unsigned int restartGeometries_;
+    };
+    class ConversionThread;
+
+    void convertGeometry( osg::Geometry& geom, ConversionCounts& counts );
+    osg::DrawElements* createSmallestDrawElements( const osg::Geometry& geom,
+        osg::DrawElementsUInt& deui, const bool restart, ConversionCounts& counts );
+    static bool usesMaxIndex( const osg::Geometry& geom );
+    void enableRestart( osg::Geometry& geom );
+
     void processTriangles( const osg::DrawArrays& da, osg::VectorGLuint& indices );
     void processTriFan( const osg::DrawArrays& da, osg::VectorGLuint& indices );
     void processTriStrip( const osg::DrawArrays& da, osg::VectorGLuint& indices );
+    void appendTriStrip( const osg::DrawArrays& da, osg::VectorGLuint& indices, const bool restart );
 
-    unsigned int triangles_;
-    unsigned int triFans_;
-    unsigned int triStrips_;
-    unsigned int newDEUIs_;
+    typedef std::vector< osg::ref_ptr< osg::Geometry > > GeometryList;
+    GeometryList geometries_;
+    std::set< osg::Geometry* > uniqueGeometries_;
+
+    ConversionCounts counts_;
     unsigned int DLtoVBO_;
     unsigned int VBOtoDL_;
+
+    OpenThreads::Mutex restartMutex_;
 };
 
 
@@ -0,0 +1,400 @@
+//
+// Copyright (c) 2009 Skew Matrix Software LLC.
+// All rights reserved.
+//
+
+#include "WeldVisitor.h"
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Array>
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <cstring>
+
+
+// A per-vertex attribute array of a Geometry, plus enough information
+// to put a replacement array back in the same slot.
+struct AttributeSlot
+{
+    enum Kind {
+        VERTEX,
+        NORMAL,
+        COLOR,
+        SECONDARY_COLOR,
+        FOG_COORD,
+        TEXCOORD,
+        VERTEX_ATTRIB
+    };
+
+    AttributeSlot( Kind kind, unsigned int unit, osg::Array* array )
+      : _kind( kind ),
+        _unit( unit ),
+        _array( array )
+    {}
+
+    void setArray( osg::Geometry& geom, osg::Array* array ) const
+    {
+        switch( _kind )
+        {
+        case VERTEX: geom.setVertexArray( array ); break;
+        case NORMAL: geom.setNormalArray( array ); break;
+        case COLOR: geom.setColorArray( array ); break;
+        case SECONDARY_COLOR: geom.setSecondaryColorArray( array ); break;
+        case FOG_COORD: geom.setFogCoordArray( array ); break;
+        case TEXCOORD: geom.setTexCoordArray( _unit, array ); break;
+        case VERTEX_ATTRIB: geom.setVertexAttribArray( _unit, array ); break;
+        }
+    }
+
+    Kind _kind;
+    unsigned int _unit;
+    osg::Array* _array;
+};
+typedef std::vector< AttributeSlot > AttributeSlotList;
+
+
+// Gather the per-vertex arrays of a Geometry. Returns false if the
+// Geometry has an attribute array we can't remap per vertex.
+static bool gatherSlots( osg::Geometry& geom, AttributeSlotList& slots )
+{
+    osg::Array* verts( geom.getVertexArray() );
+    if( verts == NULL )
+        return( false );
+    const unsigned int numVerts( verts->getNumElements() );
+    slots.push_back( AttributeSlot( AttributeSlot::VERTEX, 0, verts ) );
+
+    if( ( geom.getNormalArray() != NULL ) &&
+        ( geom.getNormalBinding() == osg::Geometry::BIND_PER_VERTEX ) )
+        slots.push_back( AttributeSlot( AttributeSlot::NORMAL, 0, geom.getNormalArray() ) );
+    if( ( geom.getColorArray() != NULL ) &&
+        ( geom.getColorBinding() == osg::Geometry::BIND_PER_VERTEX ) )
+        slots.push_back( AttributeSlot( AttributeSlot::COLOR, 0, geom.getColorArray() ) );
+    if( ( geom.getSecondaryColorArray() != NULL ) &&
+        ( geom.getSecondaryColorBinding() == osg::Geometry::BIND_PER_VERTEX ) )
+        slots.push_back( AttributeSlot( AttributeSlot::SECONDARY_COLOR, 0, geom.getSecondaryColorArray() ) );
+    if( ( geom.getFogCoordArray() != NULL ) &&
+        ( geom.getFogCoordBinding() == osg::Geometry::BIND_PER_VERTEX ) )
+        slots.push_back( AttributeSlot( AttributeSlot::FOG_COORD, 0, geom.getFogCoordArray() ) );
+
+    unsigned int unit;
+    for( unit=0; unit<geom.getNumTexCoordArrays(); ++unit )
+    {
+        if( geom.getTexCoordArray( unit ) != NULL )
+            slots.push_back( AttributeSlot( AttributeSlot::TEXCOORD, unit, geom.getTexCoordArray( unit ) ) );
+    }
+    for( unit=0; unit<geom.getNumVertexAttribArrays(); ++unit )
+    {
+        if( ( geom.getVertexAttribArray( unit ) != NULL ) &&
+            ( geom.getVertexAttribBinding( unit ) == osg::Geometry::BIND_PER_VERTEX ) )
+            slots.push_back( AttributeSlot( AttributeSlot::VERTEX_ATTRIB, unit, geom.getVertexAttribArray( unit ) ) );
+    }
+
+    AttributeSlotList::const_iterator it;
+    for( it = slots.begin(); it != slots.end(); ++it )
+    {
+        if( it->_array->getNumElements() != numVerts )
+            return( false );
+    }
+    return( true );
+}
+
+
+// Quantized view of one vertex's attributes. Float and double components
+// snap to an epsilon grid; all other data types compare bit-for-bit.
+class VertexKey
+{
+public:
+    VertexKey( const AttributeSlotList& slots, const float epsilon )
+      : _slots( slots ),
+        _invEpsilon( 1. / epsilon )
+    {}
+
+    unsigned int hash( const unsigned int idx ) const
+    {
+        // FNV-1a over the quantized components.
+        unsigned int h( 2166136261u );
+        AttributeSlotList::const_iterator it;
+        for( it = _slots.begin(); it != _slots.end(); ++it )
+        {
+            const osg::Array* array( it->_array );
+            const unsigned int numComp( components( *array ) );
+            for( unsigned int comp=0; comp<numComp; ++comp )
+            {
+                const long long q( quantized( *array, idx, comp ) );
+                const unsigned char* bytes( (const unsigned char*)&q );
+                for( unsigned int b=0; b<sizeof( q ); ++b )
+                    h = ( h ^ bytes[ b ] ) * 16777619u;
+            }
+        }
+        return( h );
+    }
+
+    bool equal( const unsigned int lhs, const unsigned int rhs ) const
+    {
+        AttributeSlotList::const_iterator it;
+        for( it = _slots.begin(); it != _slots.end(); ++it )
+        {
+            const osg::Array* array( it->_array );
+            const unsigned int numComp( components( *array ) );
+            for( unsigned int comp=0; comp<numComp; ++comp )
+            {
+                if( quantized( *array, lhs, comp ) != quantized( *array, rhs, comp ) )
+                    return( false );
+            }
+        }
+        return( true );
+    }
+
+protected:
+    static unsigned int components( const osg::Array& array )
+    {
+        if( array.getDataType() == GL_FLOAT )
+            return( array.getElementSize() / sizeof( GLfloat ) );
+        else if( array.getDataType() == GL_DOUBLE )
+            return( array.getElementSize() / sizeof( double ) );
+        return( array.getElementSize() );
+    }
+
+    long long quantized( const osg::Array& array, const unsigned int idx, const unsigned int comp ) const
+    {
+        const unsigned char* elem( (const unsigned char*)( array.getDataPointer() ) +
+            idx * array.getElementSize() );
+        if( array.getDataType() == GL_FLOAT )
+            return( (long long)( floor( ( (const GLfloat*)elem )[ comp ] * _invEpsilon + .5 ) ) );
+        else if( array.getDataType() == GL_DOUBLE )
+            return( (long long)( floor( ( (const double*)elem )[ comp ] * _invEpsilon + .5 ) ) );
+        return( elem[ comp ] );
+    }
+
+    const AttributeSlotList& _slots;
+    double _invEpsilon;
+};
+
+
+// Compact an array so that element i of the result is element
+// oldIndices[i] of the input.
+class CompactArrayVisitor : public osg::ArrayVisitor
+{
+public:
+    CompactArrayVisitor( const std::vector< unsigned int >& oldIndices )
+      : _oldIndices( oldIndices ),
+        _handled( false )
+    {}
+
+    template< class ArrayType >
+    void compact( ArrayType& array )
+    {
+        osg::ref_ptr< ArrayType > compacted = new ArrayType( _oldIndices.size() );
+        for( unsigned int idx=0; idx<_oldIndices.size(); ++idx )
+            (*compacted)[ idx ] = array[ _oldIndices[ idx ] ];
+        array.swap( *compacted );
+        _handled = true;
+    }
+
+    virtual void apply( osg::Array& ) { _handled = false; }
+    virtual void apply( osg::ByteArray& array ) { compact( array ); }
+    virtual void apply( osg::ShortArray& array ) { compact( array ); }
+    virtual void apply( osg::IntArray& array ) { compact( array ); }
+    virtual void apply( osg::UByteArray& array ) { compact( array ); }
+    virtual void apply( osg::UShortArray& array ) { compact( array ); }
+    virtual void apply( osg::UIntArray& array ) { compact( array ); }
+    virtual void apply( osg::FloatArray& array ) { compact( array ); }
+    virtual void apply( osg::Vec2Array& array ) { compact( array ); }
+    virtual void apply( osg::Vec3Array& array ) { compact( array ); }
+    virtual void apply( osg::Vec4Array& array ) { compact( array ); }
+    virtual void apply( osg::Vec4ubArray& array ) { compact( array ); }
+    virtual void apply( osg::Vec2sArray& array ) { compact( array ); }
+    virtual void apply( osg::Vec3sArray& array ) { compact( array ); }
+    virtual void apply( osg::Vec4sArray& array ) { compact( array ); }
+    virtual void apply( osg::Vec3dArray& array ) { compact( array ); }
+
+    const std::vector< unsigned int >& _oldIndices;
+    bool _handled;
+};
+
+
+// Indices past the end of the remap table are primitive
+// restart indices, and are left as-is.
+template< class DrawElementsType >
+static void remapIndices( DrawElementsType& de, const std::vector< unsigned int >& remap )
+{
+    typename DrawElementsType::iterator it;
+    for( it = de.begin(); it != de.end(); ++it )
+    {
+        if( *it < remap.size() )
+            *it = remap[ *it ];
+    }
+}
+
+
+
+WeldVisitor::WeldVisitor()
+  : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ),
+    epsilon_( 1e-5f ),
+    geometries_( 0 ),
+    skipped_( 0 ),
+    verticesIn_( 0 ),
+    verticesOut_( 0 )
+{
+}
+WeldVisitor::~WeldVisitor()
+{
+}
+
+void
+WeldVisitor::apply( osg::Geode& geode )
+{
+    for(unsigned int i=0;i<geode.getNumDrawables();++i)
+    {
+        osg::Geometry* geom = dynamic_cast< osg::Geometry* >( geode.getDrawable(i) );
+        if( ( geom != NULL ) && processed_.insert( geom ).second )
+            weld( *geom );
+    }
+}
+
+void
+WeldVisitor::weld( osg::Geometry& geom )
+{
+    AttributeSlotList slots;
+    if( !geom.areFastPathsUsed() || !gatherSlots( geom, slots ) ||
+        ( geom.getNumPrimitiveSets() == 0 ) )
+    {
+        ++skipped_;
+        return;
+    }
+    unsigned int idx;
+    for( idx=0; idx<geom.getNumPrimitiveSets(); ++idx )
+    {
+        const osg::PrimitiveSet::Type type( geom.getPrimitiveSet( idx )->getType() );
+        if( ( type != osg::PrimitiveSet::DrawElementsUBytePrimitiveType ) &&
+            ( type != osg::PrimitiveSet::DrawElementsUShortPrimitiveType ) &&
+            ( type != osg::PrimitiveSet::DrawElementsUIntPrimitiveType ) )
+        {
+            ++skipped_;
+            return;
+        }
+    }
+
+    // Hash every vertex into an open-addressing table sized to the next
+    // power of two at least twice the vertex count. The first vertex with
+    // a given key survives; later duplicates remap to it.
+    const unsigned int numVerts( slots[ 0 ]._array->getNumElements() );
+    VertexKey key( slots, epsilon_ );
+
+    unsigned int tableSize( 1 );
+    while( tableSize < numVerts * 2 )
+        tableSize <<= 1;
+    const unsigned int mask( tableSize - 1 );
+    const unsigned int empty( ~0u );
+    std::vector< unsigned int > table( tableSize, empty );
+    std::vector< unsigned int > hashes( numVerts );
+
+    std::vector< unsigned int > remap( numVerts );
+    std::vector< unsigned int > oldIndices;
+    oldIndices.reserve( numVerts );
+    for( idx=0; idx<numVerts; ++idx )
+    {
+        const unsigned int h( key.hash( idx ) );
+        hashes[ idx ] = h;
+
+        unsigned int slot( h & mask );
+        while( table[ slot ] != empty )
+        {
+            const unsigned int other( table[ slot ] );
+            if( ( hashes[ other ] == h ) && key.equal( other, idx ) )
+                break;
+            slot = ( slot + 1 ) & mask;
+        }
+        if( table[ slot ] == empty )
+        {
+            table[ slot ] = idx;
+            remap[ idx ] = oldIndices.size();
+            oldIndices.push_back( idx );
+        }
+        else
+            remap[ idx ] = remap[ table[ slot ] ];
+    }
+
+    if( oldIndices.size() == numVerts )
+    {
+        ++geometries_;
+        verticesIn_ += numVerts;
+        verticesOut_ += numVerts;
+        return;
+    }
+
+    // Compact copies of the arrays, so that arrays shared with
+    // other Geometries stay intact.
+    CompactArrayVisitor cav( oldIndices );
+    std::vector< osg::ref_ptr< osg::Array > > compacted;
+    AttributeSlotList::const_iterator it;
+    for( it = slots.begin(); it != slots.end(); ++it )
+    {
+        osg::ref_ptr< osg::Array > array = dynamic_cast< osg::Array* >(
+            it->_array->clone( osg::CopyOp::DEEP_COPY_ALL ) );
+        if( !array.valid() )
+        {
+            ++skipped_;
+            return;
+        }
+        array->accept( cav );
+        if( !cav._handled )
+        {
+            osg::notify( osg::INFO ) << "WeldVisitor: Unsupported array type " <<
+                array->className() << "." << std::endl;
+            ++skipped_;
+            return;
+        }
+        compacted.push_back( array );
+    }
+    for( idx=0; idx<slots.size(); ++idx )
+        slots[ idx ].setArray( geom, compacted[ idx ].get() );
+
+    for( idx=0; idx<geom.getNumPrimitiveSets(); ++idx )
+    {
+        osg::PrimitiveSet* ps( geom.getPrimitiveSet( idx ) );
+        if( ps->referenceCount() > 1 )
+        {
+            // Shared; remap a private copy.
+            ps = dynamic_cast< osg::PrimitiveSet* >( ps->clone( osg::CopyOp::DEEP_COPY_ALL ) );
+            geom.setPrimitiveSet( idx, ps );
+        }
+        switch( ps->getType() )
+        {
+        case osg::PrimitiveSet::DrawElementsUBytePrimitiveType:
+            remapIndices( *static_cast< osg::DrawElementsUByte* >( ps ), remap );
+            break;
+        case osg::PrimitiveSet::DrawElementsUShortPrimitiveType:
+            remapIndices( *static_cast< osg::DrawElementsUShort* >( ps ), remap );
+            break;
+        case osg::PrimitiveSet::DrawElementsUIntPrimitiveType:
+            remapIndices( *static_cast< osg::DrawElementsUInt* >( ps ), remap );
+            break;
+        default:
+            break;
+        }
+        ps->dirty();
+    }
+
+    geom.dirtyDisplayList();
+    geom.dirtyBound();
+
+    ++geometries_;
+    verticesIn_ += numVerts;
+    verticesOut_ += oldIndices.size();
+}
+
+void
+WeldVisitor::dump( std::ostream& ostr )
+{
+    ostr << "Welded duplicate vertices:" << std::endl;
+    ostr << "\tGeometries:\t" << geometries_ << std::endl;
+    ostr << "\tSkipped:\t" << skipped_ << std::endl;
+    ostr << "\tVertices in:\t" << verticesIn_ << std::endl;
+    ostr << "\tVertices out:\t" << verticesOut_ << std::endl;
+    if( verticesIn_ > 0 )
+        ostr << "Vertex reduction: " << verticesIn_ - verticesOut_ << " (" <<
+            100.f * (float)( verticesIn_ - verticesOut_ ) / (float)verticesIn_ << "%)" << std::endl;
+}
@@ -0,0 +1,56 @@
+//
+// Copyright (c) 2009 Skew Matrix Software LLC.
+// All rights reserved.
+//
+
+#ifndef __WELD_VISITOR_H__
+#define __WELD_VISITOR_H__
+
+
+#include <osg/NodeVisitor>
+#include <osg/Geometry>
+#include <iostream>
+#include <vector>
+#include <set>
+
+
+
+/** \brief Collapse duplicate vertices in indexed Geometry.
+\details Hashes all per-vertex attributes (vertex, normal, colors,
+texcoords, generic vertex attribs), quantized by epsilon_ for float data,
+and merges vertices whose attributes all match. The DrawElements are
+remapped to the surviving vertices and the arrays shrink accordingly.
+
+Only Geometries whose primitive sets are all DrawElements, and that use
+the fast path, are welded. Run it after OptVisitor has converted
+DrawArrays to DrawElements. Arrays are copied before they are
+compacted, so arrays shared with other Geometries are left intact. */
+class WeldVisitor : public osg::NodeVisitor
+{
+public:
+    WeldVisitor();
+    ~WeldVisitor();
+
+    virtual void apply( osg::Geode& geode );
+
+    /** Float attribute components are rounded to a grid with this
+    spacing, and attributes that round to the same grid point in every
+    component are considered equal. Values closer than this can still
+    round apart across a grid line. Default: 1e-5. */
+    float epsilon_;
+
+    void dump( std::ostream& ostr );
+
+protected:
+    void weld( osg::Geometry& geom );
+
+    std::set< osg::Geometry* > processed_;
+
+    unsigned int geometries_;
+    unsigned int skipped_;
+    unsigned int verticesIn_;
+    unsigned int verticesOut_;
+};
+
+
+#endif
@@ -0,0 +1,109 @@
+//
+// Copyright (c) 2009 Skew Matrix Software LLC.
+// All rights reserved.
+//
+
+#include "CountsVisitor.h"
+#include <osg/ArgumentParser>
+#include <osg/Group>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Timer>
+#include <osg/Notify>
+
+#include <iostream>
+#include <sstream>
+
+
+// Time the default and fast modes of CountsVisitor on a generated
+// scene graph, and check that all modes report the same counts.
+//
+// countsperf [--children <n>] [--depth <n>] [--passes <n>]
+//
+// The graph is a tree of Groups with numChildren children per Group
+// and Geode leaves at maxDepth. Every leaf has its own Geometry and
+// DrawArrays, and all leaves share one vertex array, so the unique sets
+// see a mix of unique and shared objects.
+
+
+osg::Node* createLeaf( osg::Vec3Array* verts )
+{
+    osg::Geometry* geom = new osg::Geometry;
+    geom->setVertexArray( verts );
+    geom->addPrimitiveSet( new osg::DrawArrays( GL_TRIANGLES, 0, 3 ) );
+
+    osg::Geode* geode = new osg::Geode;
+    geode->addDrawable( geom );
+    return( geode );
+}
+
+osg::Node* createGraph( const unsigned int depth, const unsigned int maxDepth,
+    const unsigned int numChildren, osg::Vec3Array* verts, unsigned int& numNodes )
+{
+    ++numNodes;
+    if( depth >= maxDepth )
+        return( createLeaf( verts ) );
+
+    osg::Group* grp = new osg::Group;
+    for( unsigned int idx=0; idx<numChildren; ++idx )
+        grp->addChild( createGraph( depth+1, maxDepth, numChildren, verts, numNodes ) );
+    return( grp );
+}
+
+// Mean time per pass. \c counts gets the dumpJSON() output of the last pass.
+double timeCounts( osg::Node* root, CountsVisitor& cv, const unsigned int passes, std::string& counts )
+{
+    osg::Timer timer;
+    const osg::Timer_t start( timer.tick() );
+    for( unsigned int pass=0; pass<passes; ++pass )
+    {
+        cv.reset();
+        root->accept( cv );
+    }
+    const double time( timer.delta_m( start, timer.tick() ) / (double)passes );
+
+    std::ostringstream ostr;
+    cv.dumpJSON( ostr );
+    counts = ostr.str();
+    return( time );
+}
+
+int main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+    unsigned int numChildren( 10 ), maxDepth( 6 ), passes( 3 );
+    arguments.read( "--children", numChildren );
+    arguments.read( "--depth", maxDepth );
+    arguments.read( "--passes", passes );
+    if( passes == 0 )
+        passes = 1;
+
+    osg::ref_ptr< osg::Vec3Array > verts = new osg::Vec3Array;
+    verts->push_back( osg::Vec3( 0., 0., 0. ) );
+    verts->push_back( osg::Vec3( 1., 0., 0. ) );
+    verts->push_back( osg::Vec3( 0., 0., 1. ) );
+
+    unsigned int numNodes( 0 );
+    osg::ref_ptr< osg::Node > root = createGraph( 1, maxDepth, numChildren, verts.get(), numNodes );
+
+    std::string slowCounts, fastCounts, presizedCounts;
+    CountsVisitor slow;
+    const double slowTime( timeCounts( root.get(), slow, passes, slowCounts ) );
+    CountsVisitor fast;
+    fast.setFastMode( true );
+    const double fastTime( timeCounts( root.get(), fast, passes, fastCounts ) );
+    CountsVisitor presized;
+    presized.setFastMode( true, numNodes );
+    const double presizedTime( timeCounts( root.get(), presized, passes, presizedCounts ) );
+
+    std::cout << numNodes << " nodes, ms/pass: default " << slowTime <<
+        ", fast " << fastTime << ", fast presized " << presizedTime << "." << std::endl;
+
+    if( ( fastCounts != slowCounts ) || ( presizedCounts != slowCounts ) )
+    {
+        osg::notify( osg::FATAL ) << "Fast mode counts differ from the default mode." << std::endl;
+        return( 1 );
+    }
+
+    return( 0 );
+}
@@ -0,0 +1,119 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#include "FixedFunctionLighting.h"
+#include "InheritedState.h"
+#include <osg/Material>
+#include <osg/LightModel>
+#include <osg/TexEnv>
+
+#include <vector>
+
+
+
+namespace
+{
+
+const char* vertexSource =
+    "void fixedFunctionVertex( vec4 vertex, vec3 normal, vec4 texCoord0 )\n"
+    "{\n"
+    "    vec4 ecPosition = gl_ModelViewMatrix * vertex;\n"
+    "    gl_Position = gl_ProjectionMatrix * ecPosition;\n"
+    "    gl_ClipVertex = ecPosition;\n"
+    "    gl_FogFragCoord = abs( ecPosition.z );\n"
+    "    gl_TexCoord[ 0 ] = gl_TextureMatrix[ 0 ] * texCoord0;\n"
+    "\n"
+    "    vec3 n = normalize( gl_NormalMatrix * normal );\n"
+    "    vec3 toLight = gl_LightSource[ 0 ].position.xyz;\n"
+    "    float attenuation = 1.0;\n"
+    "    if( gl_LightSource[ 0 ].position.w != 0.0 )\n"
+    "    {\n"
+    "        toLight = toLight / gl_LightSource[ 0 ].position.w - ecPosition.xyz / ecPosition.w;\n"
+    "        float d = length( toLight );\n"
+    "        attenuation = 1.0 / ( gl_LightSource[ 0 ].constantAttenuation +\n"
+    "            gl_LightSource[ 0 ].linearAttenuation * d +\n"
+    "            gl_LightSource[ 0 ].quadraticAttenuation * d * d );\n"
+    "        if( gl_LightSource[ 0 ].spotCutoff <= 90.0 )\n"
+    "        {\n"
+    "            float spot = dot( -normalize( toLight ), normalize( gl_LightSource[ 0 ].spotDirection ) );\n"
+    "            attenuation *= ( spot < gl_LightSource[ 0 ].spotCosCutoff ) ?\n"
+    "                0.0 : pow( spot, gl_LightSource[ 0 ].spotExponent );\n"
+    "        }\n"
+    "    }\n"
+    "    toLight = normalize( toLight );\n"
+    "\n"
+    "    float diffuse = max( dot( n, toLight ), 0.0 );\n"
+    "    vec4 color = gl_FrontMaterial.emission + gl_Color * gl_LightModel.ambient +\n"
+    "        attenuation * gl_Color * ( gl_LightSource[ 0 ].ambient + gl_LightSource[ 0 ].diffuse * diffuse );\n"
+    "    if( diffuse > 0.0 )\n"
+    "    {\n"
+    "        vec3 halfVector = normalize( toLight + vec3( 0.0, 0.0, 1.0 ) );\n"
+    "        color += attenuation * gl_FrontLightProduct[ 0 ].specular *\n"
+    "            pow( max( dot( n, halfVector ), 0.0 ), gl_FrontMaterial.shininess );\n"
+    "    }\n"
+    "    gl_FrontColor = gl_BackColor = vec4( color.rgb, gl_Color.a );\n"
+    "}\n";
+
+
+bool isReproducible( const InheritedState& state, bool fragmentShader )
+{
+    // Unset modes are left to the viewer's defaults: lighting and
+    // light 0 on, everything else off.
+    if( state.isOff( GL_LIGHTING ) || state.isOff( GL_LIGHT0 ) )
+        return( false );
+    for( GLenum light=GL_LIGHT1; light<GL_LIGHT0+8; ++light )
+        if( state.isOn( light ) )
+            return( false );
+
+    if( state.getAttribute( osg::StateAttribute::PROGRAM ) != NULL )
+        return( false );
+    const osg::Material* material( dynamic_cast< const osg::Material* >(
+        state.getAttribute( osg::StateAttribute::MATERIAL ) ) );
+    if( ( material != NULL ) && ( material->getColorMode() != osg::Material::AMBIENT_AND_DIFFUSE ) )
+        return( false );
+    const osg::LightModel* lightModel( dynamic_cast< const osg::LightModel* >(
+        state.getAttribute( osg::StateAttribute::LIGHTMODEL ) ) );
+    if( ( lightModel != NULL ) && ( lightModel->getTwoSided() || lightModel->getLocalViewer() ||
+        ( lightModel->getColorControl() != osg::LightModel::SINGLE_COLOR ) ) )
+        return( false );
+
+    for( unsigned int unit=1; unit<state.getNumTextureUnits(); ++unit )
+        if( state.isAnyTextureModeOn( unit ) )
+            return( false );
+    if( state.isTextureOn( 0, GL_TEXTURE_GEN_S ) || state.isTextureOn( 0, GL_TEXTURE_GEN_T ) ||
+        state.isTextureOn( 0, GL_TEXTURE_GEN_R ) || state.isTextureOn( 0, GL_TEXTURE_GEN_Q ) )
+        return( false );
+    if( fragmentShader )
+    {
+        if( state.isOn( GL_FOG ) )
+            return( false );
+        const osg::StateAttribute* texEnv( state.getTextureAttribute( 0, osg::StateAttribute::TEXENV ) );
+        if( texEnv != NULL )
+        {
+            // TexEnvCombine has the same type, and isn't a TexEnv.
+            const osg::TexEnv* te( dynamic_cast< const osg::TexEnv* >( texEnv ) );
+            if( ( te == NULL ) || ( te->getMode() != osg::TexEnv::MODULATE ) )
+                return( false );
+        }
+    }
+    return( true );
+}
+
+}
+
+
+
+const char* FixedFunctionLighting::getVertexSource()
+{
+    return( vertexSource );
+}
+
+bool FixedFunctionLighting::isReproducible( const osg::Drawable& draw, bool fragmentShader )
+{
+    std::vector< InheritedState > states;
+    InheritedState::getPathStates( draw, states );
+    std::vector< InheritedState >::const_iterator it;
+    for( it = states.begin(); it != states.end(); ++it )
+        if( !::isReproducible( *it, fragmentShader ) )
+            return( false );
+    return( true );
+}
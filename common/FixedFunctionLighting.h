@@ -0,0 +1,51 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __FIXED_FUNCTION_LIGHTING_H__
+#define __FIXED_FUNCTION_LIGHTING_H__ 1
+
+
+#include <osg/Drawable>
+
+
+
+/** FixedFunctionLighting FixedFunctionLighting.h
+\brief Vertex shader code for tools that replace fixed-function vertex processing.
+\details meshopt, textureatlas and nodeshare install vertex shaders that
+decode or transform vertices, so those shaders must also do the lighting
+and texture coordinate work of the fixed-function pipeline. They all call
+the GLSL 1.20 function in getVertexSource():
+
+\code
+void fixedFunctionVertex( vec4 vertex, vec3 normal, vec4 texCoord0 );
+\endcode
+
+It takes the object space vertex, normal and unit 0 texture coordinate,
+and writes gl_Position, gl_ClipVertex, gl_FogFragCoord, gl_TexCoord[0],
+gl_FrontColor and gl_BackColor. It lights with light 0, directional,
+positional or spot, including attenuation and specular, and takes the
+ambient and diffuse colors from gl_Color as the default osgViewer Material
+(color mode AMBIENT_AND_DIFFUSE) does.
+
+That only covers part of the fixed-function state, so isReproducible()
+checks the state a Drawable inherits on each of its parental paths. Tools
+leave Drawables it rejects alone.
+**/
+class FixedFunctionLighting
+{
+public:
+    /** GLSL 1.20 source of fixedFunctionVertex(), without a #version line. */
+    static const char* getVertexSource();
+
+    /** \return true if fixedFunctionVertex() reproduces the state in
+    effect for \c draw: lighting on with only light 0, a LightModel (if
+    any) with one-sided lighting, an infinite viewer and a single color,
+    a Material (if any) with color mode AMBIENT_AND_DIFFUSE, no Program,
+    and texturing on unit 0 only, without TexGen. Pass \c fragmentShader
+    true if the caller's fragment shader outputs gl_Color times the unit 0
+    texture; then any TexEnv on unit 0 must be MODULATE and fog must be off. */
+    static bool isReproducible( const osg::Drawable& draw, bool fragmentShader=false );
+};
+
+
+// __FIXED_FUNCTION_LIGHTING_H__
+#endif
@@ -0,0 +1,142 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#include "InheritedState.h"
+#include <osg/Node>
+
+
+
+namespace
+{
+
+inline bool overridden( unsigned int parent, unsigned int child )
+{
+    return( ( ( parent & osg::StateAttribute::OVERRIDE ) != 0 ) &&
+        ( ( child & osg::StateAttribute::PROTECTED ) == 0 ) );
+}
+
+}
+
+
+
+void InheritedState::push( const osg::StateSet* ss )
+{
+    if( ss == NULL )
+        return;
+    pushModes( ss->getModeList(), _modes );
+    pushAttributes( ss->getAttributeList(), _attributes );
+
+    const osg::StateSet::TextureModeList& textureModes( ss->getTextureModeList() );
+    if( _textureModes.size() < textureModes.size() )
+        _textureModes.resize( textureModes.size() );
+    unsigned int unit;
+    for( unit=0; unit<textureModes.size(); ++unit )
+        pushModes( textureModes[ unit ], _textureModes[ unit ] );
+
+    const osg::StateSet::TextureAttributeList& textureAttributes( ss->getTextureAttributeList() );
+    if( _textureAttributes.size() < textureAttributes.size() )
+        _textureAttributes.resize( textureAttributes.size() );
+    for( unit=0; unit<textureAttributes.size(); ++unit )
+        pushAttributes( textureAttributes[ unit ], _textureAttributes[ unit ] );
+}
+
+void InheritedState::getPathStates( const osg::Drawable& draw, std::vector< InheritedState >& states )
+{
+    const osg::NodePathList paths( draw.getParentalNodePaths() );
+    if( paths.empty() )
+    {
+        states.push_back( InheritedState() );
+        states.back().push( draw.getStateSet() );
+        return;
+    }
+
+    osg::NodePathList::const_iterator pit;
+    for( pit = paths.begin(); pit != paths.end(); ++pit )
+    {
+        states.push_back( InheritedState() );
+        InheritedState& state( states.back() );
+        osg::NodePath::const_iterator it;
+        for( it = pit->begin(); it != pit->end(); ++it )
+            state.push( (*it)->getStateSet() );
+        state.push( draw.getStateSet() );
+    }
+}
+
+bool InheritedState::isOn( GLenum mode ) const
+{
+    return( isOn( _modes, mode ) );
+}
+
+bool InheritedState::isOff( GLenum mode ) const
+{
+    ModeMap::const_iterator it( _modes.find( mode ) );
+    return( ( it != _modes.end() ) && ( ( it->second & osg::StateAttribute::ON ) == 0 ) );
+}
+
+bool InheritedState::isTextureOn( unsigned int unit, GLenum mode ) const
+{
+    return( ( unit < _textureModes.size() ) && isOn( _textureModes[ unit ], mode ) );
+}
+
+bool InheritedState::isAnyTextureModeOn( unsigned int unit ) const
+{
+    if( unit >= _textureModes.size() )
+        return( false );
+    ModeMap::const_iterator it;
+    for( it = _textureModes[ unit ].begin(); it != _textureModes[ unit ].end(); ++it )
+        if( ( it->second & osg::StateAttribute::ON ) != 0 )
+            return( true );
+    return( false );
+}
+
+const osg::StateAttribute* InheritedState::getAttribute( osg::StateAttribute::Type type ) const
+{
+    return( find( _attributes, type ) );
+}
+
+const osg::StateAttribute* InheritedState::getTextureAttribute( unsigned int unit, osg::StateAttribute::Type type ) const
+{
+    if( unit >= _textureAttributes.size() )
+        return( NULL );
+    return( find( _textureAttributes[ unit ], type ) );
+}
+
+
+void InheritedState::pushModes( const osg::StateSet::ModeList& modes, ModeMap& result )
+{
+    osg::StateSet::ModeList::const_iterator it;
+    for( it = modes.begin(); it != modes.end(); ++it )
+    {
+        ModeMap::iterator rit( result.find( it->first ) );
+        if( rit == result.end() )
+            result[ it->first ] = it->second;
+        else if( !overridden( rit->second, it->second ) )
+            rit->second = it->second;
+    }
+}
+
+void InheritedState::pushAttributes( const osg::StateSet::AttributeList& attributes, AttributeMap& result )
+{
+    osg::StateSet::AttributeList::const_iterator it;
+    for( it = attributes.begin(); it != attributes.end(); ++it )
+    {
+        if( it->first.second != 0 )
+            continue;
+        AttributeMap::iterator rit( result.find( it->first.first ) );
+        if( rit == result.end() )
+            result[ it->first.first ] = it->second;
+        else if( !overridden( rit->second.second, it->second.second ) )
+            rit->second = it->second;
+    }
+}
+
+bool InheritedState::isOn( const ModeMap& modes, GLenum mode )
+{
+    ModeMap::const_iterator it( modes.find( mode ) );
+    return( ( it != modes.end() ) && ( ( it->second & osg::StateAttribute::ON ) != 0 ) );
+}
+
+const osg::StateAttribute* InheritedState::find( const AttributeMap& attributes, osg::StateAttribute::Type type )
+{
+    AttributeMap::const_iterator it( attributes.find( type ) );
+    return( ( it != attributes.end() ) ? it->second.first.get() : NULL );
+}
@@ -0,0 +1,63 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __INHERITED_STATE_H__
+#define __INHERITED_STATE_H__ 1
+
+
+#include <osg/Drawable>
+#include <osg/StateSet>
+
+#include <map>
+#include <vector>
+
+
+
+/** InheritedState InheritedState.h
+\brief The modes and attributes in effect at the end of one path through the scene graph.
+\details push() the StateSets along a path from the root. As in
+osg::State, a parent's OVERRIDE value wins over its children's unless
+they're PROTECTED. Modes and attributes no StateSet sets are left to the
+viewer's defaults, so isOn() and isOff() are both false for them.
+
+Only member 0 of each attribute type is tracked, which is enough for
+lighting, culling and texture environment checks, but not for
+individual lights or clip planes.
+**/
+class InheritedState
+{
+public:
+    void push( const osg::StateSet* ss );
+
+    /** One InheritedState for each parental path of \c draw, ending
+    with its own StateSet. A Drawable without parents gets one
+    InheritedState holding only its own StateSet. */
+    static void getPathStates( const osg::Drawable& draw, std::vector< InheritedState >& states );
+
+    bool isOn( GLenum mode ) const;
+    bool isOff( GLenum mode ) const;
+    bool isTextureOn( unsigned int unit, GLenum mode ) const;
+    bool isAnyTextureModeOn( unsigned int unit ) const;
+    unsigned int getNumTextureUnits() const { return( _textureModes.size() ); }
+
+    /** \return NULL if no StateSet on the path sets \c type. */
+    const osg::StateAttribute* getAttribute( osg::StateAttribute::Type type ) const;
+    const osg::StateAttribute* getTextureAttribute( unsigned int unit, osg::StateAttribute::Type type ) const;
+
+protected:
+    typedef std::map< GLenum, osg::StateAttribute::GLModeValue > ModeMap;
+    typedef std::map< osg::StateAttribute::Type, osg::StateSet::RefAttributePair > AttributeMap;
+
+    static void pushModes( const osg::StateSet::ModeList& modes, ModeMap& result );
+    static void pushAttributes( const osg::StateSet::AttributeList& attributes, AttributeMap& result );
+    static bool isOn( const ModeMap& modes, GLenum mode );
+    static const osg::StateAttribute* find( const AttributeMap& attributes, osg::StateAttribute::Type type );
+
+    ModeMap _modes;
+    AttributeMap _attributes;
+    std::vector< ModeMap > _textureModes;
+    std::vector< AttributeMap > _textureAttributes;
+};
+
+
+// __INHERITED_STATE_H__
+#endif
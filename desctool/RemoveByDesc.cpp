@@ -1,15 +1,217 @@
 #include "RemoveByDesc.h"
 #include <osg/MatrixTransform>
 #include <osg/Geode>
+#include <osg/Transform>
 #include <osgwTools/InsertRemove.h>
 #include <osg/ref_ptr>
+#include <osg/Notify>
 
+#include <algorithm>
+#include <deque>
 #include <iostream>
+#include <typeinfo>
+
+
+
+namespace
+{
+
+// Replays osgwTools::removeNode() calls without editing wide child lists
+// one removal at a time. Plain Groups and Transforms have no per-child
+// data, so their child lists are edited as copies, indexed by child so
+// each removal is constant time, and written back once in flush(). Other
+// Groups are edited directly, exactly as removeNode() would. Parent lists
+// are tracked alongside, because the copies hide changes from OSG.
+class BatchRemover
+{
+public:
+    unsigned int getNumParents( osg::Node* node )
+    {
+        return( parents( node ).size() );
+    }
+
+    void removeNode( osg::Node* node )
+    {
+        const std::vector< osg::Group* > nodeParents( parents( node ) );
+        osg::Group* grp( node->asGroup() );
+        std::vector< osg::Group* >::const_iterator it;
+        for( it = nodeParents.begin(); it != nodeParents.end(); ++it )
+        {
+            removeChild( *it, node );
+            if( grp != NULL )
+            {
+                const std::vector< osg::Node* > grandChildren( children( grp ) );
+                std::vector< osg::Node* >::const_iterator cit;
+                for( cit = grandChildren.begin(); cit != grandChildren.end(); ++cit )
+                    addChild( *it, *cit );
+            }
+        }
+    }
+
+    void flush()
+    {
+        ChildListMap::iterator it;
+        for( it = _lists.begin(); it != _lists.end(); ++it )
+        {
+            if( !( it->second._dirty ) )
+                continue;
+            osg::Group* grp( it->first );
+            const std::vector< osg::Node* > newChildren( children( grp ) );
+            grp->removeChildren( 0, grp->getNumChildren() );
+            std::vector< osg::Node* >::const_iterator cit;
+            for( cit = newChildren.begin(); cit != newChildren.end(); ++cit )
+                grp->addChild( *cit );
+        }
+        _lists.clear();
+        _parents.clear();
+    }
+
+protected:
+    struct ChildList
+    {
+        ChildList() : _dirty( false ) {}
+
+        std::vector< osg::ref_ptr< osg::Node > > _children;
+        std::vector< bool > _live;
+        // Positions of each child's live entries, ascending.
+        std::map< osg::Node*, std::deque< unsigned int > > _positions;
+        bool _dirty;
+    };
+    typedef std::map< osg::Group*, ChildList > ChildListMap;
+    ChildListMap _lists;
+    std::map< osg::Node*, std::vector< osg::Group* > > _parents;
+
+    static bool isPlain( const osg::Group* grp )
+    {
+        return( ( typeid( *grp ) == typeid( osg::Group ) ) ||
+            ( dynamic_cast< const osg::Transform* >( grp ) != NULL ) );
+    }
+
+    std::vector< osg::Group* >& parents( osg::Node* node )
+    {
+        std::map< osg::Node*, std::vector< osg::Group* > >::iterator it( _parents.find( node ) );
+        if( it == _parents.end() )
+        {
+            const osg::Node::ParentList& pl( node->getParents() );
+            it = _parents.insert( std::make_pair( node,
+                std::vector< osg::Group* >( pl.begin(), pl.end() ) ) ).first;
+        }
+        return( it->second );
+    }
+
+    ChildList& list( osg::Group* grp )
+    {
+        ChildListMap::iterator it( _lists.find( grp ) );
+        if( it == _lists.end() )
+        {
+            it = _lists.insert( std::make_pair( grp, ChildList() ) ).first;
+            ChildList& cl( it->second );
+            for( unsigned int idx=0; idx<grp->getNumChildren(); ++idx )
+            {
+                cl._children.push_back( grp->getChild( idx ) );
+                cl._live.push_back( true );
+                cl._positions[ grp->getChild( idx ) ].push_back( idx );
+            }
+        }
+        return( it->second );
+    }
+
+    std::vector< osg::Node* > children( osg::Group* grp )
+    {
+        std::vector< osg::Node* > result;
+        if( !isPlain( grp ) )
+        {
+            for( unsigned int idx=0; idx<grp->getNumChildren(); ++idx )
+                result.push_back( grp->getChild( idx ) );
+            return( result );
+        }
+        const ChildList& cl( list( grp ) );
+        for( unsigned int idx=0; idx<cl._children.size(); ++idx )
+        {
+            if( cl._live[ idx ] )
+                result.push_back( cl._children[ idx ].get() );
+        }
+        return( result );
+    }
+
+    // Like osg::Group::removeChild(), removes the first occurrence.
+    void removeChild( osg::Group* grp, osg::Node* node )
+    {
+        std::vector< osg::Group* >& pl( parents( node ) );
+        std::vector< osg::Group* >::iterator pit( std::find( pl.begin(), pl.end(), grp ) );
+        if( pit != pl.end() )
+            pl.erase( pit );
+
+        if( !isPlain( grp ) )
+        {
+            grp->removeChild( node );
+            return;
+        }
+        ChildList& cl( list( grp ) );
+        std::deque< unsigned int >& positions( cl._positions[ node ] );
+        if( positions.empty() )
+            return;
+        cl._live[ positions.front() ] = false;
+        positions.pop_front();
+        cl._dirty = true;
+    }
+
+    void addChild( osg::Group* grp, osg::Node* node )
+    {
+        parents( node ).push_back( grp );
+
+        if( !isPlain( grp ) )
+        {
+            grp->addChild( node );
+            return;
+        }
+        ChildList& cl( list( grp ) );
+        cl._positions[ node ].push_back( cl._children.size() );
+        cl._children.push_back( node );
+        cl._live.push_back( true );
+        cl._dirty = true;
+    }
+};
+
+// True if \c pattern refers to one of its groups by number or name:
+// a backreference, a recursion or a conditional. Wrapped in the
+// combined alternation, its groups are renumbered and such references
+// break, so it can't be prefiltered.
+bool hasGroupReference( const std::string& pattern )
+{
+    for( std::string::size_type idx=0; idx+1<pattern.size(); ++idx )
+    {
+        const char next( pattern[ idx+1 ] );
+        if( pattern[ idx ] == '\\' )
+        {
+            if( ( ( next >= '1' ) && ( next <= '9' ) ) || ( next == 'g' ) || ( next == 'k' ) )
+                return( true );
+            // Skip the escaped character, which may itself be a backslash.
+            ++idx;
+        }
+        else if( ( pattern[ idx ] == '(' ) && ( next == '?' ) && ( idx+2 < pattern.size() ) )
+        {
+            const char kind( pattern[ idx+2 ] );
+            if( ( ( kind >= '0' ) && ( kind <= '9' ) ) || ( kind == 'R' ) || ( kind == '&' ) ||
+                ( kind == '+' ) || ( kind == '(' ) || ( kind == 'P' ) )
+                return( true );
+        }
+    }
+    return( false );
+}
+
+}
 
 
 RemoveByDesc::RemoveByDesc()
-    : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN )
+    : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ),
+    _descCount( 0 ),
+    _regexDirty( false ),
+    _regexCombined( true ),
+    _batch( true )
 {
+    // Root of the prefix trie.
+    _trie.push_back( TrieNode() );
 }
 
 void RemoveByDesc::setDescriptions( const osg::Node::DescriptionList& desc )
@@ -21,11 +223,145 @@ const osg::Node::DescriptionList& RemoveByDesc::getDescriptions() const
     return( _desc );
 }
 
+unsigned int RemoveByDesc::addPattern( const std::string& pattern, MatchType type )
+{
+    const unsigned int index( _patterns.size() );
+    Pattern entry;
+    entry._pattern = pattern;
+    entry._type = type;
+    entry._count = 0;
+    _patterns.push_back( entry );
+
+    switch( type )
+    {
+    case EXACT:
+        // A duplicate pattern never matches; the first one wins.
+        _exact.insert( ExactMap::value_type( pattern, index ) );
+        break;
+    case PREFIX:
+    {
+        unsigned int trieIdx( 0 );
+        for( std::string::const_iterator it = pattern.begin(); it != pattern.end(); ++it )
+        {
+            std::map< char, unsigned int >::const_iterator child( _trie[ trieIdx ]._children.find( *it ) );
+            if( child == _trie[ trieIdx ]._children.end() )
+            {
+                _trie[ trieIdx ]._children[ *it ] = _trie.size();
+                trieIdx = _trie.size();
+                _trie.push_back( TrieNode() );
+            }
+            else
+                trieIdx = child->second;
+        }
+        if( _trie[ trieIdx ]._pattern < 0 )
+            _trie[ trieIdx ]._pattern = index;
+        break;
+    }
+    case REGEX:
+        try
+        {
+            _regexes.push_back( std::make_pair( boost::regex( pattern ), index ) );
+        }
+        catch( const boost::regex_error& e )
+        {
+            osg::notify( osg::WARN ) << "RemoveByDesc: Ignoring invalid regex \"" << pattern
+                << "\": " << e.what() << std::endl;
+            break;
+        }
+        if( hasGroupReference( pattern ) )
+            _regexCombined = false;
+        _regexDirty = true;
+        break;
+    }
+    return( index );
+}
+unsigned int RemoveByDesc::getNumPatterns() const
+{
+    return( _patterns.size() );
+}
+unsigned int RemoveByDesc::getRemovedCount( unsigned int index ) const
+{
+    return( _patterns[ index ]._count );
+}
+
+void RemoveByDesc::dump( std::ostream& ostr ) const
+{
+    static const char* typeNames[] = { "exact", "prefix", "regex" };
+    if( !( _desc.empty() ) )
+        ostr << "  " << _descCount << "\tdescription list" << std::endl;
+    for( std::vector< Pattern >::const_iterator it = _patterns.begin(); it != _patterns.end(); ++it )
+        ostr << "  " << it->_count << "\t" << typeNames[ it->_type ] << " \"" << it->_pattern << "\"" << std::endl;
+}
+
+
+int RemoveByDesc::matchPrefix( const std::string& desc ) const
+{
+    // The shortest matching prefix wins.
+    unsigned int trieIdx( 0 );
+    if( _trie[ trieIdx ]._pattern >= 0 )
+        return( _trie[ trieIdx ]._pattern );
+    for( std::string::const_iterator it = desc.begin(); it != desc.end(); ++it )
+    {
+        std::map< char, unsigned int >::const_iterator child( _trie[ trieIdx ]._children.find( *it ) );
+        if( child == _trie[ trieIdx ]._children.end() )
+            return( -1 );
+        trieIdx = child->second;
+        if( _trie[ trieIdx ]._pattern >= 0 )
+            return( _trie[ trieIdx ]._pattern );
+    }
+    return( -1 );
+}
+
+int RemoveByDesc::matchRegex( const std::string& desc )
+{
+    if( _regexes.empty() )
+        return( -1 );
+    if( _regexDirty && _regexCombined )
+    {
+        std::string combined;
+        for( unsigned int idx=0; idx<_regexes.size(); ++idx )
+        {
+            if( idx > 0 )
+                combined += "|";
+            combined += "(?:" + _patterns[ _regexes[ idx ].second ]._pattern + ")";
+        }
+        _regex = boost::regex( combined );
+        _regexDirty = false;
+    }
+
+    if( _regexCombined && !( boost::regex_match( desc, _regex ) ) )
+        return( -1 );
+    for( unsigned int idx=0; idx<_regexes.size(); ++idx )
+    {
+        if( boost::regex_match( desc, _regexes[ idx ].first ) )
+            return( _regexes[ idx ].second );
+    }
+    return( -1 );
+}
+
+int RemoveByDesc::match( const osg::Node::DescriptionList& desc )
+{
+    for( osg::Node::DescriptionList::const_iterator it = desc.begin(); it != desc.end(); ++it )
+    {
+        ExactMap::const_iterator exactIt( _exact.find( *it ) );
+        if( exactIt != _exact.end() )
+            return( exactIt->second );
+        int index( matchPrefix( *it ) );
+        if( index >= 0 )
+            return( index );
+        index = matchRegex( *it );
+        if( index >= 0 )
+            return( index );
+    }
+    return( -1 );
+}
+
 
 void RemoveByDesc::apply( osg::Node& node )
 {
     const osg::Node::DescriptionList& localDesc( node.getDescriptions() );
-    if( _desc.size() == localDesc.size() )
+    // An empty list would match every node without descriptions.
+    if( !( _desc.empty() ) && ( _desc.size() == localDesc.size() ) )
     {
         bool mismatch( false );
         for( unsigned int idx=0; idx<_desc.size(); ++idx )
@@ -37,7 +373,18 @@ void RemoveByDesc::apply( osg::Node& node )
             }
         }
         if( !mismatch )
-            _nodes.insert( &node );
+        {
+            addNode( node, -1 );
+            traverse( node );
+            return;
+        }
+    }
+
+    if( !( _patterns.empty() ) )
+    {
+        const int index( match( localDesc ) );
+        if( index >= 0 )
+            addNode( node, index );
     }
 
     traverse( node );
@@ -62,15 +409,49 @@ int RemoveByDesc::execute( osg::Node* node )
         return( 0 );
 
     unsigned int removed( 0 );
-    for( NodeSet::const_iterator it = _nodes.begin(); it != _nodes.end(); ++it )
+    if( !_batch )
+    {
+        for( NodeList::const_iterator it = _nodes.begin(); it != _nodes.end(); ++it )
+        {
+            osg::ref_ptr< osg::Node > target( it->first );
+            if( target->getNumParents() > 0 )
+            {
+                osgwTools::removeNode( target.get() );
+                ++removed;
+                countRemoved( it->second );
+            }
+        }
+        return( removed );
+    }
+
+    // Same removals in the same order as above, so the
+    // resulting graph is identical.
+    BatchRemover br;
+    for( NodeList::const_iterator it = _nodes.begin(); it != _nodes.end(); ++it )
     {
-        osg::ref_ptr< osg::Node > target( *it );
-        if( target->getNumParents() > 0 )
+        osg::Node* target( it->first.get() );
+        if( br.getNumParents( target ) > 0 )
         {
-            osgwTools::removeNode( target.get() );
+            br.removeNode( target );
             ++removed;
+            countRemoved( it->second );
         }
     }
+    br.flush();
 
     return( removed );
 }
+
+void RemoveByDesc::addNode( osg::Node& node, int index )
+{
+    if( _found.insert( &node ).second )
+        _nodes.push_back( std::make_pair( osg::ref_ptr< osg::Node >( &node ), index ) );
+}
+
+void RemoveByDesc::countRemoved( int index )
+{
+    if( index < 0 )
+        ++_descCount;
+    else
+        ++( _patterns[ index ]._count );
+}
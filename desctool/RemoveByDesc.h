@@ -4,14 +4,36 @@
 
 #include <osg/NodeVisitor>
 
+#include <boost/regex.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <iostream>
+#include <map>
 #include <set>
 #include <string>
+#include <vector>
 
 
 
 /** RemoveByDesc RemoveByDesc.h
 \brief Remove nodes with a specified description string.
-\details TBD
+\details A node is removed if its description list equals the list
+passed to setDescriptions(), or if any one of its descriptions matches a
+pattern passed to addPattern(). All patterns are matched in a single
+traversal. Exact patterns are in a hash map and prefix patterns in a
+trie, so both cost time proportional to the description length,
+regardless of the number of patterns. All regex patterns are combined
+into one alternation, matched once per description; only descriptions
+that match are then tested against the individual regexes.
+
+MatrixTransforms and Geodes are never removed. As with
+osgwTools::removeNode(), a removed node's children are added to each of
+its parents. By default, removals are batched: the per-node removals are
+replayed in the same order on copies of the child lists of plain Groups
+and Transforms, and each list is written back once, so removing many
+children of a wide Group costs time linear in its number of children.
+The result is identical to per-node removal. Other Groups, such as LOD,
+Switch and Sequence, keep per-child data and are always edited directly.
 **/
 class RemoveByDesc : public osg::NodeVisitor
 {
@@ -20,18 +42,82 @@ public:
 
     int execute( osg::Node* node=NULL );
 
+    /** If false, each node is removed with its own
+    osgwTools::removeNode() call. Default: true. */
+    void setBatchRemoval( bool batch ) { _batch = batch; }
+
     void setDescriptions( const osg::Node::DescriptionList& desc );
     const osg::Node::DescriptionList& getDescriptions() const;
 
+    enum MatchType {
+        EXACT,
+        PREFIX,
+        REGEX
+    };
+    /** Add a pattern. REGEX patterns must match the whole description.
+    An invalid REGEX pattern is reported and never matches, but still
+    gets an index.
+    \return The pattern's index, for getRemovedCount(). */
+    unsigned int addPattern( const std::string& pattern, MatchType type=EXACT );
+    unsigned int getNumPatterns() const;
+    /** Nodes removed by pattern \c index. A node matching several
+    patterns is counted for only one of them. */
+    unsigned int getRemovedCount( unsigned int index ) const;
+
+    /** Per-pattern removal counts. */
+    void dump( std::ostream& ostr ) const;
+
     virtual void apply( osg::Node& node );
     virtual void apply( osg::MatrixTransform& node );
     virtual void apply( osg::Geode& node );
 
 protected:
     osg::Node::DescriptionList _desc;
+    unsigned int _descCount;
+
+    struct Pattern {
+        std::string _pattern;
+        MatchType _type;
+        unsigned int _count;
+    };
+    std::vector< Pattern > _patterns;
+
+    // Returns the index of a pattern matching one of \c desc, or -1.
+    int match( const osg::Node::DescriptionList& desc );
+    int matchPrefix( const std::string& desc ) const;
+    int matchRegex( const std::string& desc );
+
+    typedef boost::unordered_map< std::string, unsigned int > ExactMap;
+    ExactMap _exact;
+
+    struct TrieNode {
+        TrieNode() : _pattern( -1 ) {}
+        std::map< char, unsigned int > _children;
+        int _pattern;
+    };
+    std::vector< TrieNode > _trie;
+
+    // The alternation of all regex patterns rejects most descriptions
+    // in one match. On a match, the individual patterns find which one.
+    // Patterns that refer to their own groups break in the alternation;
+    // with any of them, _regexCombined is false and only the individual
+    // patterns are matched.
+    boost::regex _regex;
+    std::vector< std::pair< boost::regex, unsigned int > > _regexes;
+    bool _regexDirty;
+    bool _regexCombined;
+
+    // Matched nodes in traversal order, and the pattern that matched,
+    // or -1 for the setDescriptions() list. Removing in traversal order
+    // makes the result independent of node addresses.
+    typedef std::vector< std::pair< osg::ref_ptr< osg::Node >, int > > NodeList;
+    NodeList _nodes;
+    std::set< osg::Node* > _found;
+    void addNode( osg::Node& node, int index );
+
+    bool _batch;
+    void countRemoved( int index );
 
-    typedef std::set< osg::ref_ptr< osg::Node > > NodeSet;
-    NodeSet _nodes;
 };
 
 
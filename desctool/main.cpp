@@ -2,31 +2,54 @@
 
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
+#include <osg/ArgumentParser>
 
 #include "RemoveByDesc.h"
 
 #include <iostream>
 
 
+// desctool [options] <infile> [<outfile>]
+//
+//   -e <desc>    Remove nodes with a description equal to <desc>.
+//   -p <prefix>  Remove nodes with a description starting with <prefix>.
+//   -r <regex>   Remove nodes with a description matching <regex>.
+//
+// Each option can be repeated; all patterns are removed in one pass.
+// With no patterns, nodes with the NUGRAF AccountedCounter
+// description list are removed.
 int main( int argc, char** argv )
 {
+    osg::ArgumentParser arguments( &argc, argv );
+    RemoveByDesc rbd;
+    std::string pattern;
+    while( arguments.read( "-e", pattern ) )
+        rbd.addPattern( pattern, RemoveByDesc::EXACT );
+    while( arguments.read( "-p", pattern ) )
+        rbd.addPattern( pattern, RemoveByDesc::PREFIX );
+    while( arguments.read( "-r", pattern ) )
+        rbd.addPattern( pattern, RemoveByDesc::REGEX );
+
     if( argc < 2 )
     {
-        std::cerr << "desctool <infile> [<outfile>]" << std::endl;
+        std::cerr << "desctool [-e <desc>] [-p <prefix>] [-r <regex>] <infile> [<outfile>]" << std::endl;
         exit( 1 );
     }
 
     osg::ref_ptr< osg::Node > scene( osgDB::readNodeFile( argv[ 1 ] ) );
 
-    osg::Node::DescriptionList criteria;
-    criteria.push_back( "NUGRAF___AccountedCounter" );
-    //criteria.push_back( "AccountedCounter" );
-    criteria.push_back( "ok_int: -1" );
+    if( rbd.getNumPatterns() == 0 )
+    {
+        osg::Node::DescriptionList criteria;
+        criteria.push_back( "NUGRAF___AccountedCounter" );
+        //criteria.push_back( "AccountedCounter" );
+        criteria.push_back( "ok_int: -1" );
+        rbd.setDescriptions( criteria );
+    }
 
-    RemoveByDesc rbd;
-    rbd.setDescriptions( criteria );
     unsigned int count( rbd.execute( scene.get() ) );
     std::cout << "Removed " << count << " nodes." << std::endl;
+    rbd.dump( std::cout );
 
     std::string filename = "output.ive";
     if( argc > 2 )
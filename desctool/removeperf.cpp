@@ -0,0 +1,133 @@
+// Copyright (c) 2010 Skew Matrix Software LLC. All rights reserved.
+
+#include "RemoveByDesc.h"
+#include <osg/ArgumentParser>
+#include <osg/Group>
+#include <osg/Geode>
+#include <osg/LOD>
+#include <osg/Timer>
+#include <osg/Notify>
+
+#include <iostream>
+#include <sstream>
+
+
+// Time per-node and batched removal in RemoveByDesc, and check
+// that both produce the same scene graph.
+//
+// removeperf [--children <n>] [--every <n>]
+//
+// The root Group has numChildren Group children, each with its own
+// Geode. Every nth child is removed, so its Geode moves up to the root.
+// Some removed children contain another removed Group, and the root also
+// has an LOD with a removed child, so nested removals and parents with
+// per-child data are covered too. Every node has a unique name, which
+// identifies it when the two results are compared.
+
+
+osg::Group* createGroup( unsigned int& id, const bool remove )
+{
+    std::ostringstream ostr;
+    ostr << "n" << id++;
+    osg::Group* grp = new osg::Group;
+    grp->setName( ostr.str() );
+    if( remove )
+        grp->addDescription( "remove" );
+
+    osg::Geode* geode = new osg::Geode;
+    ostr.str( "" );
+    ostr << "n" << id++;
+    geode->setName( ostr.str() );
+    grp->addChild( geode );
+    return( grp );
+}
+
+osg::Group* createGraph( const unsigned int numChildren, const unsigned int every )
+{
+    unsigned int id( 0 );
+    osg::Group* root = new osg::Group;
+    root->setName( "root" );
+    for( unsigned int idx=0; idx<numChildren; ++idx )
+    {
+        const bool remove( idx % every == 0 );
+        osg::Group* grp = createGroup( id, remove );
+        if( remove && ( idx % ( every * 10 ) == 0 ) )
+            grp->addChild( createGroup( id, true ) );
+        root->addChild( grp );
+    }
+
+    osg::LOD* lod = new osg::LOD;
+    lod->setName( "lod" );
+    lod->addChild( createGroup( id, false ), 0.f, 100.f );
+    lod->addChild( createGroup( id, true ), 100.f, 1000.f );
+    lod->addChild( createGroup( id, false ), 1000.f, 10000.f );
+    root->addChild( lod );
+
+    return( root );
+}
+
+// Names of all nodes in traversal order, with the child structure
+// and LOD ranges.
+void writeStructure( const osg::Node& node, std::ostream& ostr )
+{
+    ostr << node.getName();
+    const osg::Group* grp( node.asGroup() );
+    if( grp == NULL )
+        return;
+    const osg::LOD* lod( dynamic_cast< const osg::LOD* >( grp ) );
+    ostr << "(";
+    for( unsigned int idx=0; idx<grp->getNumChildren(); ++idx )
+    {
+        if( idx > 0 )
+            ostr << ",";
+        writeStructure( *( grp->getChild( idx ) ), ostr );
+        if( lod != NULL )
+            ostr << "[" << lod->getMinRange( idx ) << "," << lod->getMaxRange( idx ) << "]";
+    }
+    ostr << ")";
+}
+
+double timeRemove( osg::Group* root, const bool batch, unsigned int& removed )
+{
+    RemoveByDesc rbd;
+    rbd.addPattern( "remove" );
+    rbd.setBatchRemoval( batch );
+
+    osg::Timer timer;
+    const osg::Timer_t start( timer.tick() );
+    removed = rbd.execute( root );
+    return( timer.delta_m( start, timer.tick() ) );
+}
+
+int main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+    unsigned int numChildren( 100000 ), every( 10 );
+    arguments.read( "--children", numChildren );
+    arguments.read( "--every", every );
+    if( every == 0 )
+        every = 1;
+
+    osg::ref_ptr< osg::Group > eachRoot = createGraph( numChildren, every );
+    osg::ref_ptr< osg::Group > batchRoot = createGraph( numChildren, every );
+
+    unsigned int eachRemoved, batchRemoved;
+    const double eachTime( timeRemove( eachRoot.get(), false, eachRemoved ) );
+    const double batchTime( timeRemove( batchRoot.get(), true, batchRemoved ) );
+    std::cout << "Per-node removal: " << eachTime << " ms, batched: " << batchTime << " ms";
+    if( batchTime > 0. )
+        std::cout << " (" << eachTime / batchTime << "x)";
+    std::cout << ", " << batchRemoved << " nodes removed." << std::endl;
+
+    std::ostringstream eachStructure, batchStructure;
+    writeStructure( *eachRoot, eachStructure );
+    writeStructure( *batchRoot, batchStructure );
+    if( ( eachRemoved != batchRemoved ) ||
+        ( eachStructure.str() != batchStructure.str() ) )
+    {
+        osg::notify( osg::FATAL ) << "Batched removal produced a different scene graph." << std::endl;
+        return( 1 );
+    }
+
+    return( 0 );
+}
@@ -2,27 +2,55 @@
 #include <osg/Geode>
 #include <osg/Group>
 #include <osg/Drawable>
+#include <osg/Geometry>
+#include <osg/LOD>
+#include <osg/Switch>
+#include <osg/Sequence>
+#include <osg/Transform>
 #include <osg/ref_ptr>
 #include <osgUtil/Optimizer>
 
 
+
+namespace
+{
+
+// MERGE_GEODES and MERGE_GEOMETRY don't merge across these.
+bool isMergeBarrier( const osg::Group& node )
+{
+    return( ( node.asTransform() != NULL ) ||
+        ( dynamic_cast< const osg::LOD* >( &node ) != NULL ) ||
+        ( dynamic_cast< const osg::Switch* >( &node ) != NULL ) ||
+        ( dynamic_cast< const osg::Sequence* >( &node ) != NULL ) );
+}
+
+}
+
+
 CompressSubgraphVisitor::CompressSubgraphVisitor( osg::Node* node, const unsigned int threshold )
     : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ),
     _thresholdCheck( true ),
     _nameCheck( false ),
-    _threshold( threshold )
+    _threshold( threshold ),
+    _costCheck( false ),
+    _dryRun( false ),
+    _fastTracking( false )
 {
     _opt.setIsOperationPermissibleForObjectCallback( new LocalIsOpPermissible() );
 
     if( node != NULL )
-    {
-        OSG_ALWAYS << "Child threshold pass..." << std::endl;
-        node->accept( *this );
+        compress( node );
+}
 
-        OSG_ALWAYS << "Single name pass..." << std::endl;
-        setCompressionMode( SINGLE_NAME );
-        node->accept( *this );
-    }
+void CompressSubgraphVisitor::compress( osg::Node* node )
+{
+    OSG_ALWAYS << "Child threshold pass..." << std::endl;
+    setCompressionMode( CHILD_THRESHOLD );
+    node->accept( *this );
+
+    OSG_ALWAYS << "Single name pass..." << std::endl;
+    setCompressionMode( SINGLE_NAME );
+    node->accept( *this );
 }
 
 void CompressSubgraphVisitor::setNumChildrenThreshold( const unsigned int threshold )
@@ -36,7 +64,9 @@ unsigned int CompressSubgraphVisitor::getNumChildrenThreshold() const
 
 void CompressSubgraphVisitor::setCompressionMode( const unsigned int flags )
 {
-    _thresholdCheck =  _nameCheck = false;
+    _thresholdCheck =  _nameCheck = _costCheck = false;
+    if( flags & COST_MODEL )
+        _costCheck = true;
     if( flags & SINGLE_NAME )
         _nameCheck = true;
     if( flags & CHILD_THRESHOLD )
@@ -49,39 +79,140 @@ unsigned int CompressSubgraphVisitor::getCompressionMode() const
         flags |= SINGLE_NAME;
     if( _thresholdCheck )
         flags |= CHILD_THRESHOLD;
+    if( _costCheck )
+        flags |= COST_MODEL;
     return( flags );
 }
 
+void CompressSubgraphVisitor::setCostModel( const CostModel& costModel )
+{
+    _costModel = costModel;
+}
+const CompressSubgraphVisitor::CostModel& CompressSubgraphVisitor::getCostModel() const
+{
+    return( _costModel );
+}
+
+void CompressSubgraphVisitor::setFastTracking( const bool fastTracking )
+{
+    _fastTracking = fastTracking;
+}
+bool CompressSubgraphVisitor::getFastTracking() const
+{
+    return( _fastTracking );
+}
+
+void CompressSubgraphVisitor::setDryRun( const bool dryRun )
+{
+    _dryRun = dryRun;
+}
+bool CompressSubgraphVisitor::getDryRun() const
+{
+    return( _dryRun );
+}
+
+void CompressSubgraphVisitor::dump( std::ostream& ostr ) const
+{
+    double totalWin( 0. );
+    std::vector< Candidate >::const_iterator it;
+    for( it = _candidates.begin(); it != _candidates.end(); ++it )
+        totalWin += it->_win;
+
+    ostr << "CompressSubgraphVisitor: " << _candidates.size() << " subgraphs " <<
+        ( _dryRun ? "would be " : "" ) << "compressed, estimated win " <<
+        totalWin << " us/frame." << std::endl;
+    for( it = _candidates.begin(); it != _candidates.end(); ++it )
+    {
+        ostr << "  \"" << it->_name << "\": " << it->_children << " children, " <<
+            it->_cost._nodes << " nodes, " << it->_cost._drawables << " drawables, " <<
+            it->_cost._vertices << " vertices, " << it->_stateSets << " StateSets, tightness " <<
+            it->_tightness << ", win " << it->_win << " us" << std::endl;
+    }
+}
+
+double CompressSubgraphVisitor::estimateWin( const osg::Group& node, const SubgraphCost& cost,
+    const unsigned int numStateSets, float& tightness ) const
+{
+    tightness = 1.f;
+    if( cost._drawables == 0 )
+        return( 0. );
+
+    const osg::BoundingSphere& bs( node.getBound() );
+    if( bs.valid() && ( bs.radius() > 0.f ) )
+    {
+        double childVolume( 0. );
+        for( unsigned int idx=0; idx<node.getNumChildren(); ++idx )
+        {
+            const osg::BoundingSphere& childBS( node.getChild( idx )->getBound() );
+            if( childBS.valid() )
+                childVolume += (double)childBS.radius() * childBS.radius() * childBS.radius();
+        }
+        const double volume( (double)bs.radius() * bs.radius() * bs.radius() );
+        tightness = (float)osg::minimum( childVolume / volume, 1. );
+    }
+
+    const unsigned int afterDraws( estimateMergedDrawables( cost, numStateSets ) );
+    const double before( _costModel._nodeCost * cost._nodes +
+        _costModel._drawCost * cost._drawables +
+        _costModel._stateCost * numStateSets );
+    const double after( _costModel._nodeCost * ( 1 + cost._barriers + afterDraws ) +
+        _costModel._drawCost * afterDraws +
+        _costModel._stateCost * numStateSets +
+        _costModel._vertexCost * cost._vertices * ( 1. - tightness ) );
+    return( before - after );
+}
+unsigned int CompressSubgraphVisitor::estimateMergedDrawables( const SubgraphCost& cost, const unsigned int numStateSets )
+{
+    return( osg::minimum( osg::maximum( numStateSets, 1u ) * cost.getNumMergeGroups(), cost._drawables ) );
+}
+
 
 void CompressSubgraphVisitor::apply( osg::Node& node )
 {
-    if( ( node.getStateSet() != NULL ) && ( _stateStack.size() > 0 ) )
-        _stateStack.back().insert( node.getStateSet() );
+    if( node.getStateSet() != NULL )
+        addStateSet( node.getStateSet() );
 
-    if( _nameCheck &&
-        !( node.getName().empty() ) && ( _nameStack.size() > 0 ) )
-        _nameStack.back().insert( node.getName() );
+    if( _costCheck && ( _costStack.size() > 0 ) )
+        ++( _costStack.back()._nodes );
+
+    if( _nameCheck && !( node.getName().empty() ) )
+        addName( node.getName() );
 
     traverse( node );
 }
 void CompressSubgraphVisitor::apply( osg::Geode& node )
 {
-    if( ( node.getStateSet() != NULL ) && ( _stateStack.size() > 0 ) )
-        _stateStack.back().insert( node.getStateSet() );
+    if( node.getStateSet() != NULL )
+        addStateSet( node.getStateSet() );
 
-    if( _nameCheck &&
-        !( node.getName().empty() ) && ( _nameStack.size() > 0 ) )
-        _nameStack.back().insert( node.getName() );
+    if( _nameCheck && !( node.getName().empty() ) )
+        addName( node.getName() );
 
-    if( _stateStack.empty() )
+    if( !inSubgraph() )
         return;
 
+    SubgraphCost* cost( ( _costCheck && ( _costStack.size() > 0 ) ) ? &( _costStack.back() ) : NULL );
+    if( cost != NULL )
+    {
+        ++( cost->_nodes );
+        cost->_drawables += node.getNumDrawables();
+        if( node.getNumDrawables() > 0 )
+            cost->_open = true;
+    }
+
     for( unsigned int idx = 0; idx < node.getNumDrawables(); ++idx )
     {
         osg::Drawable* draw( node.getDrawable( idx ) );
 
+        if( cost != NULL )
+        {
+            const osg::Geometry* geom( draw->asGeometry() );
+            if( ( geom != NULL ) && ( geom->getVertexArray() != NULL ) )
+                cost->_vertices += geom->getVertexArray()->getNumElements();
+        }
+
         if( draw->getStateSet() != NULL )
-            _stateStack.back().insert( draw->getStateSet() );
+            addStateSet( draw->getStateSet() );
 
         // Do not check Drawables names. PT never exports Drawables with names.
     }
@@ -90,55 +221,53 @@ void CompressSubgraphVisitor::apply( osg::Geode& node )
 }
 void CompressSubgraphVisitor::apply( osg::Group& node )
 {
-    // Push data onto state stack.
-    StateSetSet newSSS;
-    if( node.getStateSet() != NULL )
-        newSSS.insert( node.getStateSet() );
-    _stateStack.push_back( newSSS );
+    // Push data onto state and name stacks.
+    pushSubgraph( node );
 
-    // Push data onto name stack.
-    if( _nameCheck )
+    // Push data onto cost stack. Count this Group.
+    if( _costCheck )
     {
-        NameSet newNS;
-        if( !( node.getName().empty() ) )
-            newNS.insert( node.getName() );
-        _nameStack.push_back( newNS );
+        _costStack.push_back( SubgraphCost() );
+        _costStack.back()._nodes = 1;
     }
 
 
     traverse( node );
 
 
-    // Obtain results from state stack.
-    const StateSetSet& sss( _stateStack.back() );
-    if( _stateStack.size() > 1 )
-    {
-        // Take all the StateSets in this
-        // subgraph and insert them into the new top of stack.
-        StateSetSet& newTop( _stateStack[ _stateStack.size() - 2 ] );
-        newTop.insert( sss.begin(), sss.end() );
-    }
-    const unsigned int numStateSetsInSubgraph( sss.size() );
-    _stateStack.pop_back();
+    // Obtain results from state and name stacks.
+    unsigned int numStateSetsInSubgraph, numNamesInSubgraph;
+    popSubgraph( numStateSetsInSubgraph, numNamesInSubgraph );
 
-    // Obtain results from name stack.
-    unsigned int numNamesInSubgraph( 0 );
-    if( _nameCheck )
+    // Obtain results from cost stack, and add them to the parent.
+    SubgraphCost cost;
+    SubgraphCost* parentCost( NULL );
+    if( _costCheck )
     {
-        const NameSet& ns( _nameStack.back() );
-        if( _nameStack.size() > 1 )
+        cost = _costStack.back();
+        _costStack.pop_back();
+        if( _costStack.size() > 0 )
         {
-            // Take all the Names in this
-            // subgraph and insert them into the new top of stack.
-            NameSet& newTop( _nameStack[ _nameStack.size() - 2 ] );
-            newTop.insert( ns.begin(), ns.end() );
+            parentCost = &( _costStack.back() );
+            parentCost->_nodes += cost._nodes;
+            parentCost->_drawables += cost._drawables;
+            parentCost->_vertices += cost._vertices;
+            parentCost->_groups += cost._groups;
+            parentCost->_barriers += cost._barriers;
+            if( isMergeBarrier( node ) )
+            {
+                // Close this node's merge group.
+                ++( parentCost->_barriers );
+                if( cost._open )
+                    ++( parentCost->_groups );
+            }
+            else if( cost._open )
+                parentCost->_open = true;
         }
-        numNamesInSubgraph = ns.size();
-        _nameStack.pop_back();
     }
 
     // Check for conditions that force us to skip compression..
-    if( numStateSetsInSubgraph > 1 )
+    if( !_costCheck && ( numStateSetsInSubgraph > 1 ) )
     {
         // Too many StateSets
         return;
@@ -155,10 +284,43 @@ void CompressSubgraphVisitor::apply( osg::Group& node )
         // Not enough children at this node.
         return;
     }
+    if( _costCheck )
+    {
+        // Fast tracking doesn't count beyond one StateSet. Assume
+        // the worst case, one StateSet per Drawable.
+        if( _fastTracking && ( numStateSetsInSubgraph > 1 ) )
+            numStateSetsInSubgraph = osg::maximum( numStateSetsInSubgraph, cost._drawables );
+
+        Candidate candidate;
+        candidate._win = estimateWin( node, cost, numStateSetsInSubgraph, candidate._tightness );
+        if( candidate._win <= 0. )
+        {
+            // Not worth it.
+            return;
+        }
+        candidate._name = node.getName();
+        candidate._children = node.getNumChildren();
+        candidate._cost = cost;
+        candidate._stateSets = numStateSetsInSubgraph;
+        _candidates.push_back( candidate );
+
+        // Ancestors see the subgraph as compressed: its merge barriers,
+        // and about one Geode and one Drawable per StateSet in each
+        // merge group. The merge groups themselves are unchanged.
+        if( parentCost != NULL )
+        {
+            const unsigned int afterDraws( estimateMergedDrawables( cost, numStateSetsInSubgraph ) );
+            parentCost->_nodes -= cost._nodes - osg::minimum( cost._nodes, 1 + cost._barriers + afterDraws );
+            parentCost->_drawables -= cost._drawables - afterDraws;
+        }
+
+        if( _dryRun )
+            return;
+    }
 
 
-    // Either the number of named nodes is == 1
-    // or the number of children exceeds the threshold.
+    // Either the number of named nodes is == 1, the number of
+    // children exceeds the threshold, or the cost model predicts a win.
     // Compress this subgraph.
     OSG_INFO << "Compressing subgraph at node \"" << node.getName() << "\", " <<
         node.getNumChildren() << " children..." << std::endl;
@@ -226,3 +388,99 @@ bool CompressSubgraphVisitor::LocalIsOpPermissible::isOperationPermissibleForObj
             return( optimizer->isOperationPermissibleForObjectImplementation( node, option ) );
     }
 }
+
+
+void CompressSubgraphVisitor::addStateSet( const osg::StateSet* stateSet )
+{
+    if( _fastTracking )
+    {
+        if( _summaryStack.empty() )
+            return;
+        StateSetIDMap::const_iterator it( _stateSetIDs.find( stateSet ) );
+        if( it == _stateSetIDs.end() )
+            it = _stateSetIDs.insert( StateSetIDMap::value_type( stateSet, _stateSetIDs.size() ) ).first;
+        _summaryStack.back()._stateSets.add( it->second );
+    }
+    else if( _stateStack.size() > 0 )
+        _stateStack.back().insert( const_cast< osg::StateSet* >( stateSet ) );
+}
+void CompressSubgraphVisitor::addName( const std::string& name )
+{
+    if( _fastTracking )
+    {
+        if( _summaryStack.empty() )
+            return;
+        NameIDMap::const_iterator it( _nameIDs.find( name ) );
+        if( it == _nameIDs.end() )
+            it = _nameIDs.insert( NameIDMap::value_type( name, _nameIDs.size() ) ).first;
+        _summaryStack.back()._names.add( it->second );
+    }
+    else if( _nameStack.size() > 0 )
+        _nameStack.back().insert( name );
+}
+bool CompressSubgraphVisitor::inSubgraph() const
+{
+    return( _fastTracking ? !( _summaryStack.empty() ) : !( _stateStack.empty() ) );
+}
+
+void CompressSubgraphVisitor::pushSubgraph( const osg::Group& node )
+{
+    if( _fastTracking )
+        _summaryStack.push_back( SubgraphSummary() );
+    else
+    {
+        _stateStack.push_back( StateSetSet() );
+        if( _nameCheck )
+            _nameStack.push_back( NameSet() );
+    }
+
+    if( node.getStateSet() != NULL )
+        addStateSet( node.getStateSet() );
+    if( _nameCheck && !( node.getName().empty() ) )
+        addName( node.getName() );
+}
+void CompressSubgraphVisitor::popSubgraph( unsigned int& numStateSets, unsigned int& numNames )
+{
+    numNames = 0;
+
+    if( _fastTracking )
+    {
+        const SubgraphSummary summary( _summaryStack.back() );
+        _summaryStack.pop_back();
+        if( _summaryStack.size() > 0 )
+        {
+            // Merge this subgraph's summary into the new top of stack.
+            _summaryStack.back()._stateSets.merge( summary._stateSets );
+            _summaryStack.back()._names.merge( summary._names );
+        }
+        numStateSets = summary._stateSets.count();
+        if( _nameCheck )
+            numNames = summary._names.count();
+        return;
+    }
+
+    const StateSetSet& sss( _stateStack.back() );
+    if( _stateStack.size() > 1 )
+    {
+        // Take all the StateSets in this
+        // subgraph and insert them into the new top of stack.
+        StateSetSet& newTop( _stateStack[ _stateStack.size() - 2 ] );
+        newTop.insert( sss.begin(), sss.end() );
+    }
+    numStateSets = sss.size();
+    _stateStack.pop_back();
+
+    if( _nameCheck )
+    {
+        const NameSet& ns( _nameStack.back() );
+        if( _nameStack.size() > 1 )
+        {
+            // Take all the Names in this
+            // subgraph and insert them into the new top of stack.
+            NameSet& newTop( _nameStack[ _nameStack.size() - 2 ] );
+            newTop.insert( ns.begin(), ns.end() );
+        }
+        numNames = ns.size();
+        _nameStack.pop_back();
+    }
+}
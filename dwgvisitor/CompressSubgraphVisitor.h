@@ -4,7 +4,9 @@
 
 #include <osg/NodeVisitor>
 #include <osgUtil/Optimizer>
+#include <boost/unordered_map.hpp>
 
+#include <iostream>
 #include <set>
 #include <vector>
 #include <string>
@@ -27,21 +29,37 @@ equals one.
 In both modes, a subgraph is compressed only if there is
 zero or one unique StateSets referenced in the subgraph.
 
+In Cost Model mode, a subgraph is compressed only if compression
+is estimated to reduce cull and draw time; see CostModel. This mode
+allows any number of StateSets, and can be combined with the other
+modes. With setDryRun( true ), nothing is compressed, and dump()
+reports the subgraphs that would be.
+
 "Compressed" means the osgUtil::Optimizer is ran on the
 scene graph to remove redundant nodes, merge geodes, and
 merge geometry.
 
-If you pass a node to the constructor, this visitor performs
-two traversals, first in Child Threshold mode, then in Single
-Name mode. This is often faster than executing both modes
+If you pass a node to the constructor, or call compress(), this
+visitor performs two traversals, first in Child Threshold mode,
+then in Single Name mode. This is often faster than executing both modes
 simultaneously, as the first traversal can dramatically reduce
 the processing of the second traversal for certain scene graphs.
+
+By default, each Group collects the set of unique StateSets and names
+in its subgraph and merges it into its parent's set, which is costly in
+deep hierarchies. With setFastTracking( true ), StateSets and names are
+interned to integer IDs, and each Group keeps only a summary: none, one
+unique ID, or many. Merging a summary into the parent is constant time,
+so the traversal is linear in the size of the scene graph.
 **/
 class CompressSubgraphVisitor : public osg::NodeVisitor
 {
 public:
     CompressSubgraphVisitor( osg::Node* node=NULL, const unsigned int threshold=5000 );
 
+    /** Run the Child Threshold pass, then the Single Name pass, on \c node. */
+    void compress( osg::Node* node );
+
     /** \brief Group node child count threshold.
     Ignore (don't compredd) subgraphs that are rooted at Group nodes
     with less than \c threshold children. The default is 5000. */
@@ -51,11 +69,58 @@ public:
     enum {
         CHILD_THRESHOLD = ( 0x1 << 0 ),
         SINGLE_NAME = ( 0x1 << 1 ),
+        COST_MODEL = ( 0x1 << 2 ),
         FULL = ( CHILD_THRESHOLD | SINGLE_NAME )
     };
     void setCompressionMode( const unsigned int flags );
     unsigned int getCompressionMode() const;
 
+    /** \brief Per-frame cost estimate weights, in microseconds.
+    \details Before compression, a subgraph costs one cull test per node,
+    one draw per Drawable, and one state change per unique StateSet.
+    The Optimizer can't merge Geodes or Drawables across Transforms,
+    LODs, Switches or Sequences, so each of those keeps its own merge
+    group. Afterwards, the Optimizer leaves those nodes, and about one
+    Geode and one merged Drawable per StateSet in each merge group, and
+    the state changes are unchanged. But the
+    merged Drawables can only be culled as a whole. Compression therefore
+    also pays for the vertices that per-child culling would have skipped,
+    estimated as the subgraph's vertex count times ( 1 - tightness ).
+    Tightness is the summed volume of the child bounding spheres over the
+    volume of the Group's bounding sphere, clamped to 1. */
+    struct CostModel
+    {
+        CostModel()
+          : _nodeCost( .2 ),
+            _drawCost( 2. ),
+            _stateCost( 5. ),
+            _vertexCost( .002 )
+        {}
+
+        double _nodeCost;
+        double _drawCost;
+        double _stateCost;
+        double _vertexCost;
+    };
+    void setCostModel( const CostModel& costModel );
+    const CostModel& getCostModel() const;
+
+    /** If true, track StateSets and names as interned ID summaries
+    instead of sets. Set before traversal. In COST_MODEL mode, a subgraph
+    with more than one StateSet is costed as if no Drawables could be
+    merged, because the exact count is not tracked. Default: false. */
+    void setFastTracking( const bool fastTracking );
+    bool getFastTracking() const;
+
+    /** If true, COST_MODEL mode records what it would compress
+    without modifying the scene graph. Default: false. */
+    void setDryRun( const bool dryRun );
+    bool getDryRun() const;
+
+    /** Report the subgraphs COST_MODEL mode compressed,
+    or would have compressed in a dry run. */
+    void dump( std::ostream& ostr ) const;
+
     virtual void apply( osg::Node& node );
     virtual void apply( osg::Geode& node );
     virtual void apply( osg::Group& node );
@@ -73,6 +138,50 @@ protected:
 
     unsigned int _threshold;
 
+    bool _costCheck;
+    bool _dryRun;
+    CostModel _costModel;
+
+    struct SubgraphCost
+    {
+        SubgraphCost() : _nodes( 0 ), _drawables( 0 ), _vertices( 0 ),
+            _barriers( 0 ), _groups( 0 ), _open( false ) {}
+        unsigned int _nodes;
+        unsigned int _drawables;
+        unsigned int _vertices;
+
+        // Transforms, LODs, Switches and Sequences below the root, which
+        // the Optimizer can't merge across, and the merge groups with
+        // Drawables below them. _open is true if the root's own merge
+        // group has Drawables.
+        unsigned int _barriers;
+        unsigned int _groups;
+        bool _open;
+
+        unsigned int getNumMergeGroups() const { return( _groups + ( _open ? 1 : 0 ) ); }
+    };
+    typedef std::vector< SubgraphCost > CostStack;
+    CostStack _costStack;
+
+    /** \return Estimated microseconds per frame saved by compressing
+    \c node, negative for a loss. */
+    double estimateWin( const osg::Group& node, const SubgraphCost& cost,
+        const unsigned int numStateSets, float& tightness ) const;
+    /** Merged Drawables left by compression, assuming each merge group
+    could hold every StateSet in the subgraph. */
+    static unsigned int estimateMergedDrawables( const SubgraphCost& cost, const unsigned int numStateSets );
+
+    struct Candidate
+    {
+        std::string _name;
+        unsigned int _children;
+        SubgraphCost _cost;
+        unsigned int _stateSets;
+        float _tightness;
+        double _win;
+    };
+    std::vector< Candidate > _candidates;
+
     typedef std::set< osg::StateSet* > StateSetSet;
     typedef std::vector< StateSetSet > StateSetStack;
 
@@ -82,6 +191,62 @@ protected:
     typedef std::vector< NameSet > NameStack;
 
     NameStack _nameStack;
+
+    bool _fastTracking;
+
+    /** Zero, one, or many unique IDs. */
+    struct UniqueSummary
+    {
+        enum { NONE = 0xffffffff, MANY = 0xfffffffe };
+
+        UniqueSummary() : _id( NONE ) {}
+
+        void add( const unsigned int id )
+        {
+            if( _id == NONE )
+                _id = id;
+            else if( _id != id )
+                _id = MANY;
+        }
+        void merge( const UniqueSummary& rhs )
+        {
+            if( rhs._id == MANY )
+                _id = MANY;
+            else if( rhs._id != NONE )
+                add( rhs._id );
+        }
+        /** \return 0, 1, or 2 for many. */
+        unsigned int count() const
+        {
+            return( ( _id == NONE ) ? 0 : ( ( _id == MANY ) ? 2 : 1 ) );
+        }
+
+        unsigned int _id;
+    };
+    struct SubgraphSummary
+    {
+        UniqueSummary _stateSets;
+        UniqueSummary _names;
+    };
+    typedef std::vector< SubgraphSummary > SummaryStack;
+
+    SummaryStack _summaryStack;
+
+    typedef boost::unordered_map< const osg::StateSet*, unsigned int > StateSetIDMap;
+    typedef boost::unordered_map< std::string, unsigned int > NameIDMap;
+
+    StateSetIDMap _stateSetIDs;
+    NameIDMap _nameIDs;
+
+    /** Add to the innermost subgraph, using whichever tracking is active. */
+    void addStateSet( const osg::StateSet* stateSet );
+    void addName( const std::string& name );
+    bool inSubgraph() const;
+
+    void pushSubgraph( const osg::Group& node );
+    /** Pop the innermost subgraph and merge it into its parent.
+    In fast tracking mode, counts above one are reported as 2. */
+    void popSubgraph( unsigned int& numStateSets, unsigned int& numNames );
 };
 
 
@@ -4,24 +4,66 @@
 #include <osgDB/WriteFile>
 #include <osgViewer/Viewer>
 #include <osg/MatrixTransform>
+#include <osg/ArgumentParser>
 #include <osgwTools/Shapes.h>
 
 #include "RemoveNodeNameVisitor.h"
 #include "CompressSubgraphVisitor.h"
 
+#include <iostream>
+
+// dwgvisitor [--cost] [--dry-run] [--fast] <infile> [<outfile>]
+//
+// --cost     Compress subgraphs where the cost model predicts a win,
+//            and print a report of the compressed subgraphs.
+// --dry-run  With --cost, report candidates without compressing or
+//            writing any output.
+// --fast     Track StateSets and names with interned ID summaries,
+//            which is linear in the size of the scene graph.
+
 int
 main( int argc, char** argv )
 {
-    osg::ref_ptr< osg::Node > scene = osgDB::readNodeFile( argv[ 1 ] );
+    osg::ArgumentParser arguments( &argc, argv );
+    const bool cost( arguments.read( "--cost" ) );
+    const bool dryRun( arguments.read( "--dry-run" ) );
+    const bool fast( arguments.read( "--fast" ) );
+
+    if( arguments.argc() < 2 )
+    {
+        std::cout << "Usage: " << arguments.getApplicationName() <<
+            " [--cost] [--dry-run] [--fast] <infile> [<outfile>]" << std::endl;
+        return 1;
+    }
+    osg::ref_ptr< osg::Node > scene = osgDB::readNodeFile( arguments[ 1 ] );
+    if( !scene.valid() )
+        return 1;
 
     ves::xplorer::scenegraph::util::RemoveNodeNameVisitor( scene.get() );
     //osgDB::writeNodeFile( *scene.get(), "no_name.osg" );
-    CompressSubgraphVisitor( scene.get(), 50 );
+    if( cost )
+    {
+        CompressSubgraphVisitor csv;
+        csv.setFastTracking( fast );
+        csv.setCompressionMode( CompressSubgraphVisitor::COST_MODEL );
+        csv.setDryRun( dryRun );
+        scene->accept( csv );
+        csv.dump( std::cout );
+    }
+    else
+    {
+        CompressSubgraphVisitor csv( NULL, 50 );
+        csv.setFastTracking( fast );
+        csv.compress( scene.get() );
+    }
+
+    if( cost && dryRun )
+        return 0;
 
     std::string filename = "output.ive";
-    if( argc > 2 )
+    if( arguments.argc() > 2 )
     {
-        filename = argv[ 2 ];
+        filename = arguments[ 2 ];
     }
     osgDB::writeNodeFile( *scene.get(), filename );
     return 0;
@@ -0,0 +1,439 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#include "AttributeQuantizer.h"
+#include "FixedFunctionLighting.h"
+#include <osg/Shader>
+#include <osg/Uniform>
+#include <OpenThreads/ScopedLock>
+
+#include <sstream>
+#include <cmath>
+
+
+
+namespace
+{
+
+const char* decodeSource =
+    "uniform vec3 meshopt_positionScale;\n"
+    "uniform vec3 meshopt_positionOffset;\n"
+    "uniform vec2 meshopt_texCoordScale;\n"
+    "uniform vec2 meshopt_texCoordOffset;\n"
+    "#ifdef OCT_NORMALS\n"
+    "attribute vec2 meshopt_octNormal;\n"
+    "vec3 octDecode( vec2 e )\n"
+    "{\n"
+    "    vec3 v = vec3( e, 1.0 - abs( e.x ) - abs( e.y ) );\n"
+    "    if( v.z < 0.0 )\n"
+    "        v.xy = ( 1.0 - abs( v.yx ) ) * vec2( v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0 );\n"
+    "    return( normalize( v ) );\n"
+    "}\n"
+    "#endif\n"
+    "void main()\n"
+    "{\n"
+    "    vec4 vertex = vec4( gl_Vertex.xyz * meshopt_positionScale + meshopt_positionOffset, 1.0 );\n"
+    "    vec4 texCoord = vec4( gl_MultiTexCoord0.xy * meshopt_texCoordScale + meshopt_texCoordOffset, 0.0, 1.0 );\n"
+    "#ifdef OCT_NORMALS\n"
+    "    fixedFunctionVertex( vertex, octDecode( meshopt_octNormal ), texCoord );\n"
+    "#else\n"
+    "    fixedFunctionVertex( vertex, gl_Normal, texCoord );\n"
+    "#endif\n"
+    "}\n";
+
+osg::Program* createProgram( bool octNormals )
+{
+    std::string source( "#version 120\n" );
+    if( octNormals )
+        source += "#define OCT_NORMALS 1\n";
+    source += FixedFunctionLighting::getVertexSource();
+    source += decodeSource;
+
+    osg::Program* program( new osg::Program );
+    program->setName( octNormals ? "meshopt decode (oct normals)" : "meshopt decode" );
+    program->addShader( new osg::Shader( osg::Shader::VERTEX, source ) );
+    if( octNormals )
+        program->addBindAttribLocation( "meshopt_octNormal", AttributeQuantizer::OCT_NORMAL_ATTRIB );
+    return( program );
+}
+
+// Round to nearest and clamp to [-limit,limit].
+inline int quantizeValue( float value, int limit )
+{
+    const int q( (int)std::floor( value * (float)limit + .5f ) );
+    return( osg::clampBetween( q, -limit, limit ) );
+}
+
+inline float signNotZero( float value )
+{
+    return( ( value >= 0.f ) ? 1.f : -1.f );
+}
+
+osg::Vec2 octEncode( const osg::Vec3& n )
+{
+    const float l1( std::fabs( n.x() ) + std::fabs( n.y() ) + std::fabs( n.z() ) );
+    if( l1 == 0.f )
+        return( osg::Vec2( 0.f, 0.f ) );
+    osg::Vec2 p( n.x() / l1, n.y() / l1 );
+    if( n.z() < 0.f )
+        p = osg::Vec2( ( 1.f - std::fabs( p.y() ) ) * signNotZero( p.x() ),
+            ( 1.f - std::fabs( p.x() ) ) * signNotZero( p.y() ) );
+    return( p );
+}
+
+osg::Vec3 octDecode( const osg::Vec2& e )
+{
+    osg::Vec3 v( e.x(), e.y(), 1.f - std::fabs( e.x() ) - std::fabs( e.y() ) );
+    if( v.z() < 0.f )
+    {
+        const float x( v.x() );
+        v.x() = ( 1.f - std::fabs( v.y() ) ) * signNotZero( x );
+        v.y() = ( 1.f - std::fabs( x ) ) * signNotZero( v.y() );
+    }
+    v.normalize();
+    return( v );
+}
+
+// Angle between two unit vectors, in degrees.
+inline double angleBetween( const osg::Vec3& a, const osg::Vec3& b )
+{
+    return( osg::RadiansToDegrees( std::acos( osg::clampBetween< double >( a * b, -1., 1. ) ) ) );
+}
+
+}
+
+
+
+AttributeQuantizer::AttributeStats::AttributeStats()
+  : _arrays( 0 ),
+    _bytesIn( 0 ),
+    _bytesOut( 0 ),
+    _maxError( 0. )
+{
+}
+
+bool AttributeQuantizer::StateSetKey::operator<( const StateSetKey& rhs ) const
+{
+    if( _ss != rhs._ss )
+        return( _ss < rhs._ss );
+    if( _positions != rhs._positions )
+        return( _positions < rhs._positions );
+    if( _texCoords != rhs._texCoords )
+        return( _texCoords < rhs._texCoords );
+    return( _oct < rhs._oct );
+}
+
+
+AttributeQuantizer::AttributeQuantizer( NormalMode normalMode, bool positions, bool texCoords )
+  : _normalMode( normalMode ),
+    _positions( positions ),
+    _texCoords( texCoords ),
+    _skipped( 0 )
+{
+    _program = createProgram( false );
+    _octProgram = createProgram( true );
+}
+AttributeQuantizer::~AttributeQuantizer()
+{
+}
+
+void AttributeQuantizer::quantize( osg::Geometry& geom )
+{
+    // The decode shader replaces fixed-function vertex processing,
+    // so leave Geometries whose state it can't reproduce alone.
+    if( !FixedFunctionLighting::isReproducible( geom ) )
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+        ++_skipped;
+        return;
+    }
+
+    double maxError;
+
+    const osg::Vec3Array* verts( dynamic_cast< const osg::Vec3Array* >( geom.getVertexArray() ) );
+    if( _positions && ( verts != NULL ) && !verts->empty() && ( find( POSITION, verts ) == NULL ) )
+    {
+        const Quantized q( quantizePositions( *verts, maxError ) );
+        add( POSITION, verts, q, maxError );
+    }
+
+    const osg::Vec2Array* tc( dynamic_cast< const osg::Vec2Array* >( geom.getTexCoordArray( 0 ) ) );
+    if( _texCoords && ( tc != NULL ) && !tc->empty() && ( find( TEXCOORD, tc ) == NULL ) )
+    {
+        const Quantized q( quantizeTexCoords( *tc, maxError ) );
+        add( TEXCOORD, tc, q, maxError );
+    }
+
+    const osg::Vec3Array* norms( dynamic_cast< const osg::Vec3Array* >( geom.getNormalArray() ) );
+    if( ( _normalMode != NORMAL_FLOAT ) && ( norms != NULL ) && !norms->empty() &&
+        ( geom.getNormalBinding() == osg::Geometry::BIND_PER_VERTEX ) &&
+        ( find( NORMAL, norms ) == NULL ) )
+    {
+        const Quantized q( quantizeNormals( *norms, maxError ) );
+        add( NORMAL, norms, q, maxError );
+    }
+
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+    _geometries.push_back( &geom );
+}
+
+void AttributeQuantizer::apply()
+{
+    std::vector< osg::Geometry* >::const_iterator it;
+    for( it = _geometries.begin(); it != _geometries.end(); ++it )
+    {
+        osg::Geometry& geom( **it );
+
+        const Quantized* positions( find( POSITION, geom.getVertexArray() ) );
+        const Quantized* texCoords( find( TEXCOORD, geom.getTexCoordArray( 0 ) ) );
+        const Quantized* normals( NULL );
+        if( geom.getNormalBinding() == osg::Geometry::BIND_PER_VERTEX )
+            normals = find( NORMAL, geom.getNormalArray() );
+        if( ( positions == NULL ) && ( texCoords == NULL ) && ( normals == NULL ) )
+            continue;
+
+        // The decode shader needs float normals, or quantized normals,
+        // so it can light the Geometry.
+        const bool octNormals( ( normals != NULL ) && ( _normalMode != NORMAL_SNORM16 ) );
+        geom.setStateSet( getStateSet( geom, positions, texCoords, octNormals ) );
+
+        if( positions != NULL )
+        {
+            // Bounds computation only understands float vertices, so
+            // keep the float bound.
+            if( geom.getComputeBoundingBoxCallback() == NULL )
+                geom.setInitialBound( geom.getBound() );
+            geom.setVertexArray( positions->_array.get() );
+        }
+        if( texCoords != NULL )
+            geom.setTexCoordArray( 0, texCoords->_array.get() );
+        if( octNormals )
+        {
+            geom.setNormalArray( NULL );
+            geom.setNormalBinding( osg::Geometry::BIND_OFF );
+            geom.setVertexAttribArray( OCT_NORMAL_ATTRIB, normals->_array.get() );
+            geom.setVertexAttribBinding( OCT_NORMAL_ATTRIB, osg::Geometry::BIND_PER_VERTEX );
+        }
+        else if( normals != NULL )
+            geom.setNormalArray( normals->_array.get() );
+
+        geom.dirtyDisplayList();
+    }
+    _geometries.clear();
+    _stateSets.clear();
+}
+
+void AttributeQuantizer::dump( std::ostream& ostr ) const
+{
+    const char* names[ NUM_ATTRIBUTES ] = { "Positions", "Normals", "TexCoords" };
+    const char* units[ NUM_ATTRIBUTES ] = { "", " deg", "" };
+    unsigned long long totalIn( 0 ), totalOut( 0 );
+
+    ostr << "AttributeQuantizer results:" << std::endl;
+    for( unsigned int idx=0; idx<NUM_ATTRIBUTES; ++idx )
+    {
+        const AttributeStats& stats( _stats[ idx ] );
+        ostr << "  " << names[ idx ] << ": " << stats._arrays << " arrays, " <<
+            stats._bytesIn << " -> " << stats._bytesOut << " bytes, max error " <<
+            stats._maxError << units[ idx ] << std::endl;
+        totalIn += stats._bytesIn;
+        totalOut += stats._bytesOut;
+    }
+    ostr << "  Bytes saved: " << totalIn - totalOut << std::endl;
+    ostr << "  Geometries skipped (state the decode shader can't reproduce): " << _skipped << std::endl;
+}
+
+
+const AttributeQuantizer::Quantized* AttributeQuantizer::find( Attribute attr, const osg::Array* source ) const
+{
+    if( source == NULL )
+        return( NULL );
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+    QuantizedMap::const_iterator it( _quantized[ attr ].find( source ) );
+    return( ( it == _quantized[ attr ].end() ) ? NULL : &( it->second ) );
+}
+
+void AttributeQuantizer::add( Attribute attr, const osg::Array* source, const Quantized& quantized, double maxError )
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+    // Another thread may have quantized a shared array first.
+    if( !_quantized[ attr ].insert( std::make_pair( source, quantized ) ).second )
+        return;
+
+    AttributeStats& stats( _stats[ attr ] );
+    ++stats._arrays;
+    stats._bytesIn += source->getTotalDataSize();
+    stats._bytesOut += quantized._array->getTotalDataSize();
+    stats._maxError = osg::maximum( stats._maxError, maxError );
+}
+
+
+AttributeQuantizer::Quantized AttributeQuantizer::quantizePositions( const osg::Vec3Array& source, double& maxError ) const
+{
+    osg::BoundingBox bb;
+    osg::Vec3Array::const_iterator it;
+    for( it = source.begin(); it != source.end(); ++it )
+        bb.expandBy( *it );
+
+    // Map the box to [-32767,32767] on each axis.
+    Quantized result;
+    result._offset = bb.center();
+    unsigned int idx;
+    for( idx=0; idx<3; ++idx )
+    {
+        const float halfExtent( ( bb._max[ idx ] - bb._min[ idx ] ) * .5f );
+        result._scale[ idx ] = ( ( halfExtent > 0.f ) ? halfExtent : 1.f ) / 32767.f;
+    }
+
+    osg::Vec3sArray* dest( new osg::Vec3sArray );
+    dest->reserve( source.size() );
+    maxError = 0.;
+    for( it = source.begin(); it != source.end(); ++it )
+    {
+        osg::Vec3s q;
+        osg::Vec3 decoded;
+        for( idx=0; idx<3; ++idx )
+        {
+            q[ idx ] = (short)quantizeValue( ( (*it)[ idx ] - result._offset[ idx ] ) / ( result._scale[ idx ] * 32767.f ), 32767 );
+            decoded[ idx ] = (float)q[ idx ] * result._scale[ idx ] + result._offset[ idx ];
+        }
+        dest->push_back( q );
+        maxError = osg::maximum< double >( maxError, ( decoded - *it ).length() );
+    }
+    result._array = dest;
+    return( result );
+}
+
+AttributeQuantizer::Quantized AttributeQuantizer::quantizeTexCoords( const osg::Vec2Array& source, double& maxError ) const
+{
+    osg::Vec2 minTC( source.front() ), maxTC( source.front() );
+    osg::Vec2Array::const_iterator it;
+    unsigned int idx;
+    for( it = source.begin(); it != source.end(); ++it )
+    {
+        for( idx=0; idx<2; ++idx )
+        {
+            minTC[ idx ] = osg::minimum( minTC[ idx ], (*it)[ idx ] );
+            maxTC[ idx ] = osg::maximum( maxTC[ idx ], (*it)[ idx ] );
+        }
+    }
+
+    // Same mapping as positions, in two dimensions; scale
+    // and offset z are unused.
+    Quantized result;
+    result._scale.set( 1.f, 1.f, 1.f );
+    result._offset.set( 0.f, 0.f, 0.f );
+    for( idx=0; idx<2; ++idx )
+    {
+        const float halfExtent( ( maxTC[ idx ] - minTC[ idx ] ) * .5f );
+        result._offset[ idx ] = ( maxTC[ idx ] + minTC[ idx ] ) * .5f;
+        result._scale[ idx ] = ( ( halfExtent > 0.f ) ? halfExtent : 1.f ) / 32767.f;
+    }
+
+    osg::Vec2sArray* dest( new osg::Vec2sArray );
+    dest->reserve( source.size() );
+    maxError = 0.;
+    for( it = source.begin(); it != source.end(); ++it )
+    {
+        osg::Vec2s q;
+        for( idx=0; idx<2; ++idx )
+        {
+            q[ idx ] = (short)quantizeValue( ( (*it)[ idx ] - result._offset[ idx ] ) / ( result._scale[ idx ] * 32767.f ), 32767 );
+            const float decoded( (float)q[ idx ] * result._scale[ idx ] + result._offset[ idx ] );
+            maxError = osg::maximum< double >( maxError, std::fabs( decoded - (*it)[ idx ] ) );
+        }
+        dest->push_back( q );
+    }
+    result._array = dest;
+    return( result );
+}
+
+AttributeQuantizer::Quantized AttributeQuantizer::quantizeNormals( const osg::Vec3Array& source, double& maxError ) const
+{
+    Quantized result;
+    result._scale.set( 1.f, 1.f, 1.f );
+    result._offset.set( 0.f, 0.f, 0.f );
+    maxError = 0.;
+
+    osg::Vec3Array::const_iterator it;
+    if( _normalMode == NORMAL_SNORM16 )
+    {
+        osg::Vec3sArray* dest( new osg::Vec3sArray );
+        dest->reserve( source.size() );
+        for( it = source.begin(); it != source.end(); ++it )
+        {
+            osg::Vec3 n( *it );
+            n.normalize();
+            const osg::Vec3s q( (short)quantizeValue( n.x(), 32767 ),
+                (short)quantizeValue( n.y(), 32767 ), (short)quantizeValue( n.z(), 32767 ) );
+            dest->push_back( q );
+            osg::Vec3 decoded( q.x(), q.y(), q.z() );
+            decoded.normalize();
+            maxError = osg::maximum( maxError, angleBetween( n, decoded ) );
+        }
+        dest->setNormalize( true );
+        result._array = dest;
+        return( result );
+    }
+
+    const int limit( ( _normalMode == NORMAL_OCT8 ) ? 127 : 32767 );
+    osg::ref_ptr< osg::Vec2sArray > dest16;
+    osg::ref_ptr< osg::Vec2bArray > dest8;
+    if( _normalMode == NORMAL_OCT8 )
+    {
+        dest8 = new osg::Vec2bArray;
+        dest8->reserve( source.size() );
+        result._array = dest8.get();
+    }
+    else
+    {
+        dest16 = new osg::Vec2sArray;
+        dest16->reserve( source.size() );
+        result._array = dest16.get();
+    }
+
+    for( it = source.begin(); it != source.end(); ++it )
+    {
+        osg::Vec3 n( *it );
+        n.normalize();
+        const osg::Vec2 e( octEncode( n ) );
+        const int qx( quantizeValue( e.x(), limit ) );
+        const int qy( quantizeValue( e.y(), limit ) );
+        if( dest8.valid() )
+            dest8->push_back( osg::Vec2b( (signed char)qx, (signed char)qy ) );
+        else
+            dest16->push_back( osg::Vec2s( (short)qx, (short)qy ) );
+
+        const osg::Vec3 decoded( octDecode( osg::Vec2( (float)qx / limit, (float)qy / limit ) ) );
+        maxError = osg::maximum( maxError, angleBetween( n, decoded ) );
+    }
+    result._array->setNormalize( true );
+    return( result );
+}
+
+
+osg::StateSet* AttributeQuantizer::getStateSet( osg::Geometry& geom, const Quantized* positions,
+    const Quantized* texCoords, bool octNormals )
+{
+    const StateSetKey key( geom.getStateSet(), positions, texCoords, octNormals );
+    osg::ref_ptr< osg::StateSet >& ss( _stateSets[ key ] );
+    if( ss.valid() )
+        return( ss.get() );
+
+    // Copy the original StateSet, so Geometries that don't
+    // share these arrays keep their own uniforms.
+    if( geom.getStateSet() != NULL )
+        ss = new osg::StateSet( *( geom.getStateSet() ), osg::CopyOp::SHALLOW_COPY );
+    else
+        ss = new osg::StateSet;
+
+    ss->setAttribute( octNormals ? _octProgram.get() : _program.get() );
+    ss->addUniform( new osg::Uniform( "meshopt_positionScale",
+        ( positions != NULL ) ? positions->_scale : osg::Vec3( 1.f, 1.f, 1.f ) ) );
+    ss->addUniform( new osg::Uniform( "meshopt_positionOffset",
+        ( positions != NULL ) ? positions->_offset : osg::Vec3( 0.f, 0.f, 0.f ) ) );
+    ss->addUniform( new osg::Uniform( "meshopt_texCoordScale",
+        ( texCoords != NULL ) ? osg::Vec2( texCoords->_scale.x(), texCoords->_scale.y() ) : osg::Vec2( 1.f, 1.f ) ) );
+    ss->addUniform( new osg::Uniform( "meshopt_texCoordOffset",
+        ( texCoords != NULL ) ? osg::Vec2( texCoords->_offset.x(), texCoords->_offset.y() ) : osg::Vec2( 0.f, 0.f ) ) );
+    return( ss.get() );
+}
@@ -0,0 +1,132 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __ATTRIBUTE_QUANTIZER_H__
+#define __ATTRIBUTE_QUANTIZER_H__ 1
+
+
+#include <osg/Geometry>
+#include <osg/Program>
+#include <osg/StateSet>
+#include <osg/ref_ptr>
+#include <OpenThreads/Mutex>
+
+#include <iostream>
+#include <vector>
+#include <map>
+
+
+
+/** AttributeQuantizer AttributeQuantizer.h
+\brief Replaces float vertex attributes with 16- and 8-bit integer arrays.
+\details
+\li Positions (Vec3Array) become Vec3sArray, relative to the array's bounding box.
+\li Texture unit 0 coordinates (Vec2Array) become Vec2sArray, relative to their range.
+\li Per-vertex normals (Vec3Array) become one of the NormalMode formats.
+
+Each Geometry gets a StateSet with a vertex shader that decodes the
+attributes. The shader's meshopt_positionScale/Offset and
+meshopt_texCoordScale/Offset uniforms carry the dequantization. It lights
+and transforms the decoded attributes with FixedFunctionLighting, so
+Geometries whose inherited state that can't reproduce are left alone.
+
+Use is two-phase. quantize() may be called for many Geometries concurrently;
+it only reads the Geometry. Arrays shared between Geometries are
+quantized once. apply() then installs the arrays and StateSets serially.
+Geometries sharing a StateSet and the same source arrays still share
+the replacement StateSet.
+
+Quantized positions keep their float bound as the initial bound, but
+intersection testing against them isn't supported.
+**/
+class AttributeQuantizer
+{
+public:
+    enum NormalMode {
+        NORMAL_FLOAT,   /**< Leave normals as they are. */
+        NORMAL_SNORM16, /**< 3x16-bit normalized, in the normal array. */
+        NORMAL_OCT16,   /**< 2x16-bit octahedral, in vertex attribute 6. */
+        NORMAL_OCT8     /**< 2x8-bit octahedral, in vertex attribute 6. */
+    };
+
+    AttributeQuantizer( NormalMode normalMode=NORMAL_OCT16,
+        bool positions=true, bool texCoords=true );
+    ~AttributeQuantizer();
+
+    /** Thread-safe. Reads, but doesn't modify, \c geom. */
+    void quantize( osg::Geometry& geom );
+    /** Not thread-safe; modifies the Geometries passed to quantize(). */
+    void apply();
+
+    /** Bytes saved and maximum error for each attribute. Position and
+    texture coordinate error are distances in object and texture
+    space; normal error is an angle in degrees. */
+    void dump( std::ostream& ostr ) const;
+
+    /** Generic vertex attribute holding octahedral normals. */
+    enum { OCT_NORMAL_ATTRIB = 6 };
+
+protected:
+    enum Attribute {
+        POSITION,
+        NORMAL,
+        TEXCOORD,
+        NUM_ATTRIBUTES
+    };
+
+    struct Quantized
+    {
+        osg::ref_ptr< osg::Array > _array;
+        osg::Vec3 _scale;
+        osg::Vec3 _offset;
+    };
+    typedef std::map< const osg::Array*, Quantized > QuantizedMap;
+
+    struct AttributeStats
+    {
+        AttributeStats();
+        unsigned int _arrays;
+        unsigned long long _bytesIn;
+        unsigned long long _bytesOut;
+        double _maxError;
+    };
+
+    const Quantized* find( Attribute attr, const osg::Array* source ) const;
+    void add( Attribute attr, const osg::Array* source, const Quantized& quantized, double maxError );
+
+    Quantized quantizePositions( const osg::Vec3Array& source, double& maxError ) const;
+    Quantized quantizeTexCoords( const osg::Vec2Array& source, double& maxError ) const;
+    Quantized quantizeNormals( const osg::Vec3Array& source, double& maxError ) const;
+
+    osg::StateSet* getStateSet( osg::Geometry& geom, const Quantized* positions,
+        const Quantized* texCoords, bool octNormals );
+
+    NormalMode _normalMode;
+    bool _positions;
+    bool _texCoords;
+
+    mutable OpenThreads::Mutex _mutex;
+    QuantizedMap _quantized[ NUM_ATTRIBUTES ];
+    AttributeStats _stats[ NUM_ATTRIBUTES ];
+    std::vector< osg::Geometry* > _geometries;
+    unsigned int _skipped;
+
+    osg::ref_ptr< osg::Program > _program;
+    osg::ref_ptr< osg::Program > _octProgram;
+
+    struct StateSetKey
+    {
+        StateSetKey( const osg::StateSet* ss, const Quantized* positions, const Quantized* texCoords, bool oct )
+          : _ss( ss ), _positions( positions ), _texCoords( texCoords ), _oct( oct ) {}
+        bool operator<( const StateSetKey& rhs ) const;
+
+        const osg::StateSet* _ss;
+        const Quantized* _positions;
+        const Quantized* _texCoords;
+        bool _oct;
+    };
+    std::map< StateSetKey, osg::ref_ptr< osg::StateSet > > _stateSets;
+};
+
+
+// __ATTRIBUTE_QUANTIZER_H__
+#endif
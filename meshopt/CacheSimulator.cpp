@@ -0,0 +1,158 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#include "CacheSimulator.h"
+#include <osg/TriangleIndexFunctor>
+
+#include <sstream>
+#include <algorithm>
+
+
+
+CacheStats::CacheStats()
+  : _triangles( 0 ),
+    _vertices( 0 )
+{
+}
+
+void CacheStats::add( const CacheStats& rhs )
+{
+    _triangles += rhs._triangles;
+    _vertices += rhs._vertices;
+    if( _misses.size() < rhs._misses.size() )
+        _misses.resize( rhs._misses.size(), 0 );
+    for( unsigned int idx=0; idx<rhs._misses.size(); ++idx )
+        _misses[ idx ] += rhs._misses[ idx ];
+}
+
+double CacheStats::acmr( unsigned int config ) const
+{
+    if( ( _triangles == 0 ) || ( config >= _misses.size() ) )
+        return( 0. );
+    return( (double)( _misses[ config ] ) / (double)_triangles );
+}
+double CacheStats::atvr( unsigned int config ) const
+{
+    if( ( _vertices == 0 ) || ( config >= _misses.size() ) )
+        return( 0. );
+    return( (double)( _misses[ config ] ) / (double)_vertices );
+}
+
+
+
+std::string CacheSimulator::Config::getName() const
+{
+    std::ostringstream ostr;
+    ostr << ( ( _policy == FIFO ) ? "FIFO" : "LRU" ) << _size;
+    return( ostr.str() );
+}
+
+
+CacheSimulator::CacheSimulator()
+{
+    const unsigned int sizes[] = { 8, 16, 24, 32 };
+    for( unsigned int idx=0; idx<4; ++idx )
+        addConfig( FIFO, sizes[ idx ] );
+    for( unsigned int idx=0; idx<4; ++idx )
+        addConfig( LRU, sizes[ idx ] );
+}
+CacheSimulator::~CacheSimulator()
+{
+}
+
+void CacheSimulator::clearConfigs()
+{
+    _configs.clear();
+}
+void CacheSimulator::addConfig( Policy policy, unsigned int size )
+{
+    _configs.push_back( Config( policy, osg::maximum< unsigned int >( size, 1 ) ) );
+}
+const CacheSimulator::ConfigList& CacheSimulator::getConfigs() const
+{
+    return( _configs );
+}
+
+
+struct CollectTriangleIndices
+{
+    void operator()( unsigned int p1, unsigned int p2, unsigned int p3 )
+    {
+        _indices.push_back( p1 );
+        _indices.push_back( p2 );
+        _indices.push_back( p3 );
+    }
+    std::vector< unsigned int > _indices;
+};
+
+CacheStats CacheSimulator::simulate( const osg::Geometry& geom ) const
+{
+    osg::TriangleIndexFunctor< CollectTriangleIndices > collect;
+    geom.accept( collect );
+    const std::vector< unsigned int >& indices( collect._indices );
+
+    unsigned int numVerts( 0 );
+    if( geom.getVertexArray() != NULL )
+        numVerts = geom.getVertexArray()->getNumElements();
+    std::vector< unsigned int >::const_iterator it;
+    for( it = indices.begin(); it != indices.end(); ++it )
+        numVerts = osg::maximum( numVerts, *it + 1 );
+
+    CacheStats stats;
+    stats._triangles = indices.size() / 3;
+    stats._vertices = numVerts;
+    ConfigList::const_iterator cit;
+    for( cit = _configs.begin(); cit != _configs.end(); ++cit )
+    {
+        if( cit->_policy == FIFO )
+            stats._misses.push_back( simulateFIFO( indices, numVerts, cit->_size ) );
+        else
+            stats._misses.push_back( simulateLRU( indices, cit->_size ) );
+    }
+    return( stats );
+}
+
+unsigned int CacheSimulator::simulateFIFO( const std::vector< unsigned int >& indices,
+        unsigned int numVerts, unsigned int size ) const
+{
+    // A vertex is in the FIFO if fewer than size vertices
+    // entered the cache after it did.
+    std::vector< unsigned int > entered( numVerts, 0 );
+    unsigned int time( 0 );
+    unsigned int misses( 0 );
+    std::vector< unsigned int >::const_iterator it;
+    for( it = indices.begin(); it != indices.end(); ++it )
+    {
+        unsigned int& stamp( entered[ *it ] );
+        if( ( stamp == 0 ) || ( time - stamp >= size ) )
+        {
+            ++misses;
+            stamp = ++time;
+        }
+    }
+    return( misses );
+}
+
+unsigned int CacheSimulator::simulateLRU( const std::vector< unsigned int >& indices,
+        unsigned int size ) const
+{
+    // Most recently used entry first. Caches are small, so
+    // a linear search beats anything cleverer.
+    std::vector< unsigned int > cache;
+    cache.reserve( size + 1 );
+    unsigned int misses( 0 );
+    std::vector< unsigned int >::const_iterator it;
+    for( it = indices.begin(); it != indices.end(); ++it )
+    {
+        std::vector< unsigned int >::iterator hit( std::find( cache.begin(), cache.end(), *it ) );
+        if( hit == cache.end() )
+        {
+            ++misses;
+            cache.insert( cache.begin(), *it );
+            if( cache.size() > size )
+                cache.pop_back();
+        }
+        else
+            std::rotate( cache.begin(), hit, hit+1 );
+    }
+    return( misses );
+}
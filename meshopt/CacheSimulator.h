@@ -0,0 +1,79 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __CACHE_SIMULATOR_H__
+#define __CACHE_SIMULATOR_H__ 1
+
+
+#include <osg/Geometry>
+
+#include <vector>
+#include <string>
+
+
+
+/** \brief Vertex cache statistics for one or more Geometries.
+\details Holds one miss count per CacheSimulator configuration.
+ACMR (average cache miss ratio) is misses per triangle; the
+ideal for a large mesh approaches 0.5. ATVR (average transform to
+vertex ratio) is misses per vertex; the ideal is 1.0. */
+struct CacheStats
+{
+    CacheStats();
+
+    void add( const CacheStats& rhs );
+
+    double acmr( unsigned int config ) const;
+    double atvr( unsigned int config ) const;
+
+    unsigned int _triangles;
+    unsigned int _vertices;
+    std::vector< unsigned int > _misses;
+};
+
+
+/** CacheSimulator CacheSimulator.h
+\brief Post-transform vertex cache simulation.
+\details Replays the triangles of a Geometry (any triangle-based
+primitive set, indexed or not) through simulated FIFO and LRU vertex
+caches and counts the misses. The default configurations are FIFO and
+LRU caches of 8, 16, 24 and 32 entries.
+**/
+class CacheSimulator
+{
+public:
+    CacheSimulator();
+    ~CacheSimulator();
+
+    enum Policy {
+        FIFO,
+        LRU
+    };
+    struct Config
+    {
+        Config( Policy policy, unsigned int size )
+          : _policy( policy ), _size( size ) {}
+        std::string getName() const;
+
+        Policy _policy;
+        unsigned int _size;
+    };
+    typedef std::vector< Config > ConfigList;
+
+    void clearConfigs();
+    void addConfig( Policy policy, unsigned int size );
+    const ConfigList& getConfigs() const;
+
+    CacheStats simulate( const osg::Geometry& geom ) const;
+
+protected:
+    unsigned int simulateFIFO( const std::vector< unsigned int >& indices,
+        unsigned int numVerts, unsigned int size ) const;
+    unsigned int simulateLRU( const std::vector< unsigned int >& indices,
+        unsigned int size ) const;
+
+    ConfigList _configs;
+};
+
+
+// __CACHE_SIMULATOR_H__
+#endif
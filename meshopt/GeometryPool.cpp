@@ -0,0 +1,215 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#include "GeometryPool.h"
+#include <osg/NodeVisitor>
+#include <osg/Geode>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+
+#include <map>
+#include <set>
+
+
+
+struct CollectGeometries : public osg::NodeVisitor
+{
+    CollectGeometries( GeometryPool::GeometryList& geometries )
+      : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ),
+        _geometries( geometries )
+    {}
+
+    virtual void apply( osg::Geode& geode )
+    {
+        for( unsigned int idx=0; idx<geode.getNumDrawables(); ++idx )
+        {
+            osg::Geometry* geom( geode.getDrawable( idx )->asGeometry() );
+            if( ( geom != NULL ) && _unique.insert( geom ).second )
+                _geometries.push_back( geom );
+        }
+        traverse( geode );
+    }
+
+    GeometryPool::GeometryList& _geometries;
+    std::set< osg::Geometry* > _unique;
+};
+
+// Union-find over Geometry indices. Geometries that reference the same
+// array or PrimitiveSet end up with the same root.
+class SharedDataGroups
+{
+public:
+    SharedDataGroups( unsigned int size )
+      : _parent( size )
+    {
+        for( unsigned int idx=0; idx<size; ++idx )
+            _parent[ idx ] = idx;
+    }
+
+    void add( unsigned int idx, const osg::Object* data )
+    {
+        if( data == NULL )
+            return;
+        std::map< const osg::Object*, unsigned int >::const_iterator it( _owner.find( data ) );
+        if( it == _owner.end() )
+            _owner[ data ] = idx;
+        else
+            _parent[ find( idx ) ] = find( it->second );
+    }
+    // The operations only rewrite arrays with one element per vertex or
+    // primitive. Overall arrays, such as one color shared by a whole
+    // model, are left alone and mustn't serialize the pool.
+    void add( unsigned int idx, const osg::Object* data, const osg::Geometry::AttributeBinding binding )
+    {
+        if( ( binding != osg::Geometry::BIND_OFF ) && ( binding != osg::Geometry::BIND_OVERALL ) )
+            add( idx, data );
+    }
+
+    unsigned int find( unsigned int idx )
+    {
+        while( _parent[ idx ] != idx )
+        {
+            _parent[ idx ] = _parent[ _parent[ idx ] ];
+            idx = _parent[ idx ];
+        }
+        return( idx );
+    }
+
+protected:
+    std::vector< unsigned int > _parent;
+    std::map< const osg::Object*, unsigned int > _owner;
+};
+
+class GeometryPoolThread : public OpenThreads::Thread
+{
+public:
+    GeometryPoolThread( const GeometryPool::GeometryList& geometries,
+            const GeometryPool::GroupList& groups,
+            GeometryPool::Operation& op, OpenThreads::Atomic& next )
+      : _geometries( geometries ),
+        _groups( groups ),
+        _op( op ),
+        _next( next )
+    {}
+
+    virtual void run()
+    {
+        unsigned int idx;
+        while( ( idx = ( ++_next ) - 1 ) < _groups.size() )
+        {
+            const std::vector< unsigned int >& group( _groups[ idx ] );
+            std::vector< unsigned int >::const_iterator it;
+            for( it = group.begin(); it != group.end(); ++it )
+                _op( *( _geometries[ *it ] ) );
+        }
+    }
+
+protected:
+    const GeometryPool::GeometryList& _geometries;
+    const GeometryPool::GroupList& _groups;
+    GeometryPool::Operation& _op;
+    OpenThreads::Atomic& _next;
+};
+
+
+
+GeometryPool::GeometryPool( unsigned int numThreads )
+  : _numThreads( numThreads )
+{
+    if( _numThreads == 0 )
+        _numThreads = OpenThreads::GetNumberOfProcessors();
+    if( _numThreads == 0 )
+        _numThreads = 1;
+}
+GeometryPool::~GeometryPool()
+{
+}
+
+void GeometryPool::collect( osg::Node& root )
+{
+    _geometries.clear();
+    _groups.clear();
+    CollectGeometries cg( _geometries );
+    root.accept( cg );
+
+    // Operations rewrite per-vertex arrays and PrimitiveSets in place,
+    // so Geometries sharing any of them must run on the same thread.
+    SharedDataGroups sdg( _geometries.size() );
+    unsigned int idx;
+    for( idx=0; idx<_geometries.size(); ++idx )
+    {
+        const osg::Geometry* geom( _geometries[ idx ].get() );
+        sdg.add( idx, geom->getVertexArray() );
+        sdg.add( idx, geom->getNormalArray(), geom->getNormalBinding() );
+        sdg.add( idx, geom->getColorArray(), geom->getColorBinding() );
+        sdg.add( idx, geom->getSecondaryColorArray(), geom->getSecondaryColorBinding() );
+        sdg.add( idx, geom->getFogCoordArray(), geom->getFogCoordBinding() );
+        unsigned int jdx;
+        for( jdx=0; jdx<geom->getNumTexCoordArrays(); ++jdx )
+            sdg.add( idx, geom->getTexCoordArray( jdx ) );
+        for( jdx=0; jdx<geom->getNumVertexAttribArrays(); ++jdx )
+            sdg.add( idx, geom->getVertexAttribArray( jdx ), geom->getVertexAttribBinding( jdx ) );
+        for( jdx=0; jdx<geom->getNumPrimitiveSets(); ++jdx )
+            sdg.add( idx, geom->getPrimitiveSet( jdx ) );
+    }
+
+    std::map< unsigned int, unsigned int > rootToGroup;
+    for( idx=0; idx<_geometries.size(); ++idx )
+    {
+        const unsigned int root( sdg.find( idx ) );
+        std::map< unsigned int, unsigned int >::const_iterator it( rootToGroup.find( root ) );
+        if( it == rootToGroup.end() )
+        {
+            rootToGroup[ root ] = _groups.size();
+            _groups.push_back( std::vector< unsigned int >( 1, idx ) );
+        }
+        else
+            _groups[ it->second ].push_back( idx );
+    }
+}
+const GeometryPool::GeometryList& GeometryPool::getGeometries() const
+{
+    return( _geometries );
+}
+
+unsigned int GeometryPool::getNumThreads() const
+{
+    return( _numThreads );
+}
+
+const GeometryPool::GroupList& GeometryPool::getGroups() const
+{
+    return( _groups );
+}
+
+double GeometryPool::run( Operation& op )
+{
+    osg::Timer timer;
+    const osg::Timer_t start( timer.tick() );
+
+    const unsigned int numThreads( osg::minimum< unsigned int >( _numThreads, _groups.size() ) );
+    if( numThreads <= 1 )
+    {
+        GeometryList::const_iterator it;
+        for( it = _geometries.begin(); it != _geometries.end(); ++it )
+            op( *( it->get() ) );
+    }
+    else
+    {
+        OpenThreads::Atomic next;
+        std::vector< GeometryPoolThread* > threads;
+        unsigned int idx;
+        for( idx=0; idx<numThreads; ++idx )
+        {
+            threads.push_back( new GeometryPoolThread( _geometries, _groups, op, next ) );
+            threads.back()->start();
+        }
+        for( idx=0; idx<numThreads; ++idx )
+        {
+            threads[ idx ]->join();
+            delete threads[ idx ];
+        }
+    }
+
+    return( timer.delta_m( start, timer.tick() ) );
+}
@@ -0,0 +1,73 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __GEOMETRY_POOL_H__
+#define __GEOMETRY_POOL_H__ 1
+
+
+#include <osg/Node>
+#include <osg/Geometry>
+#include <osg/ref_ptr>
+
+#include <vector>
+
+
+
+/** GeometryPool GeometryPool.h
+\brief Runs a per-Geometry operation over a scene graph on a pool of threads.
+\details collect() gathers the unique Geometries in a scene graph once,
+and partitions them into groups: Geometries that share a vertex attribute
+array or a PrimitiveSet, directly or through other Geometries, are in the
+same group. run() then applies an Operation to each Geometry, with worker
+threads claiming whole groups from a shared atomic cursor until all are
+done. A group is processed serially by one thread, so an Operation may
+modify a Geometry's per-vertex and per-primitive arrays and PrimitiveSets
+in place. Arrays bound BIND_OVERALL or BIND_OFF don't group Geometries, so
+an Operation must leave them alone. It only needs to be thread-safe with
+respect to shared state of its own, such as results accumulated across
+Geometries.
+**/
+class GeometryPool
+{
+public:
+    /** \param numThreads Number of worker threads. 0 uses one
+    thread per processor. */
+    GeometryPool( unsigned int numThreads=0 );
+    ~GeometryPool();
+
+    typedef std::vector< osg::ref_ptr< osg::Geometry > > GeometryList;
+
+    /** Gather the unique Geometries in \c root, replacing any
+    previously collected Geometries, and group them by shared data. */
+    void collect( osg::Node& root );
+    const GeometryList& getGeometries() const;
+
+    unsigned int getNumThreads() const;
+
+    /** Each group lists indices into getGeometries(). */
+    typedef std::vector< std::vector< unsigned int > > GroupList;
+    const GroupList& getGroups() const;
+
+    /** \brief Per-Geometry operation executed by run(). */
+    struct Operation
+    {
+        Operation() {}
+        virtual ~Operation() {}
+
+        /** Called concurrently on different threads, for Geometries
+        that share no arrays or PrimitiveSets. */
+        virtual void operator()( osg::Geometry& geom ) = 0;
+    };
+
+    /** Apply \c op to every collected Geometry.
+    \return Wall-clock time in milliseconds. */
+    double run( Operation& op );
+
+protected:
+    unsigned int _numThreads;
+    GeometryList _geometries;
+    GroupList _groups;
+};
+
+
+// __GEOMETRY_POOL_H__
+#endif
@@ -0,0 +1,234 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#include "HausdorffDistance.h"
+#include <osg/TriangleIndexFunctor>
+#include <osg/BoundingBox>
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <cstdlib>
+
+
+
+namespace
+{
+
+struct CollectHausdorffTriangles
+{
+    void operator()( unsigned int p1, unsigned int p2, unsigned int p3 )
+    {
+        _indices.push_back( p1 );
+        _indices.push_back( p2 );
+        _indices.push_back( p3 );
+    }
+    std::vector< unsigned int > _indices;
+};
+
+// Squared distance from p to triangle (a, b, c). From Ericson,
+// "Real-Time Collision Detection", 5.1.5.
+float distance2( const osg::Vec3& p, const osg::Vec3& a, const osg::Vec3& b, const osg::Vec3& c )
+{
+    const osg::Vec3 ab( b - a ), ac( c - a ), ap( p - a );
+    const float d1( ab * ap ), d2( ac * ap );
+    if( ( d1 <= 0.f ) && ( d2 <= 0.f ) )
+        return( ap.length2() );
+
+    const osg::Vec3 bp( p - b );
+    const float d3( ab * bp ), d4( ac * bp );
+    if( ( d3 >= 0.f ) && ( d4 <= d3 ) )
+        return( bp.length2() );
+
+    const float vc( d1 * d4 - d3 * d2 );
+    if( ( vc <= 0.f ) && ( d1 >= 0.f ) && ( d3 <= 0.f ) )
+        return( ( a + ab * ( d1 / ( d1 - d3 ) ) - p ).length2() );
+
+    const osg::Vec3 cp( p - c );
+    const float d5( ab * cp ), d6( ac * cp );
+    if( ( d6 >= 0.f ) && ( d5 <= d6 ) )
+        return( cp.length2() );
+
+    const float vb( d5 * d2 - d1 * d6 );
+    if( ( vb <= 0.f ) && ( d2 >= 0.f ) && ( d6 <= 0.f ) )
+        return( ( a + ac * ( d2 / ( d2 - d6 ) ) - p ).length2() );
+
+    const float va( d3 * d6 - d5 * d4 );
+    if( ( va <= 0.f ) && ( ( d4 - d3 ) >= 0.f ) && ( ( d5 - d6 ) >= 0.f ) )
+        return( ( b + ( c - b ) * ( ( d4 - d3 ) / ( ( d4 - d3 ) + ( d5 - d6 ) ) ) - p ).length2() );
+
+    const float denom( va + vb + vc );
+    if( denom == 0.f )
+        return( ap.length2() );
+    const float v( vb / denom ), w( vc / denom );
+    return( ( a + ab * v + ac * w - p ).length2() );
+}
+
+
+/** Triangles binned into a uniform grid for nearest-triangle queries. */
+class TriangleGrid
+{
+public:
+    TriangleGrid( const osg::Vec3Array& verts, const std::vector< unsigned int >& indices );
+
+    /** Distance from p to the nearest triangle. */
+    float distance( const osg::Vec3& p ) const;
+
+protected:
+    int cellCoord( float value, unsigned int axis ) const;
+    void search( const int* center, int ring, const osg::Vec3& p, float& best2 ) const;
+
+    const osg::Vec3Array& _verts;
+    const std::vector< unsigned int >& _indices;
+    osg::BoundingBox _bb;
+    float _cellSize;
+    int _dims[ 3 ];
+    std::vector< std::vector< unsigned int > > _cells;
+};
+
+TriangleGrid::TriangleGrid( const osg::Vec3Array& verts, const std::vector< unsigned int >& indices )
+  : _verts( verts ),
+    _indices( indices )
+{
+    const unsigned int numTris( indices.size() / 3 );
+    unsigned int idx;
+    for( idx=0; idx<indices.size(); ++idx )
+        _bb.expandBy( verts[ indices[ idx ] ] );
+
+    // About one triangle per cell.
+    float maxExtent( 0.f );
+    for( idx=0; idx<3; ++idx )
+        maxExtent = osg::maximum( maxExtent, _bb._max[ idx ] - _bb._min[ idx ] );
+    const float cellsPerAxis( osg::clampBetween< float >( std::pow( (float)numTris, 1.f/3.f ), 1.f, 128.f ) );
+    _cellSize = osg::maximum( maxExtent / cellsPerAxis, FLT_MIN );
+    for( idx=0; idx<3; ++idx )
+        _dims[ idx ] = osg::clampBetween< int >( (int)std::ceil( ( _bb._max[ idx ] - _bb._min[ idx ] ) / _cellSize ), 1, 128 );
+    _cells.resize( _dims[ 0 ] * _dims[ 1 ] * _dims[ 2 ] );
+
+    for( unsigned int tri=0; tri<numTris; ++tri )
+    {
+        osg::BoundingBox tbb;
+        for( unsigned int k=0; k<3; ++k )
+            tbb.expandBy( verts[ indices[ tri*3+k ] ] );
+        int lo[ 3 ], hi[ 3 ];
+        for( idx=0; idx<3; ++idx )
+        {
+            lo[ idx ] = cellCoord( tbb._min[ idx ], idx );
+            hi[ idx ] = cellCoord( tbb._max[ idx ], idx );
+        }
+        for( int z=lo[ 2 ]; z<=hi[ 2 ]; ++z )
+            for( int y=lo[ 1 ]; y<=hi[ 1 ]; ++y )
+                for( int x=lo[ 0 ]; x<=hi[ 0 ]; ++x )
+                    _cells[ ( z * _dims[ 1 ] + y ) * _dims[ 0 ] + x ].push_back( tri );
+    }
+}
+
+int TriangleGrid::cellCoord( float value, unsigned int axis ) const
+{
+    return( osg::clampBetween< int >( (int)std::floor( ( value - _bb._min[ axis ] ) / _cellSize ),
+        0, _dims[ axis ] - 1 ) );
+}
+
+float TriangleGrid::distance( const osg::Vec3& p ) const
+{
+    int center[ 3 ];
+    for( unsigned int idx=0; idx<3; ++idx )
+        center[ idx ] = cellCoord( p[ idx ], idx );
+    const int maxRing( osg::maximum( _dims[ 0 ], osg::maximum( _dims[ 1 ], _dims[ 2 ] ) ) );
+
+    // Anything outside ring r is at least r cells away.
+    float best2( FLT_MAX );
+    for( int ring=0; ring<=maxRing; ++ring )
+    {
+        search( center, ring, p, best2 );
+        const float reach( ring * _cellSize );
+        if( best2 <= reach * reach )
+            break;
+    }
+    return( std::sqrt( best2 ) );
+}
+
+void TriangleGrid::search( const int* center, int ring, const osg::Vec3& p, float& best2 ) const
+{
+    for( int z=center[ 2 ]-ring; z<=center[ 2 ]+ring; ++z )
+    {
+        if( ( z < 0 ) || ( z >= _dims[ 2 ] ) )
+            continue;
+        for( int y=center[ 1 ]-ring; y<=center[ 1 ]+ring; ++y )
+        {
+            if( ( y < 0 ) || ( y >= _dims[ 1 ] ) )
+                continue;
+            for( int x=center[ 0 ]-ring; x<=center[ 0 ]+ring; ++x )
+            {
+                if( ( x < 0 ) || ( x >= _dims[ 0 ] ) )
+                    continue;
+                // Only the shell of the ring; the inside was already searched.
+                if( ( std::abs( x - center[ 0 ] ) != ring ) && ( std::abs( y - center[ 1 ] ) != ring ) &&
+                    ( std::abs( z - center[ 2 ] ) != ring ) )
+                    continue;
+
+                const std::vector< unsigned int >& cell( _cells[ ( z * _dims[ 1 ] + y ) * _dims[ 0 ] + x ] );
+                std::vector< unsigned int >::const_iterator it;
+                for( it = cell.begin(); it != cell.end(); ++it )
+                {
+                    const unsigned int* tri( &_indices[ *it * 3 ] );
+                    best2 = osg::minimum( best2, distance2( p,
+                        _verts[ tri[ 0 ] ], _verts[ tri[ 1 ] ], _verts[ tri[ 2 ] ] ) );
+                }
+            }
+        }
+    }
+}
+
+bool collectTriangles( const osg::Geometry& geom, std::vector< unsigned int >& indices )
+{
+    const osg::Vec3Array* verts( dynamic_cast< const osg::Vec3Array* >( geom.getVertexArray() ) );
+    if( verts == NULL )
+        return( false );
+    osg::TriangleIndexFunctor< CollectHausdorffTriangles > collect;
+    geom.accept( collect );
+    indices.clear();
+    for( unsigned int idx=0; idx+2<collect._indices.size(); idx+=3 )
+    {
+        if( ( collect._indices[ idx ] < verts->size() ) &&
+            ( collect._indices[ idx+1 ] < verts->size() ) &&
+            ( collect._indices[ idx+2 ] < verts->size() ) )
+            indices.insert( indices.end(), &collect._indices[ idx ], &collect._indices[ idx ] + 3 );
+    }
+    return( !indices.empty() );
+}
+
+// Largest distance from the samples of one surface to the other.
+double oneSided( const osg::Vec3Array& fromVerts, const std::vector< unsigned int >& fromIndices,
+    const TriangleGrid& to )
+{
+    double result( 0. );
+    for( unsigned int idx=0; idx<fromIndices.size(); idx+=3 )
+    {
+        const osg::Vec3& p0( fromVerts[ fromIndices[ idx ] ] );
+        const osg::Vec3& p1( fromVerts[ fromIndices[ idx+1 ] ] );
+        const osg::Vec3& p2( fromVerts[ fromIndices[ idx+2 ] ] );
+        result = osg::maximum< double >( result, to.distance( p0 ) );
+        result = osg::maximum< double >( result, to.distance( p1 ) );
+        result = osg::maximum< double >( result, to.distance( p2 ) );
+        result = osg::maximum< double >( result, to.distance( ( p0 + p1 + p2 ) / 3.f ) );
+    }
+    return( result );
+}
+
+}
+
+
+
+double hausdorffDistance( const osg::Geometry& a, const osg::Geometry& b )
+{
+    std::vector< unsigned int > aIndices, bIndices;
+    if( !collectTriangles( a, aIndices ) || !collectTriangles( b, bIndices ) )
+        return( 0. );
+    const osg::Vec3Array& aVerts( *static_cast< const osg::Vec3Array* >( a.getVertexArray() ) );
+    const osg::Vec3Array& bVerts( *static_cast< const osg::Vec3Array* >( b.getVertexArray() ) );
+
+    const TriangleGrid aGrid( aVerts, aIndices );
+    const TriangleGrid bGrid( bVerts, bIndices );
+    return( osg::maximum( oneSided( aVerts, aIndices, bGrid ),
+        oneSided( bVerts, bIndices, aGrid ) ) );
+}
@@ -0,0 +1,20 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __HAUSDORFF_DISTANCE_H__
+#define __HAUSDORFF_DISTANCE_H__ 1
+
+
+#include <osg/Geometry>
+
+
+
+/** \brief Approximate symmetric Hausdorff distance between the triangle surfaces of two Geometries.
+\details Samples each surface at its triangle vertices and centroids, and
+takes the largest distance from a sample to the nearest triangle of the
+other surface. Nearest triangles are found with a uniform grid. Both
+Geometries must have Vec3Array vertex arrays; returns 0 otherwise. */
+double hausdorffDistance( const osg::Geometry& a, const osg::Geometry& b );
+
+
+// __HAUSDORFF_DISTANCE_H__
+#endif
@@ -0,0 +1,325 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#include "MeshletBuilder.h"
+#include "InheritedState.h"
+#include <osg/TriangleIndexFunctor>
+#include <osg/NodeVisitor>
+#include <osg/Geode>
+#include <osg/CullFace>
+#include <osg/FrontFace>
+#include <osg/ValueObject>
+
+#include <cmath>
+
+
+
+namespace
+{
+
+struct CollectMeshletTriangles
+{
+    void operator()( unsigned int p1, unsigned int p2, unsigned int p3 )
+    {
+        _indices.push_back( p1 );
+        _indices.push_back( p2 );
+        _indices.push_back( p3 );
+    }
+    std::vector< unsigned int > _indices;
+};
+
+struct MeshletBoundCallback : public osg::Drawable::ComputeBoundingBoxCallback
+{
+    MeshletBoundCallback( const osg::BoundingBox& bb )
+      : _bb( bb )
+    {}
+    virtual osg::BoundingBox computeBound( const osg::Drawable& ) const
+    {
+        return( _bb );
+    }
+
+    osg::BoundingBox _bb;
+};
+
+bool isTriangleMode( GLenum mode )
+{
+    return( ( mode == osg::PrimitiveSet::TRIANGLES ) ||
+        ( mode == osg::PrimitiveSet::TRIANGLE_STRIP ) ||
+        ( mode == osg::PrimitiveSet::TRIANGLE_FAN ) ||
+        ( mode == osg::PrimitiveSet::QUADS ) ||
+        ( mode == osg::PrimitiveSet::QUAD_STRIP ) ||
+        ( mode == osg::PrimitiveSet::POLYGON ) );
+}
+
+bool isPerPrimitive( osg::Geometry::AttributeBinding binding )
+{
+    return( ( binding == osg::Geometry::BIND_PER_PRIMITIVE_SET ) ||
+        ( binding == osg::Geometry::BIND_PER_PRIMITIVE ) );
+}
+
+// The normal cone test culls meshlets whose CCW faces all point away
+// from the eye. That's only invisible if GL would cull those faces
+// anyway, on every path to the Geometry.
+bool cullsBackFaces( const osg::Geometry& geom )
+{
+    std::vector< InheritedState > states;
+    InheritedState::getPathStates( geom, states );
+    std::vector< InheritedState >::const_iterator it;
+    for( it = states.begin(); it != states.end(); ++it )
+    {
+        if( !it->isOn( GL_CULL_FACE ) )
+            return( false );
+        const osg::CullFace* cullFace( dynamic_cast< const osg::CullFace* >(
+            it->getAttribute( osg::StateAttribute::CULLFACE ) ) );
+        const osg::FrontFace* frontFace( dynamic_cast< const osg::FrontFace* >(
+            it->getAttribute( osg::StateAttribute::FRONTFACE ) ) );
+        const osg::CullFace::Mode mode( ( cullFace != NULL ) ? cullFace->getMode() : osg::CullFace::BACK );
+        const bool ccw( ( frontFace == NULL ) || ( frontFace->getMode() == osg::FrontFace::COUNTER_CLOCKWISE ) );
+        if( ( mode == osg::CullFace::FRONT_AND_BACK ) || ( ( mode == osg::CullFace::BACK ) != ccw ) )
+            return( false );
+    }
+    return( true );
+}
+
+}
+
+
+
+MeshletBuilder::MeshletBuilder( unsigned int maxVertices, unsigned int maxTriangles )
+  : _maxVertices( osg::maximum< unsigned int >( maxVertices, 3 ) ),
+    _maxTriangles( osg::maximum< unsigned int >( maxTriangles, 1 ) )
+{
+}
+MeshletBuilder::~MeshletBuilder()
+{
+}
+
+bool MeshletBuilder::build( const osg::Geometry& geom, GeometryList& meshlets ) const
+{
+    const osg::Vec3Array* verts( dynamic_cast< const osg::Vec3Array* >( geom.getVertexArray() ) );
+    if( ( verts == NULL ) || isPerPrimitive( geom.getNormalBinding() ) ||
+        isPerPrimitive( geom.getColorBinding() ) )
+        return( false );
+
+    osg::TriangleIndexFunctor< CollectMeshletTriangles > collect;
+    geom.accept( collect );
+    const IndexList& indices( collect._indices );
+    const unsigned int numTris( indices.size() / 3 );
+    unsigned int idx;
+    for( idx=0; idx<numTris*3; ++idx )
+    {
+        if( indices[ idx ] >= verts->size() )
+            return( false );
+    }
+
+    bool hasOtherPrimitives( false );
+    for( idx=0; idx<geom.getNumPrimitiveSets(); ++idx )
+    {
+        if( !isTriangleMode( geom.getPrimitiveSet( idx )->getMode() ) )
+            hasOtherPrimitives = true;
+    }
+    if( ( numTris == 0 ) || ( ( numTris <= _maxTriangles ) && !hasOtherPrimitives ) )
+        return( false );
+
+    const bool coneCull( cullsBackFaces( geom ) );
+    GeometryList result;
+
+    // owner[v] is the index of the last meshlet that referenced vertex v.
+    const unsigned int none( ~0u );
+    std::vector< unsigned int > owner( verts->size(), none );
+    unsigned int current( 0 );
+    unsigned int currentVerts( 0 );
+    IndexList currentIndices;
+    for( unsigned int tri=0; tri<numTris; ++tri )
+    {
+        const unsigned int* v( &indices[ tri*3 ] );
+        unsigned int added( 0 );
+        for( unsigned int k=0; k<3; ++k )
+        {
+            if( ( owner[ v[ k ] ] != current ) &&
+                ( ( k < 1 ) || ( v[ k ] != v[ 0 ] ) ) &&
+                ( ( k < 2 ) || ( v[ k ] != v[ 1 ] ) ) )
+                ++added;
+        }
+
+        if( ( currentVerts + added > _maxVertices ) ||
+            ( currentIndices.size() / 3 >= _maxTriangles ) )
+        {
+            result.push_back( createMeshlet( geom, currentIndices, coneCull ) );
+            currentIndices.clear();
+            ++current;
+            currentVerts = 0;
+            // Every vertex is new to the next meshlet.
+            added = ( v[ 1 ] != v[ 0 ] ) ? 2 : 1;
+            if( ( v[ 2 ] != v[ 0 ] ) && ( v[ 2 ] != v[ 1 ] ) )
+                ++added;
+        }
+
+        for( unsigned int k=0; k<3; ++k )
+        {
+            owner[ v[ k ] ] = current;
+            currentIndices.push_back( v[ k ] );
+        }
+        currentVerts += added;
+    }
+    result.push_back( createMeshlet( geom, currentIndices, coneCull ) );
+
+    if( hasOtherPrimitives )
+    {
+        osg::Geometry* other( new osg::Geometry( geom,
+            osg::CopyOp( osg::CopyOp::DEEP_COPY_USERDATA ) ) );
+        for( idx=other->getNumPrimitiveSets(); idx>0; --idx )
+        {
+            if( isTriangleMode( other->getPrimitiveSet( idx-1 )->getMode() ) )
+                other->removePrimitiveSet( idx-1 );
+        }
+        result.push_back( other );
+    }
+
+    meshlets.insert( meshlets.end(), result.begin(), result.end() );
+    return( true );
+}
+
+osg::Geometry* MeshletBuilder::createMeshlet( const osg::Geometry& geom, const IndexList& indices, bool coneCull ) const
+{
+    const osg::Vec3Array& verts( *static_cast< const osg::Vec3Array* >( geom.getVertexArray() ) );
+
+    // Arrays and StateSet are shared with the source. User data
+    // is copied, so each meshlet can carry its own bounds.
+    osg::Geometry* meshlet( new osg::Geometry( geom,
+        osg::CopyOp( osg::CopyOp::DEEP_COPY_USERDATA ) ) );
+    meshlet->removePrimitiveSet( 0, meshlet->getNumPrimitiveSets() );
+
+    unsigned int maxIndex( 0 );
+    IndexList::const_iterator it;
+    for( it = indices.begin(); it != indices.end(); ++it )
+        maxIndex = osg::maximum( maxIndex, *it );
+    if( maxIndex < 0xffff )
+    {
+        osg::DrawElementsUShort* de( new osg::DrawElementsUShort( GL_TRIANGLES ) );
+        de->reserve( indices.size() );
+        for( it = indices.begin(); it != indices.end(); ++it )
+            de->push_back( (GLushort)( *it ) );
+        meshlet->addPrimitiveSet( de );
+    }
+    else
+    {
+        osg::DrawElementsUInt* de( new osg::DrawElementsUInt( GL_TRIANGLES ) );
+        de->reserve( indices.size() );
+        for( it = indices.begin(); it != indices.end(); ++it )
+            de->push_back( *it );
+        meshlet->addPrimitiveSet( de );
+    }
+
+    // Bounding box, and a bounding sphere around its center.
+    osg::BoundingBox bb;
+    for( it = indices.begin(); it != indices.end(); ++it )
+        bb.expandBy( verts[ *it ] );
+    float radius2( 0.f );
+    for( it = indices.begin(); it != indices.end(); ++it )
+        radius2 = osg::maximum( radius2, ( verts[ *it ] - bb.center() ).length2() );
+    const osg::BoundingSphere bound( bb.center(), std::sqrt( radius2 ) );
+
+    // Normal cone: the axis is the average unit face normal, and the
+    // cone is wide enough to contain every face normal. A cone of
+    // 90 degrees or more can never be back-facing, so its cutoff is
+    // set to 1 to disable the test. So is the cutoff of a meshlet
+    // whose back faces GL doesn't cull.
+    std::vector< osg::Vec3 > normals;
+    normals.reserve( indices.size() / 3 );
+    osg::Vec3 axis( 0., 0., 0. );
+    unsigned int idx;
+    for( idx=0; idx+2<indices.size(); idx+=3 )
+    {
+        const osg::Vec3& p0( verts[ indices[ idx ] ] );
+        osg::Vec3 n( ( verts[ indices[ idx+1 ] ] - p0 ) ^ ( verts[ indices[ idx+2 ] ] - p0 ) );
+        if( n.normalize() == 0.f )
+            continue;
+        normals.push_back( n );
+        axis += n;
+    }
+    float cutoff( 1.f );
+    if( ( axis.normalize() > 0.f ) && coneCull )
+    {
+        float minDot( 1.f );
+        std::vector< osg::Vec3 >::const_iterator nit;
+        for( nit = normals.begin(); nit != normals.end(); ++nit )
+            minDot = osg::minimum( minDot, *nit * axis );
+        if( minDot > 0.f )
+            cutoff = std::sqrt( 1.f - minDot * minDot );
+    }
+
+    meshlet->setUserValue( "MeshletBound", osg::Vec4( bound.center(), bound.radius() ) );
+    meshlet->setUserValue( "MeshletCone", osg::Vec4( axis, cutoff ) );
+    meshlet->setComputeBoundingBoxCallback( new MeshletBoundCallback( bb ) );
+    if( cutoff < 1.f )
+        meshlet->setCullCallback( new MeshletCullCallback( bound, axis, cutoff ) );
+    return( meshlet );
+}
+
+
+
+MeshletCullCallback::MeshletCullCallback( const osg::BoundingSphere& bound, const osg::Vec3& coneAxis, float coneCutoff )
+  : _bound( bound ),
+    _coneAxis( coneAxis ),
+    _coneCutoff( coneCutoff )
+{
+}
+
+bool MeshletCullCallback::cull( osg::NodeVisitor* nv, osg::Drawable*, osg::RenderInfo* ) const
+{
+    if( nv == NULL )
+        return( false );
+
+    // Cull if the eye is inside the cone's back side for every
+    // point of the bounding sphere. The eye point is in local coordinates.
+    const osg::Vec3 toCenter( _bound.center() - nv->getEyePoint() );
+    return( toCenter * _coneAxis >= _coneCutoff * toCenter.length() + _bound.radius() );
+}
+
+bool MeshletCullCallback::install( osg::Drawable& drawable )
+{
+    osg::Vec4 bound, cone;
+    if( !drawable.getUserValue( "MeshletBound", bound ) ||
+        !drawable.getUserValue( "MeshletCone", cone ) )
+        return( false );
+
+    const osg::BoundingSphere bs( osg::Vec3( bound.x(), bound.y(), bound.z() ), bound.w() );
+    osg::BoundingBox bb;
+    bb.expandBy( bs );
+    drawable.setComputeBoundingBoxCallback( new MeshletBoundCallback( bb ) );
+    if( cone.w() < 1.f )
+        drawable.setCullCallback( new MeshletCullCallback( bs,
+            osg::Vec3( cone.x(), cone.y(), cone.z() ), cone.w() ) );
+    return( true );
+}
+
+
+
+MeshletInstallVisitor::MeshletInstallVisitor()
+  : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ),
+    _installed( 0 )
+{
+}
+
+void MeshletInstallVisitor::apply( osg::Geode& node )
+{
+    for( unsigned int idx=0; idx<node.getNumDrawables(); ++idx )
+    {
+        if( MeshletCullCallback::install( *( node.getDrawable( idx ) ) ) )
+            ++_installed;
+    }
+    traverse( node );
+}
+
+
+osgDB::ReaderWriter::ReadResult MeshletReadFileCallback::readNode( const std::string& fileName,
+    const osgDB::ReaderWriter::Options* options )
+{
+    osgDB::ReaderWriter::ReadResult result( osgDB::Registry::ReadFileCallback::readNode( fileName, options ) );
+    if( result.validNode() )
+    {
+        MeshletInstallVisitor miv;
+        result.getNode()->accept( miv );
+    }
+    return( result );
+}
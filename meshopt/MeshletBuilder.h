@@ -0,0 +1,116 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __MESHLET_BUILDER_H__
+#define __MESHLET_BUILDER_H__ 1
+
+
+#include <osg/Geometry>
+#include <osg/Drawable>
+#include <osg/NodeVisitor>
+#include <osgDB/Registry>
+#include <osg/BoundingBox>
+#include <osg/BoundingSphere>
+#include <osg/ref_ptr>
+
+#include <vector>
+
+
+
+/** MeshletBuilder MeshletBuilder.h
+\brief Splits a Geometry into small clusters (meshlets) that can be culled individually.
+\details build() walks the triangles of a Geometry in draw order, so it should
+run after the vertex cache stages. It starts a new meshlet whenever the next
+triangle would exceed the vertex or triangle limit. Each meshlet becomes its
+own Geometry. It shares the source's arrays and StateSet and has one
+GL_TRIANGLES DrawElements. Non-triangle primitive sets (points, lines) are
+kept in one extra Geometry.
+
+Every meshlet stores its bounding sphere and normal cone as user values
+("MeshletBound" and "MeshletCone", both osg::Vec4). Only the
+serializer-based formats (.osgb, .osgt, .osgx) save them, and no format
+saves the callbacks, so a consumer must reinstall those at load time with
+MeshletInstallVisitor or MeshletReadFileCallback.
+
+The normal cone test only removes faces GL would cull anyway, so it's
+enabled only when GL_CULL_FACE is on and culls back faces, with CCW front
+faces, on every path to the source Geometry. Otherwise the cone cutoff is
+stored as 1, and the meshlet gets no MeshletCullCallback.
+**/
+class MeshletBuilder
+{
+public:
+    MeshletBuilder( unsigned int maxVertices=64, unsigned int maxTriangles=124 );
+    ~MeshletBuilder();
+
+    typedef std::vector< osg::ref_ptr< osg::Geometry > > GeometryList;
+
+    /** Appends the meshlet Geometries for \c geom to \c meshlets.
+    \return false, with \c meshlets unchanged, if \c geom has per-primitive
+    bindings or no Vec3Array vertex array, or would make only one meshlet. */
+    bool build( const osg::Geometry& geom, GeometryList& meshlets ) const;
+
+protected:
+    typedef std::vector< unsigned int > IndexList;
+
+    osg::Geometry* createMeshlet( const osg::Geometry& geom, const IndexList& indices, bool coneCull ) const;
+
+    unsigned int _maxVertices;
+    unsigned int _maxTriangles;
+};
+
+
+/** \brief Culls meshlets that are entirely back-facing.
+\details The normal cone test is only valid for single-sided, CCW-front
+geometry. Frustum culling needs no callback: the meshlet's bounding box is
+supplied by a ComputeBoundingBoxCallback, and the CullVisitor tests it as
+for any other Drawable. */
+class MeshletCullCallback : public osg::Drawable::CullCallback
+{
+public:
+    MeshletCullCallback( const osg::BoundingSphere& bound, const osg::Vec3& coneAxis, float coneCutoff );
+
+    virtual bool cull( osg::NodeVisitor* nv, osg::Drawable* drawable, osg::RenderInfo* renderInfo ) const;
+
+    /** Attaches the bounding box callback, and the cull callback unless
+    the cone test is disabled, to a Drawable that has MeshletBound and
+    MeshletCone user values, such as a meshlet loaded from file.
+    \return false if the values are absent. */
+    static bool install( osg::Drawable& drawable );
+
+protected:
+    osg::BoundingSphere _bound;
+    osg::Vec3 _coneAxis;
+    float _coneCutoff;
+};
+
+
+/** \brief Calls MeshletCullCallback::install() for every Drawable in a scene graph. */
+class MeshletInstallVisitor : public osg::NodeVisitor
+{
+public:
+    MeshletInstallVisitor();
+
+    virtual void apply( osg::Geode& node );
+
+    /** Number of Drawables with meshlet user values. */
+    unsigned int getNumInstalled() const { return( _installed ); }
+
+protected:
+    unsigned int _installed;
+};
+
+/** \brief Runs MeshletInstallVisitor on every loaded scene graph.
+\details Install it before loading meshopt output:
+\code
+osgDB::Registry::instance()->setReadFileCallback( new MeshletReadFileCallback );
+\endcode */
+class MeshletReadFileCallback : public osgDB::Registry::ReadFileCallback
+{
+public:
+    virtual osgDB::ReaderWriter::ReadResult readNode( const std::string& fileName,
+        const osgDB::ReaderWriter::Options* options );
+};
+
+
+// __MESHLET_BUILDER_H__
+#endif
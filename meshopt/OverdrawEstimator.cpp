@@ -0,0 +1,161 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#include "OverdrawEstimator.h"
+#include <osg/TriangleIndexFunctor>
+#include <osg/BoundingBox>
+
+#include <vector>
+#include <cfloat>
+#include <cmath>
+
+
+
+OverdrawStats::OverdrawStats()
+  : _covered( 0 ),
+    _shaded( 0 )
+{
+}
+
+void OverdrawStats::add( const OverdrawStats& rhs )
+{
+    _covered += rhs._covered;
+    _shaded += rhs._shaded;
+}
+
+double OverdrawStats::overdraw() const
+{
+    if( _covered == 0 )
+        return( 0. );
+    return( (double)_shaded / (double)_covered );
+}
+
+
+
+namespace
+{
+
+struct CollectOverdrawTriangles
+{
+    void operator()( unsigned int p1, unsigned int p2, unsigned int p3 )
+    {
+        _indices.push_back( p1 );
+        _indices.push_back( p2 );
+        _indices.push_back( p3 );
+    }
+    std::vector< unsigned int > _indices;
+};
+
+// Twice the signed area of (a, b, c).
+inline float edge( float ax, float ay, float bx, float by, float cx, float cy )
+{
+    return( ( bx - ax ) * ( cy - ay ) - ( by - ay ) * ( cx - ax ) );
+}
+
+}
+
+
+OverdrawEstimator::OverdrawEstimator( unsigned int resolution )
+  : _resolution( osg::maximum< unsigned int >( resolution, 1 ) )
+{
+}
+OverdrawEstimator::~OverdrawEstimator()
+{
+}
+
+OverdrawStats OverdrawEstimator::estimate( const osg::Geometry& geom ) const
+{
+    OverdrawStats stats;
+    const osg::Vec3Array* verts( dynamic_cast< const osg::Vec3Array* >( geom.getVertexArray() ) );
+    if( ( verts == NULL ) || verts->empty() )
+        return( stats );
+
+    osg::TriangleIndexFunctor< CollectOverdrawTriangles > collect;
+    geom.accept( collect );
+    const std::vector< unsigned int >& indices( collect._indices );
+
+    osg::BoundingBox bb;
+    osg::Vec3Array::const_iterator vit;
+    for( vit = verts->begin(); vit != verts->end(); ++vit )
+        bb.expandBy( *vit );
+
+    const int res( (int)_resolution );
+    std::vector< float > depth( _resolution * _resolution );
+
+    for( unsigned int axis=0; axis<3; ++axis )
+    {
+        const unsigned int u( ( axis + 1 ) % 3 );
+        const unsigned int v( ( axis + 2 ) % 3 );
+        const float scaleU( (float)res / osg::maximum< float >( bb._max[ u ] - bb._min[ u ], FLT_MIN ) );
+        const float scaleV( (float)res / osg::maximum< float >( bb._max[ v ] - bb._min[ v ], FLT_MIN ) );
+
+        // Look down the axis from both ends.
+        for( int dir=1; dir>=-1; dir-=2 )
+        {
+            std::fill( depth.begin(), depth.end(), FLT_MAX );
+
+            for( unsigned int idx=0; idx+2<indices.size(); idx+=3 )
+            {
+                float x[ 3 ], y[ 3 ], z[ 3 ];
+                bool valid( true );
+                for( unsigned int k=0; k<3; ++k )
+                {
+                    const unsigned int vi( indices[ idx+k ] );
+                    if( vi >= verts->size() )
+                    {
+                        valid = false;
+                        break;
+                    }
+                    const osg::Vec3& p( (*verts)[ vi ] );
+                    x[ k ] = ( p[ u ] - bb._min[ u ] ) * scaleU;
+                    y[ k ] = ( p[ v ] - bb._min[ v ] ) * scaleV;
+                    z[ k ] = p[ axis ] * (float)dir;
+                }
+                if( !valid )
+                    continue;
+
+                const float area( edge( x[0], y[0], x[1], y[1], x[2], y[2] ) );
+                if( area == 0.f )
+                    continue;
+                // Accept either winding.
+                const float sign( ( area > 0.f ) ? 1.f : -1.f );
+                const float invArea( 1.f / ( area * sign ) );
+
+                const int minX( osg::maximum< int >( 0, (int)std::floor( osg::minimum( x[0], osg::minimum( x[1], x[2] ) ) ) ) );
+                const int maxX( osg::minimum< int >( res-1, (int)std::ceil( osg::maximum( x[0], osg::maximum( x[1], x[2] ) ) ) ) );
+                const int minY( osg::maximum< int >( 0, (int)std::floor( osg::minimum( y[0], osg::minimum( y[1], y[2] ) ) ) ) );
+                const int maxY( osg::minimum< int >( res-1, (int)std::ceil( osg::maximum( y[0], osg::maximum( y[1], y[2] ) ) ) ) );
+
+                for( int py=minY; py<=maxY; ++py )
+                {
+                    const float cy( (float)py + .5f );
+                    for( int px=minX; px<=maxX; ++px )
+                    {
+                        const float cx( (float)px + .5f );
+                        const float w0( edge( x[1], y[1], x[2], y[2], cx, cy ) * sign );
+                        const float w1( edge( x[2], y[2], x[0], y[0], cx, cy ) * sign );
+                        const float w2( edge( x[0], y[0], x[1], y[1], cx, cy ) * sign );
+                        if( ( w0 < 0.f ) || ( w1 < 0.f ) || ( w2 < 0.f ) )
+                            continue;
+
+                        const float pz( ( w0 * z[0] + w1 * z[1] + w2 * z[2] ) * invArea );
+                        float& d( depth[ py * res + px ] );
+                        if( pz < d )
+                        {
+                            d = pz;
+                            ++stats._shaded;
+                        }
+                    }
+                }
+            }
+
+            std::vector< float >::const_iterator dit;
+            for( dit = depth.begin(); dit != depth.end(); ++dit )
+            {
+                if( *dit != FLT_MAX )
+                    ++stats._covered;
+            }
+        }
+    }
+
+    return( stats );
+}
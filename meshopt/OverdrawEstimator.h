@@ -0,0 +1,49 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __OVERDRAW_ESTIMATOR_H__
+#define __OVERDRAW_ESTIMATOR_H__ 1
+
+
+#include <osg/Geometry>
+
+
+
+/** \brief Pixel counts from OverdrawEstimator.
+\details overdraw() is shaded / covered pixels: 1.0 means every
+covered pixel was shaded exactly once. */
+struct OverdrawStats
+{
+    OverdrawStats();
+
+    void add( const OverdrawStats& rhs );
+    double overdraw() const;
+
+    unsigned long long _covered;
+    unsigned long long _shaded;
+};
+
+
+/** OverdrawEstimator OverdrawEstimator.h
+\brief Measures overdraw on the CPU, so reordering can be evaluated without a GPU.
+\details Rasterizes the triangles of a Geometry, in draw order and with a
+less-than depth test, into a resolution x resolution grid fitted to the
+bounding box. This is done once for each of the six axis-aligned view
+directions. A pixel is shaded whenever a fragment passes the depth test. Back
+faces are not culled, so the estimate is conservative for closed meshes.
+**/
+class OverdrawEstimator
+{
+public:
+    OverdrawEstimator( unsigned int resolution=256 );
+    ~OverdrawEstimator();
+
+    /** Returns empty stats if \c geom has no Vec3Array vertex array. */
+    OverdrawStats estimate( const osg::Geometry& geom ) const;
+
+protected:
+    unsigned int _resolution;
+};
+
+
+// __OVERDRAW_ESTIMATOR_H__
+#endif
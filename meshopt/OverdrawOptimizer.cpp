@@ -0,0 +1,198 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#include "OverdrawOptimizer.h"
+
+#include <algorithm>
+#include <utility>
+
+
+
+namespace
+{
+
+// Simulated FIFO vertex cache: a vertex is cached if fewer than
+// cacheSize vertices entered the cache after it. Advancing time by
+// cacheSize+1 flushes the cache.
+inline unsigned int updateCache( const unsigned int* tri, unsigned int cacheSize,
+    std::vector< unsigned int >& stamps, unsigned int& time )
+{
+    unsigned int misses( 0 );
+    for( unsigned int k=0; k<3; ++k )
+    {
+        if( time - stamps[ tri[ k ] ] > cacheSize )
+        {
+            stamps[ tri[ k ] ] = time++;
+            ++misses;
+        }
+    }
+    return( misses );
+}
+
+typedef std::pair< float, unsigned int > ClusterKey;
+
+// Descending key. Used with stable_sort, so equal keys keep their
+// vertex cache order.
+inline bool drawFirst( const ClusterKey& lhs, const ClusterKey& rhs )
+{
+    return( lhs.first > rhs.first );
+}
+
+}
+
+
+OverdrawOptimizer::OverdrawOptimizer( float threshold, unsigned int cacheSize )
+  : _threshold( osg::maximum< float >( threshold, 1.f ) ),
+    _cacheSize( osg::maximum< unsigned int >( cacheSize, 3 ) )
+{
+}
+OverdrawOptimizer::~OverdrawOptimizer()
+{
+}
+
+unsigned int OverdrawOptimizer::optimize( osg::Geometry& geom ) const
+{
+    const osg::Vec3Array* verts( dynamic_cast< const osg::Vec3Array* >( geom.getVertexArray() ) );
+    if( verts == NULL )
+        return( 0 );
+
+    unsigned int numClusters( 0 );
+    for( unsigned int idx=0; idx<geom.getNumPrimitiveSets(); ++idx )
+    {
+        osg::DrawElements* de( geom.getPrimitiveSet( idx )->getDrawElements() );
+        if( ( de == NULL ) || ( de->getMode() != GL_TRIANGLES ) )
+            continue;
+
+        // Trailing indices that don't form a triangle stay where they are.
+        const unsigned int numIndices( de->getNumIndices() - de->getNumIndices() % 3 );
+        if( numIndices < 6 )
+            continue;
+        IndexList indices( numIndices );
+        bool valid( true );
+        for( unsigned int jdx=0; jdx<numIndices; ++jdx )
+        {
+            indices[ jdx ] = de->index( jdx );
+            if( indices[ jdx ] >= verts->size() )
+                valid = false;
+        }
+        if( !valid )
+            continue;
+
+        IndexList clusters;
+        findClusters( indices, verts->size(), clusters );
+        if( clusters.size() < 2 )
+            continue;
+        sortClusters( indices, clusters, *verts );
+
+        for( unsigned int jdx=0; jdx<numIndices; ++jdx )
+            de->setElement( jdx, indices[ jdx ] );
+        de->dirty();
+        numClusters += clusters.size();
+    }
+    return( numClusters );
+}
+
+void OverdrawOptimizer::findClusters( const IndexList& indices, unsigned int numVerts,
+    IndexList& clusters ) const
+{
+    const unsigned int numTris( indices.size() / 3 );
+    std::vector< unsigned int > stamps( numVerts, 0 );
+    unsigned int time( _cacheSize + 1 );
+
+    // Hard boundaries: a triangle that misses on all three
+    // vertices usually starts a disjoint patch of the mesh.
+    IndexList hard;
+    unsigned int tri;
+    for( tri=0; tri<numTris; ++tri )
+    {
+        const unsigned int misses( updateCache( &indices[ tri*3 ], _cacheSize, stamps, time ) );
+        if( ( tri == 0 ) || ( misses == 3 ) )
+            hard.push_back( tri );
+    }
+
+    // Soft boundaries: split each hard cluster wherever the piece so far,
+    // starting from a cold cache, is within threshold of the cluster's ACMR.
+    clusters.clear();
+    for( unsigned int hdx=0; hdx<hard.size(); ++hdx )
+    {
+        const unsigned int start( hard[ hdx ] );
+        const unsigned int end( ( hdx+1 < hard.size() ) ? hard[ hdx+1 ] : numTris );
+
+        time += _cacheSize + 1;
+        unsigned int misses( 0 );
+        for( tri=start; tri<end; ++tri )
+            misses += updateCache( &indices[ tri*3 ], _cacheSize, stamps, time );
+        const float target( _threshold * (float)misses / (float)( end - start ) );
+
+        clusters.push_back( start );
+        time += _cacheSize + 1;
+        unsigned int runningMisses( 0 ), runningTris( 0 );
+        for( tri=start; tri<end; ++tri )
+        {
+            runningMisses += updateCache( &indices[ tri*3 ], _cacheSize, stamps, time );
+            ++runningTris;
+            if( (float)runningMisses <= target * (float)runningTris )
+            {
+                clusters.push_back( tri+1 );
+                time += _cacheSize + 1;
+                runningMisses = runningTris = 0;
+            }
+        }
+
+        // Either the last boundary is at end (empty piece), or the trailing
+        // piece never reached the target; merge it with the one before.
+        if( ( clusters.back() == end ) || ( clusters.back() != start ) )
+            clusters.pop_back();
+    }
+}
+
+void OverdrawOptimizer::sortClusters( IndexList& indices, const IndexList& clusters,
+    const osg::Vec3Array& verts ) const
+{
+    osg::Vec3 meshCentroid( 0., 0., 0. );
+    osg::Vec3Array::const_iterator vit;
+    for( vit = verts.begin(); vit != verts.end(); ++vit )
+        meshCentroid += *vit;
+    meshCentroid /= (float)verts.size();
+
+    const unsigned int numTris( indices.size() / 3 );
+    std::vector< ClusterKey > keys;
+    keys.reserve( clusters.size() );
+    for( unsigned int cdx=0; cdx<clusters.size(); ++cdx )
+    {
+        const unsigned int end( ( cdx+1 < clusters.size() ) ? clusters[ cdx+1 ] : numTris );
+
+        // Area-weighted centroid and average normal of the cluster.
+        osg::Vec3 centroid( 0., 0., 0. ), normal( 0., 0., 0. );
+        float area( 0.f );
+        for( unsigned int tri=clusters[ cdx ]; tri<end; ++tri )
+        {
+            const osg::Vec3& p0( verts[ indices[ tri*3 ] ] );
+            const osg::Vec3& p1( verts[ indices[ tri*3+1 ] ] );
+            const osg::Vec3& p2( verts[ indices[ tri*3+2 ] ] );
+            const osg::Vec3 n( ( p1 - p0 ) ^ ( p2 - p0 ) );
+            const float a( n.length() );
+            centroid += ( p0 + p1 + p2 ) * ( a / 3.f );
+            normal += n;
+            area += a;
+        }
+        if( area > 0.f )
+            centroid /= area;
+        normal.normalize();
+
+        // Clusters facing away from the mesh center are likely
+        // occluders and draw first.
+        keys.push_back( ClusterKey( ( centroid - meshCentroid ) * normal, cdx ) );
+    }
+    std::stable_sort( keys.begin(), keys.end(), drawFirst );
+
+    IndexList sorted;
+    sorted.reserve( indices.size() );
+    std::vector< ClusterKey >::const_iterator kit;
+    for( kit = keys.begin(); kit != keys.end(); ++kit )
+    {
+        const unsigned int cdx( kit->second );
+        const unsigned int end( ( cdx+1 < clusters.size() ) ? clusters[ cdx+1 ] : numTris );
+        sorted.insert( sorted.end(), indices.begin() + clusters[ cdx ] * 3, indices.begin() + end * 3 );
+    }
+    indices.swap( sorted );
+}
@@ -0,0 +1,55 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __OVERDRAW_OPTIMIZER_H__
+#define __OVERDRAW_OPTIMIZER_H__ 1
+
+
+#include <osg/Geometry>
+
+#include <vector>
+
+
+
+/** OverdrawOptimizer OverdrawOptimizer.h
+\brief Reorders triangles to reduce overdraw without wrecking vertex cache locality.
+\details Intended to run after osgUtil::VertexCacheVisitor. Each GL_TRIANGLES
+DrawElements is split into clusters: a new cluster starts wherever a triangle
+misses the simulated cache on all three vertices, and each of those clusters
+is split further as long as every piece keeps its ACMR within threshold times
+the ACMR of the unsplit cluster. The clusters are then sorted so that those
+facing away from the mesh centroid (likely occluders) draw first.
+
+Other primitive sets, and Geometries without a Vec3Array vertex
+array, are left unchanged.
+
+This is the cluster sort from Sander, Nehab and Barczak, "Fast Triangle
+Reordering for Vertex Locality and Reduced Overdraw", SIGGRAPH 2007.
+**/
+class OverdrawOptimizer
+{
+public:
+    /** \param threshold Maximum allowed ACMR growth, as a factor. 1.0
+    keeps ACMR unchanged; larger values allow smaller clusters.
+    \param cacheSize Size of the simulated FIFO vertex cache. */
+    OverdrawOptimizer( float threshold=1.05f, unsigned int cacheSize=16 );
+    ~OverdrawOptimizer();
+
+    /** Reorders the triangles of \c geom in place.
+    \return The number of clusters sorted, or 0 if nothing was done. */
+    unsigned int optimize( osg::Geometry& geom ) const;
+
+protected:
+    typedef std::vector< unsigned int > IndexList;
+
+    void findClusters( const IndexList& indices, unsigned int numVerts,
+        IndexList& clusters ) const;
+    void sortClusters( IndexList& indices, const IndexList& clusters,
+        const osg::Vec3Array& verts ) const;
+
+    float _threshold;
+    unsigned int _cacheSize;
+};
+
+
+// __OVERDRAW_OPTIMIZER_H__
+#endif
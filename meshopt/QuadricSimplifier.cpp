@@ -0,0 +1,567 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#include "QuadricSimplifier.h"
+#include <osg/TriangleIndexFunctor>
+#include <osg/Vec3d>
+
+#include <vector>
+#include <map>
+#include <set>
+#include <queue>
+#include <algorithm>
+#include <utility>
+
+
+
+namespace
+{
+
+struct CollectSimplifyTriangles
+{
+    void operator()( unsigned int p1, unsigned int p2, unsigned int p3 )
+    {
+        _indices.push_back( p1 );
+        _indices.push_back( p2 );
+        _indices.push_back( p3 );
+    }
+    std::vector< unsigned int > _indices;
+};
+
+bool isTriangleMode( GLenum mode )
+{
+    return( ( mode == osg::PrimitiveSet::TRIANGLES ) ||
+        ( mode == osg::PrimitiveSet::TRIANGLE_STRIP ) ||
+        ( mode == osg::PrimitiveSet::TRIANGLE_FAN ) ||
+        ( mode == osg::PrimitiveSet::QUADS ) ||
+        ( mode == osg::PrimitiveSet::QUAD_STRIP ) ||
+        ( mode == osg::PrimitiveSet::POLYGON ) );
+}
+
+bool isPerPrimitive( osg::Geometry::AttributeBinding binding )
+{
+    return( ( binding == osg::Geometry::BIND_PER_PRIMITIVE_SET ) ||
+        ( binding == osg::Geometry::BIND_PER_PRIMITIVE ) );
+}
+
+
+/** Symmetric 4x4 matrix: the sum of squared distances to a set of planes. */
+struct Quadric
+{
+    Quadric()
+      : _a2( 0. ), _ab( 0. ), _ac( 0. ), _ad( 0. ),
+        _b2( 0. ), _bc( 0. ), _bd( 0. ),
+        _c2( 0. ), _cd( 0. ), _d2( 0. )
+    {}
+    // Plane n.p + d = 0 with unit normal n.
+    Quadric( const osg::Vec3d& n, double d, double weight )
+      : _a2( weight * n.x() * n.x() ), _ab( weight * n.x() * n.y() ),
+        _ac( weight * n.x() * n.z() ), _ad( weight * n.x() * d ),
+        _b2( weight * n.y() * n.y() ), _bc( weight * n.y() * n.z() ),
+        _bd( weight * n.y() * d ), _c2( weight * n.z() * n.z() ),
+        _cd( weight * n.z() * d ), _d2( weight * d * d )
+    {}
+
+    void add( const Quadric& rhs )
+    {
+        _a2 += rhs._a2; _ab += rhs._ab; _ac += rhs._ac; _ad += rhs._ad;
+        _b2 += rhs._b2; _bc += rhs._bc; _bd += rhs._bd;
+        _c2 += rhs._c2; _cd += rhs._cd; _d2 += rhs._d2;
+    }
+
+    double error( const osg::Vec3d& p ) const
+    {
+        const double x( p.x() ), y( p.y() ), z( p.z() );
+        return( _a2 * x * x + 2. * _ab * x * y + 2. * _ac * x * z + 2. * _ad * x +
+            _b2 * y * y + 2. * _bc * y * z + 2. * _bd * y +
+            _c2 * z * z + 2. * _cd * z + _d2 );
+    }
+
+    double _a2, _ab, _ac, _ad, _b2, _bc, _bd, _c2, _cd, _d2;
+};
+
+/** A candidate half-edge collapse of _from onto _to. Stale once
+either vertex changes version. */
+struct Collapse
+{
+    Collapse( double cost, unsigned int from, unsigned int to,
+            unsigned int fromVersion, unsigned int toVersion )
+      : _cost( cost ), _from( from ), _to( to ),
+        _fromVersion( fromVersion ), _toVersion( toVersion )
+    {}
+    // Cheapest first in a std::priority_queue.
+    bool operator<( const Collapse& rhs ) const
+    {
+        return( _cost > rhs._cost );
+    }
+
+    double _cost;
+    unsigned int _from, _to;
+    unsigned int _fromVersion, _toVersion;
+};
+
+typedef std::pair< unsigned int, unsigned int > Edge;
+/** Each edge of each triangle, with the triangle's index. */
+typedef std::vector< std::pair< Edge, unsigned int > > EdgeTriList;
+
+inline Edge makeEdge( unsigned int a, unsigned int b )
+{
+    return( ( a < b ) ? Edge( a, b ) : Edge( b, a ) );
+}
+
+
+/** Working state for one simplify() call. Vertices here are unique
+positions ("position ids"); triangles keep their original corner
+indices ("attribute vertices") for the final remap. */
+class SimplifyMesh
+{
+public:
+    SimplifyMesh( const osg::Geometry& geom, const osg::Vec3Array& verts, float borderWeight );
+
+    void build( const std::vector< unsigned int >& indices );
+    void collapse( unsigned int targetTris );
+    void getIndices( std::vector< unsigned int >& indices ) const;
+
+    unsigned int getNumTriangles() const { return( _liveTris ); }
+
+protected:
+    osg::Vec3d faceNormal( unsigned int a, unsigned int b, unsigned int c ) const;
+    unsigned int cornerAt( unsigned int tri, unsigned int pos ) const;
+    bool isSeam( const EdgeTriList& edges, unsigned int start, unsigned int end ) const;
+    void constrain( const Edge& edge, unsigned int tri );
+    void push( unsigned int from, unsigned int to );
+    bool isValid( unsigned int from, unsigned int to ) const;
+    void apply( unsigned int from, unsigned int to );
+    unsigned int bestMatch( unsigned int attrVert, unsigned int pos ) const;
+    double attributeDistance( unsigned int a, unsigned int b ) const;
+
+    const osg::Vec3Array& _verts;
+    const osg::Vec3Array* _normals;
+    const osg::Vec4Array* _colors;
+    const osg::Vec2Array* _texCoords;
+    double _borderWeight;
+
+    std::vector< unsigned int > _posOf;
+    std::vector< osg::Vec3d > _pos;
+    std::vector< std::vector< unsigned int > > _attrVerts;
+
+    std::vector< unsigned int > _corners;
+    std::vector< unsigned int > _tris;
+    std::vector< bool > _triAlive;
+    unsigned int _liveTris;
+
+    std::vector< std::vector< unsigned int > > _vertTris;
+    std::vector< Quadric > _quadrics;
+    std::vector< unsigned int > _version;
+    std::vector< bool > _vertAlive;
+    /** Border and seam vertices and edges. */
+    std::vector< bool > _border;
+    std::set< Edge > _borderEdges;
+
+    std::priority_queue< Collapse > _heap;
+};
+
+SimplifyMesh::SimplifyMesh( const osg::Geometry& geom, const osg::Vec3Array& verts, float borderWeight )
+  : _verts( verts ),
+    _normals( NULL ),
+    _colors( NULL ),
+    _texCoords( NULL ),
+    _borderWeight( borderWeight ),
+    _liveTris( 0 )
+{
+    // Attributes used to pick a vertex when a corner moves.
+    if( geom.getNormalBinding() == osg::Geometry::BIND_PER_VERTEX )
+        _normals = dynamic_cast< const osg::Vec3Array* >( geom.getNormalArray() );
+    if( geom.getColorBinding() == osg::Geometry::BIND_PER_VERTEX )
+        _colors = dynamic_cast< const osg::Vec4Array* >( geom.getColorArray() );
+    _texCoords = dynamic_cast< const osg::Vec2Array* >( geom.getTexCoordArray( 0 ) );
+    if( ( _normals != NULL ) && ( _normals->size() < verts.size() ) )
+        _normals = NULL;
+    if( ( _colors != NULL ) && ( _colors->size() < verts.size() ) )
+        _colors = NULL;
+    if( ( _texCoords != NULL ) && ( _texCoords->size() < verts.size() ) )
+        _texCoords = NULL;
+}
+
+void SimplifyMesh::build( const std::vector< unsigned int >& indices )
+{
+    // Weld by exact position.
+    std::map< osg::Vec3, unsigned int > posMap;
+    _posOf.resize( _verts.size() );
+    for( unsigned int idx=0; idx<_verts.size(); ++idx )
+    {
+        std::map< osg::Vec3, unsigned int >::const_iterator it( posMap.find( _verts[ idx ] ) );
+        if( it == posMap.end() )
+        {
+            it = posMap.insert( std::make_pair( _verts[ idx ], (unsigned int)_pos.size() ) ).first;
+            _pos.push_back( osg::Vec3d( _verts[ idx ] ) );
+            _attrVerts.resize( _pos.size() );
+        }
+        _posOf[ idx ] = it->second;
+        _attrVerts[ it->second ].push_back( idx );
+    }
+
+    const unsigned int numPos( _pos.size() );
+    _vertTris.resize( numPos );
+    _quadrics.resize( numPos );
+    _version.resize( numPos, 0 );
+    _vertAlive.resize( numPos, true );
+    _border.resize( numPos, false );
+
+    // Triangles that aren't degenerate in position space, and
+    // their area-weighted plane quadrics.
+    unsigned int idx;
+    for( idx=0; idx+2<indices.size(); idx+=3 )
+    {
+        const unsigned int p0( _posOf[ indices[ idx ] ] );
+        const unsigned int p1( _posOf[ indices[ idx+1 ] ] );
+        const unsigned int p2( _posOf[ indices[ idx+2 ] ] );
+        if( ( p0 == p1 ) || ( p1 == p2 ) || ( p2 == p0 ) )
+            continue;
+
+        const unsigned int tri( _triAlive.size() );
+        for( unsigned int k=0; k<3; ++k )
+            _corners.push_back( indices[ idx+k ] );
+        _tris.push_back( p0 );
+        _tris.push_back( p1 );
+        _tris.push_back( p2 );
+        _triAlive.push_back( true );
+        _vertTris[ p0 ].push_back( tri );
+        _vertTris[ p1 ].push_back( tri );
+        _vertTris[ p2 ].push_back( tri );
+
+        osg::Vec3d n( faceNormal( p0, p1, p2 ) );
+        const double len( n.normalize() );
+        if( len > 0. )
+        {
+            const Quadric q( n, -( n * _pos[ p0 ] ), len * .5 );
+            _quadrics[ p0 ].add( q );
+            _quadrics[ p1 ].add( q );
+            _quadrics[ p2 ].add( q );
+        }
+    }
+    _liveTris = _triAlive.size();
+
+    // Edges used by exactly one triangle are border edges. Edges
+    // whose triangles use different attributes at either end are
+    // seams, and are constrained the same way.
+    EdgeTriList edges;
+    edges.reserve( _tris.size() );
+    for( idx=0; idx<_tris.size(); idx+=3 )
+    {
+        for( unsigned int k=0; k<3; ++k )
+            edges.push_back( std::make_pair( makeEdge( _tris[ idx+k ], _tris[ idx+(k+1)%3 ] ), idx/3 ) );
+    }
+    std::sort( edges.begin(), edges.end() );
+
+    std::vector< Edge > unique;
+    unsigned int start( 0 );
+    while( start < edges.size() )
+    {
+        unsigned int end( start+1 );
+        while( ( end < edges.size() ) && ( edges[ end ].first == edges[ start ].first ) )
+            ++end;
+
+        const Edge& edge( edges[ start ].first );
+        if( ( end - start == 1 ) || isSeam( edges, start, end ) )
+        {
+            for( unsigned int e=start; e<end; ++e )
+                constrain( edge, edges[ e ].second );
+            _borderEdges.insert( edge );
+            _border[ edge.first ] = _border[ edge.second ] = true;
+        }
+
+        unique.push_back( edge );
+        start = end;
+    }
+
+    // Queue collapses once all quadrics and borders are known.
+    std::vector< Edge >::const_iterator it;
+    for( it = unique.begin(); it != unique.end(); ++it )
+    {
+        push( it->first, it->second );
+        push( it->second, it->first );
+    }
+}
+
+void SimplifyMesh::collapse( unsigned int targetTris )
+{
+    while( ( _liveTris > targetTris ) && !_heap.empty() )
+    {
+        const Collapse c( _heap.top() );
+        _heap.pop();
+        if( !_vertAlive[ c._from ] || !_vertAlive[ c._to ] ||
+            ( _version[ c._from ] != c._fromVersion ) ||
+            ( _version[ c._to ] != c._toVersion ) )
+            continue;
+        if( !isValid( c._from, c._to ) )
+            continue;
+        apply( c._from, c._to );
+    }
+}
+
+void SimplifyMesh::getIndices( std::vector< unsigned int >& indices ) const
+{
+    indices.clear();
+    indices.reserve( _liveTris * 3 );
+    for( unsigned int tri=0; tri<_triAlive.size(); ++tri )
+    {
+        if( !_triAlive[ tri ] )
+            continue;
+        for( unsigned int k=0; k<3; ++k )
+        {
+            const unsigned int pos( _tris[ tri*3+k ] );
+            const unsigned int corner( _corners[ tri*3+k ] );
+            indices.push_back( ( _posOf[ corner ] == pos ) ? corner : bestMatch( corner, pos ) );
+        }
+    }
+}
+
+osg::Vec3d SimplifyMesh::faceNormal( unsigned int a, unsigned int b, unsigned int c ) const
+{
+    return( ( _pos[ b ] - _pos[ a ] ) ^ ( _pos[ c ] - _pos[ a ] ) );
+}
+
+unsigned int SimplifyMesh::cornerAt( unsigned int tri, unsigned int pos ) const
+{
+    for( unsigned int k=0; k<3; ++k )
+    {
+        if( _tris[ tri*3+k ] == pos )
+            return( _corners[ tri*3+k ] );
+    }
+    return( _corners[ tri*3 ] );
+}
+
+bool SimplifyMesh::isSeam( const EdgeTriList& edges, unsigned int start, unsigned int end ) const
+{
+    // Compare each triangle's attribute vertices at the edge's
+    // ends with the first triangle's.
+    const Edge& edge( edges[ start ].first );
+    const unsigned int first0( cornerAt( edges[ start ].second, edge.first ) );
+    const unsigned int first1( cornerAt( edges[ start ].second, edge.second ) );
+    for( unsigned int e=start+1; e<end; ++e )
+    {
+        const unsigned int tri( edges[ e ].second );
+        if( ( attributeDistance( cornerAt( tri, edge.first ), first0 ) > 0. ) ||
+            ( attributeDistance( cornerAt( tri, edge.second ), first1 ) > 0. ) )
+            return( true );
+    }
+    return( false );
+}
+
+void SimplifyMesh::constrain( const Edge& edge, unsigned int tri )
+{
+    // A plane through the edge, perpendicular to the face.
+    osg::Vec3d n( faceNormal( _tris[ tri*3 ], _tris[ tri*3+1 ], _tris[ tri*3+2 ] ) );
+    n.normalize();
+    const osg::Vec3d dir( _pos[ edge.second ] - _pos[ edge.first ] );
+    osg::Vec3d bn( dir ^ n );
+    if( bn.normalize() > 0. )
+    {
+        const Quadric q( bn, -( bn * _pos[ edge.first ] ), _borderWeight * dir.length2() );
+        _quadrics[ edge.first ].add( q );
+        _quadrics[ edge.second ].add( q );
+    }
+}
+
+void SimplifyMesh::push( unsigned int from, unsigned int to )
+{
+    if( _border[ from ] && ( _borderEdges.find( makeEdge( from, to ) ) == _borderEdges.end() ) )
+        return;
+
+    Quadric q( _quadrics[ from ] );
+    q.add( _quadrics[ to ] );
+    _heap.push( Collapse( q.error( _pos[ to ] ), from, to, _version[ from ], _version[ to ] ) );
+}
+
+bool SimplifyMesh::isValid( unsigned int from, unsigned int to ) const
+{
+    if( _border[ from ] && ( _borderEdges.find( makeEdge( from, to ) ) == _borderEdges.end() ) )
+        return( false );
+
+    bool adjacent( false );
+    std::vector< unsigned int >::const_iterator it;
+    for( it = _vertTris[ from ].begin(); it != _vertTris[ from ].end(); ++it )
+    {
+        if( !_triAlive[ *it ] )
+            continue;
+        const unsigned int* tri( &_tris[ *it * 3 ] );
+        if( ( tri[ 0 ] == to ) || ( tri[ 1 ] == to ) || ( tri[ 2 ] == to ) )
+        {
+            adjacent = true;
+            continue;
+        }
+
+        // Reject if a surviving triangle would flip or degenerate.
+        unsigned int moved[ 3 ];
+        for( unsigned int k=0; k<3; ++k )
+            moved[ k ] = ( tri[ k ] == from ) ? to : tri[ k ];
+        const osg::Vec3d before( faceNormal( tri[ 0 ], tri[ 1 ], tri[ 2 ] ) );
+        const osg::Vec3d after( faceNormal( moved[ 0 ], moved[ 1 ], moved[ 2 ] ) );
+        if( before * after <= 0. )
+            return( false );
+    }
+    return( adjacent );
+}
+
+void SimplifyMesh::apply( unsigned int from, unsigned int to )
+{
+    // Move from's border and seam edges onto to.
+    if( _border[ from ] )
+    {
+        std::set< unsigned int > neighbors;
+        std::vector< unsigned int >::const_iterator it;
+        for( it = _vertTris[ from ].begin(); it != _vertTris[ from ].end(); ++it )
+        {
+            if( _triAlive[ *it ] )
+                neighbors.insert( &_tris[ *it * 3 ], &_tris[ *it * 3 ] + 3 );
+        }
+        std::set< unsigned int >::const_iterator nit;
+        for( nit = neighbors.begin(); nit != neighbors.end(); ++nit )
+        {
+            if( ( *nit == from ) || ( _borderEdges.erase( makeEdge( from, *nit ) ) == 0 ) )
+                continue;
+            if( *nit != to )
+                _borderEdges.insert( makeEdge( to, *nit ) );
+        }
+    }
+
+    std::vector< unsigned int >::const_iterator it;
+    for( it = _vertTris[ from ].begin(); it != _vertTris[ from ].end(); ++it )
+    {
+        if( !_triAlive[ *it ] )
+            continue;
+        unsigned int* tri( &_tris[ *it * 3 ] );
+        if( ( tri[ 0 ] == to ) || ( tri[ 1 ] == to ) || ( tri[ 2 ] == to ) )
+        {
+            _triAlive[ *it ] = false;
+            --_liveTris;
+            continue;
+        }
+        for( unsigned int k=0; k<3; ++k )
+        {
+            if( tri[ k ] == from )
+                tri[ k ] = to;
+        }
+        _vertTris[ to ].push_back( *it );
+    }
+    _quadrics[ to ].add( _quadrics[ from ] );
+    _vertAlive[ from ] = false;
+    std::vector< unsigned int >().swap( _vertTris[ from ] );
+    ++_version[ to ];
+
+    // Drop dead triangles from to's list and requeue its edges.
+    std::vector< unsigned int > live;
+    std::set< unsigned int > neighbors;
+    for( it = _vertTris[ to ].begin(); it != _vertTris[ to ].end(); ++it )
+    {
+        if( !_triAlive[ *it ] )
+            continue;
+        live.push_back( *it );
+        neighbors.insert( &_tris[ *it * 3 ], &_tris[ *it * 3 ] + 3 );
+    }
+    _vertTris[ to ].swap( live );
+    neighbors.erase( to );
+    std::set< unsigned int >::const_iterator nit;
+    for( nit = neighbors.begin(); nit != neighbors.end(); ++nit )
+    {
+        push( to, *nit );
+        push( *nit, to );
+    }
+}
+
+unsigned int SimplifyMesh::bestMatch( unsigned int attrVert, unsigned int pos ) const
+{
+    const std::vector< unsigned int >& candidates( _attrVerts[ pos ] );
+    unsigned int best( candidates.front() );
+    double bestDistance( attributeDistance( attrVert, best ) );
+    for( unsigned int idx=1; idx<candidates.size(); ++idx )
+    {
+        const double distance( attributeDistance( attrVert, candidates[ idx ] ) );
+        if( distance < bestDistance )
+        {
+            best = candidates[ idx ];
+            bestDistance = distance;
+        }
+    }
+    return( best );
+}
+
+double SimplifyMesh::attributeDistance( unsigned int a, unsigned int b ) const
+{
+    double distance( 0. );
+    if( _normals != NULL )
+        distance += ( (*_normals)[ a ] - (*_normals)[ b ] ).length2();
+    if( _colors != NULL )
+        distance += ( (*_colors)[ a ] - (*_colors)[ b ] ).length2();
+    if( _texCoords != NULL )
+        distance += ( (*_texCoords)[ a ] - (*_texCoords)[ b ] ).length2();
+    return( distance );
+}
+
+}
+
+
+
+QuadricSimplifier::QuadricSimplifier( float borderWeight )
+  : _borderWeight( borderWeight )
+{
+}
+QuadricSimplifier::~QuadricSimplifier()
+{
+}
+
+osg::Geometry* QuadricSimplifier::simplify( const osg::Geometry& geom, float targetRatio ) const
+{
+    const osg::Vec3Array* verts( dynamic_cast< const osg::Vec3Array* >( geom.getVertexArray() ) );
+    if( ( verts == NULL ) || verts->empty() || isPerPrimitive( geom.getNormalBinding() ) ||
+        isPerPrimitive( geom.getColorBinding() ) )
+        return( NULL );
+
+    osg::TriangleIndexFunctor< CollectSimplifyTriangles > collect;
+    geom.accept( collect );
+    std::vector< unsigned int >::const_iterator it;
+    for( it = collect._indices.begin(); it != collect._indices.end(); ++it )
+    {
+        if( *it >= verts->size() )
+            return( NULL );
+    }
+
+    SimplifyMesh mesh( geom, *verts, _borderWeight );
+    mesh.build( collect._indices );
+    const unsigned int numTris( mesh.getNumTriangles() );
+    mesh.collapse( (unsigned int)( numTris * osg::clampBetween( targetRatio, 0.f, 1.f ) ) );
+    if( mesh.getNumTriangles() == numTris )
+        return( NULL );
+
+    std::vector< unsigned int > indices;
+    mesh.getIndices( indices );
+
+    osg::Geometry* simplified( new osg::Geometry( geom,
+        osg::CopyOp( osg::CopyOp::DEEP_COPY_USERDATA ) ) );
+    for( unsigned int idx=simplified->getNumPrimitiveSets(); idx>0; --idx )
+    {
+        if( isTriangleMode( simplified->getPrimitiveSet( idx-1 )->getMode() ) )
+            simplified->removePrimitiveSet( idx-1 );
+    }
+    if( indices.empty() )
+        return( simplified );
+
+    const unsigned int maxIndex( *std::max_element( indices.begin(), indices.end() ) );
+    if( maxIndex < 0xffff )
+    {
+        osg::DrawElementsUShort* de( new osg::DrawElementsUShort( GL_TRIANGLES ) );
+        de->reserve( indices.size() );
+        for( it = indices.begin(); it != indices.end(); ++it )
+            de->push_back( (GLushort)( *it ) );
+        simplified->addPrimitiveSet( de );
+    }
+    else
+    {
+        osg::DrawElementsUInt* de( new osg::DrawElementsUInt( GL_TRIANGLES ) );
+        de->reserve( indices.size() );
+        for( it = indices.begin(); it != indices.end(); ++it )
+            de->push_back( *it );
+        simplified->addPrimitiveSet( de );
+    }
+    return( simplified );
+}
@@ -0,0 +1,49 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __QUADRIC_SIMPLIFIER_H__
+#define __QUADRIC_SIMPLIFIER_H__ 1
+
+
+#include <osg/Geometry>
+
+
+
+/** QuadricSimplifier QuadricSimplifier.h
+\brief Reduces triangle count with quadric error metric edge collapse.
+\details Garland and Heckbert, "Surface Simplification Using Quadric Error
+Metrics", SIGGRAPH 1997, restricted to half-edge collapses: a vertex only
+ever collapses onto one of its neighbors. The simplified Geometry is then
+just a new index list, sharing the source's vertex arrays, so positions
+and attributes are never interpolated.
+
+Connectivity is computed on vertex positions. When a triangle corner
+moves to a new position, it takes the vertex at that position whose
+normal, color and texture coordinates best match its old vertex.
+
+Border edges, and seam edges whose triangles use different normals,
+colors or texture coordinates at either end, get an extra quadric per
+adjacent face, for a plane through the edge perpendicular to the face,
+weighted by borderWeight. A border or seam vertex only collapses along
+a border or seam edge, so seams keep their shape and the attributes on
+each side stay put. Collapses that would flip a triangle are rejected.
+**/
+class QuadricSimplifier
+{
+public:
+    QuadricSimplifier( float borderWeight=10.f );
+    ~QuadricSimplifier();
+
+    /** Returns a copy of \c geom with at most about targetRatio of its
+    triangles. The copy shares arrays and StateSet with \c geom, and keeps
+    its non-triangle primitive sets unchanged.
+    \return NULL if \c geom has no Vec3Array vertex array or per-primitive
+    bindings, or if no triangle could be removed. */
+    osg::Geometry* simplify( const osg::Geometry& geom, float targetRatio ) const;
+
+protected:
+    float _borderWeight;
+};
+
+
+// __QUADRIC_SIMPLIFIER_H__
+#endif
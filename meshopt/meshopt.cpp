@@ -1,10 +1,406 @@
 // Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
 
+#include "GeometryPool.h"
+#include "CacheSimulator.h"
+#include "OverdrawOptimizer.h"
+#include "OverdrawEstimator.h"
+#include "MeshletBuilder.h"
+#include "AttributeQuantizer.h"
+#include "QuadricSimplifier.h"
+#include "HausdorffDistance.h"
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
+#include <osgDB/FileNameUtils>
 #include <osgwTools/MeshOptimizers.h>
 #include <osgwTools/CountsVisitor.h>
 #include <osgUtil/Optimizer>
+#include <osgUtil/TriStripVisitor>
+#include <osg/LOD>
+#include <osg/TriangleIndexFunctor>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <fstream>
+#include <map>
+#include <set>
+#include <cfloat>
+
+
+// Per-Geometry stages of the optimization pipeline. Each call uses
+// its own visitor instance. The stages rewrite arrays in place, which
+// is safe because GeometryPool runs Geometries that share arrays on
+// the same thread.
+
+struct TriStripOperation : public GeometryPool::Operation
+{
+    virtual void operator()( osg::Geometry& geom )
+    {
+        osgUtil::TriStripVisitor tsv;
+        tsv.stripify( geom );
+    }
+};
+
+struct IndexMeshOperation : public GeometryPool::Operation
+{
+    virtual void operator()( osg::Geometry& geom )
+    {
+        osgUtil::IndexMeshVisitor imv;
+        imv.makeMesh( geom );
+    }
+};
+
+struct VertexAccessOrderOperation : public GeometryPool::Operation
+{
+    virtual void operator()( osg::Geometry& geom )
+    {
+        osgUtil::VertexAccessOrderVisitor vaov;
+        vaov.optimizeOrder( geom );
+    }
+};
+
+struct VertexCacheOperation : public GeometryPool::Operation
+{
+    virtual void operator()( osg::Geometry& geom )
+    {
+        osgUtil::VertexCacheVisitor vcv;
+        vcv.optimizeVertices( geom );
+    }
+};
+
+struct OverdrawOperation : public GeometryPool::Operation
+{
+    OverdrawOperation( float threshold )
+      : _optimizer( threshold ),
+        _clusters( 0 )
+    {}
+    virtual void operator()( osg::Geometry& geom )
+    {
+        const unsigned int clusters( _optimizer.optimize( geom ) );
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+        _clusters += clusters;
+    }
+
+    OverdrawOptimizer _optimizer;
+    OpenThreads::Mutex _mutex;
+    unsigned int _clusters;
+};
+
+struct OverdrawEstimateOperation : public GeometryPool::Operation
+{
+    OverdrawEstimateOperation( unsigned int resolution )
+      : _estimator( resolution )
+    {}
+    virtual void operator()( osg::Geometry& geom )
+    {
+        const OverdrawStats stats( _estimator.estimate( geom ) );
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+        _stats.add( stats );
+    }
+
+    OverdrawEstimator _estimator;
+    OpenThreads::Mutex _mutex;
+    OverdrawStats _stats;
+};
+
+struct MeshletOperation : public GeometryPool::Operation
+{
+    MeshletOperation( unsigned int maxVertices, unsigned int maxTriangles )
+      : _builder( maxVertices, maxTriangles )
+    {}
+    virtual void operator()( osg::Geometry& geom )
+    {
+        MeshletBuilder::GeometryList meshlets;
+        if( !_builder.build( geom, meshlets ) )
+            return;
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+        _meshlets[ &geom ].swap( meshlets );
+    }
+
+    // Swap every split Geometry for its meshlets. Modifies the
+    // scene graph, so call it after the pool has finished.
+    unsigned int replace()
+    {
+        unsigned int count( 0 );
+        MeshletMap::iterator it;
+        for( it = _meshlets.begin(); it != _meshlets.end(); ++it )
+        {
+            osg::ref_ptr< osg::Geometry > geom( it->first );
+            std::vector< osg::Geode* > parents;
+            for( unsigned int idx=0; idx<geom->getNumParents(); ++idx )
+            {
+                osg::Geode* geode( geom->getParent( idx )->asGeode() );
+                if( geode != NULL )
+                    parents.push_back( geode );
+            }
+
+            const MeshletBuilder::GeometryList& meshlets( it->second );
+            std::vector< osg::Geode* >::const_iterator pit;
+            for( pit = parents.begin(); pit != parents.end(); ++pit )
+            {
+                (*pit)->removeDrawable( geom.get() );
+                MeshletBuilder::GeometryList::const_iterator mit;
+                for( mit = meshlets.begin(); mit != meshlets.end(); ++mit )
+                    (*pit)->addDrawable( mit->get() );
+            }
+            count += meshlets.size();
+        }
+        return( count );
+    }
+
+    typedef std::map< osg::Geometry*, MeshletBuilder::GeometryList > MeshletMap;
+
+    MeshletBuilder _builder;
+    OpenThreads::Mutex _mutex;
+    MeshletMap _meshlets;
+};
+
+struct QuantizeOperation : public GeometryPool::Operation
+{
+    QuantizeOperation( AttributeQuantizer& quantizer )
+      : _quantizer( quantizer )
+    {}
+    virtual void operator()( osg::Geometry& geom )
+    {
+        _quantizer.quantize( geom );
+    }
+
+    AttributeQuantizer& _quantizer;
+};
+
+struct CountTriangles
+{
+    CountTriangles() : _count( 0 ) {}
+    void operator()( unsigned int, unsigned int, unsigned int ) { ++_count; }
+    unsigned int _count;
+};
+
+unsigned int countTriangles( const osg::Geometry& geom )
+{
+    osg::TriangleIndexFunctor< CountTriangles > count;
+    geom.accept( count );
+    return( count._count );
+}
+
+struct LodOperation : public GeometryPool::Operation
+{
+    /** Simplified levels of one Geometry. Level 0, the Geometry
+    itself, is implicit in _geometries and _errors. */
+    struct Levels
+    {
+        std::vector< osg::ref_ptr< osg::Geometry > > _geometries;
+        std::vector< double > _errors;
+        std::vector< unsigned int > _triangles;
+    };
+    typedef std::map< osg::Geometry*, Levels > LevelsMap;
+
+    LodOperation( unsigned int numLevels, float ratio )
+      : _numLevels( numLevels ),
+        _ratio( ratio )
+    {}
+    virtual void operator()( osg::Geometry& geom )
+    {
+        Levels levels;
+        levels._triangles.push_back( countTriangles( geom ) );
+
+        // Each level simplifies the one before it; the error is
+        // always measured against the full-resolution Geometry.
+        const osg::Geometry* previous( &geom );
+        while( levels._geometries.size() < _numLevels )
+        {
+            osg::ref_ptr< osg::Geometry > level( _simplifier.simplify( *previous, _ratio ) );
+            if( !level.valid() )
+                break;
+            const unsigned int triangles( countTriangles( *level ) );
+            if( ( triangles == 0 ) || ( triangles > levels._triangles.back() * 9 / 10 ) )
+                break;
+
+            osgUtil::VertexCacheVisitor vcv;
+            vcv.optimizeVertices( *level );
+
+            levels._geometries.push_back( level );
+            levels._errors.push_back( hausdorffDistance( geom, *level ) );
+            levels._triangles.push_back( triangles );
+            previous = level.get();
+        }
+        if( levels._geometries.empty() )
+            return;
+
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _mutex );
+        _levels[ &geom ] = levels;
+    }
+
+    // Replace each Geode that has simplified Geometries with a
+    // pixel-size LOD. Level k is used while its Hausdorff error
+    // covers at most pixelError pixels. Modifies the scene graph,
+    // so call it after the pool has finished.
+    unsigned int buildLODs( float pixelError )
+    {
+        std::set< osg::Geode* > geodes;
+        LevelsMap::const_iterator it;
+        for( it = _levels.begin(); it != _levels.end(); ++it )
+        {
+            for( unsigned int idx=0; idx<it->first->getNumParents(); ++idx )
+            {
+                osg::Geode* geode( it->first->getParent( idx )->asGeode() );
+                if( geode != NULL )
+                    geodes.insert( geode );
+            }
+        }
+
+        std::set< osg::Geode* >::const_iterator git;
+        for( git = geodes.begin(); git != geodes.end(); ++git )
+        {
+            osg::ref_ptr< osg::Geode > geode( *git );
+            unsigned int numLevels( 0 );
+            unsigned int idx;
+            for( idx=0; idx<geode->getNumDrawables(); ++idx )
+            {
+                it = _levels.find( geode->getDrawable( idx )->asGeometry() );
+                if( it != _levels.end() )
+                    numLevels = osg::maximum< unsigned int >( numLevels, it->second._geometries.size() );
+            }
+
+            const float diameter( geode->getBound().radius() * 2.f );
+            std::vector< osg::ref_ptr< osg::Node > > levelNodes;
+            std::vector< float > maxPixels;
+            levelNodes.push_back( geode.get() );
+            maxPixels.push_back( FLT_MAX );
+            for( unsigned int level=1; level<=numLevels; ++level )
+            {
+                osg::Geode* levelGeode( new osg::Geode( *geode, osg::CopyOp::SHALLOW_COPY ) );
+                double error( 0. );
+                for( idx=0; idx<levelGeode->getNumDrawables(); ++idx )
+                {
+                    it = _levels.find( levelGeode->getDrawable( idx )->asGeometry() );
+                    if( it == _levels.end() )
+                        continue;
+                    const unsigned int available( osg::minimum< unsigned int >( level, it->second._geometries.size() ) );
+                    levelGeode->setDrawable( idx, it->second._geometries[ available-1 ].get() );
+                    error = osg::maximum( error, it->second._errors[ available-1 ] );
+                }
+                const float pixels( ( error > 0. ) ? (float)( diameter * pixelError / error ) : FLT_MAX );
+                levelNodes.push_back( levelGeode );
+                maxPixels.push_back( osg::minimum( pixels, maxPixels.back() ) );
+            }
+
+            osg::LOD* lod( new osg::LOD );
+            lod->setName( geode->getName() );
+            lod->setRangeMode( osg::LOD::PIXEL_SIZE_ON_SCREEN );
+            std::vector< osg::Group* > parents;
+            for( idx=0; idx<geode->getNumParents(); ++idx )
+                parents.push_back( geode->getParent( idx ) );
+            std::vector< osg::Group* >::const_iterator pit;
+            for( pit = parents.begin(); pit != parents.end(); ++pit )
+                (*pit)->replaceChild( geode.get(), lod );
+            for( idx=0; idx<levelNodes.size(); ++idx )
+            {
+                const float minPixels( ( idx+1 < maxPixels.size() ) ? maxPixels[ idx+1 ] : 0.f );
+                lod->addChild( levelNodes[ idx ].get(), minPixels, maxPixels[ idx ] );
+            }
+        }
+        return( geodes.size() );
+    }
+
+    void dump( std::ostream& ostr ) const
+    {
+        std::vector< unsigned int > triangles( _numLevels+1, 0 );
+        std::vector< double > errors( _numLevels+1, 0. );
+        LevelsMap::const_iterator it;
+        for( it = _levels.begin(); it != _levels.end(); ++it )
+        {
+            const Levels& levels( it->second );
+            for( unsigned int level=0; level<=_numLevels; ++level )
+            {
+                // Geometries with fewer levels repeat their last one.
+                const unsigned int available( osg::minimum< unsigned int >( level, levels._geometries.size() ) );
+                triangles[ level ] += levels._triangles[ available ];
+                if( available > 0 )
+                    errors[ level ] = osg::maximum( errors[ level ], levels._errors[ available-1 ] );
+            }
+        }
+
+        ostr << "LOD results (" << _levels.size() << " Geometries simplified):" << std::endl;
+        for( unsigned int level=0; level<=_numLevels; ++level )
+            ostr << "  Level " << level << ": " << triangles[ level ] << " triangles, max Hausdorff error " <<
+                errors[ level ] << std::endl;
+    }
+
+    QuadricSimplifier _simplifier;
+    unsigned int _numLevels;
+    float _ratio;
+    OpenThreads::Mutex _mutex;
+    LevelsMap _levels;
+};
+
+typedef std::vector< std::pair< std::string, double > > StageTimes;
+
+
+typedef std::vector< CacheStats > CacheStatsList;
+
+// Simulate the vertex cache for every Geometry in the pool. Returns
+// the overall stats; per-Geometry stats are stored in perGeom.
+CacheStats simulateCache( const GeometryPool& pool, const CacheSimulator& sim,
+    CacheStatsList& perGeom )
+{
+    CacheStats total;
+    perGeom.clear();
+    const GeometryPool::GeometryList& geoms( pool.getGeometries() );
+    GeometryPool::GeometryList::const_iterator it;
+    for( it = geoms.begin(); it != geoms.end(); ++it )
+    {
+        perGeom.push_back( sim.simulate( **it ) );
+        total.add( perGeom.back() );
+    }
+    return( total );
+}
+
+void dumpCacheReport( const CacheSimulator& sim,
+    const CacheStats& before, const CacheStats& after )
+{
+    OSG_ALWAYS << "Vertex cache simulation (" << before._triangles << " -> " <<
+        after._triangles << " triangles):" << std::endl;
+    OSG_ALWAYS << "  Cache \tACMR before\tACMR after\tATVR before\tATVR after" << std::endl;
+    const CacheSimulator::ConfigList& configs( sim.getConfigs() );
+    for( unsigned int idx=0; idx<configs.size(); ++idx )
+    {
+        OSG_ALWAYS << "  " << configs[ idx ].getName() << "\t" <<
+            before.acmr( idx ) << "\t" << after.acmr( idx ) << "\t" <<
+            before.atvr( idx ) << "\t" << after.atvr( idx ) << std::endl;
+    }
+}
+
+// One row per Geometry, in pool order.
+bool writeCacheCSV( const std::string& fileName, const CacheSimulator& sim,
+    const CacheStatsList& before, const CacheStatsList& after )
+{
+    std::ofstream ofstr( fileName.c_str() );
+    if( !ofstr.good() )
+        return( false );
+
+    const CacheSimulator::ConfigList& configs( sim.getConfigs() );
+    ofstr << "geometry,triangles,vertices";
+    unsigned int idx;
+    for( idx=0; idx<configs.size(); ++idx )
+    {
+        const std::string name( configs[ idx ].getName() );
+        ofstr << ",acmr_before_" << name << ",acmr_after_" << name <<
+            ",atvr_before_" << name << ",atvr_after_" << name;
+    }
+    ofstr << std::endl;
+
+    for( unsigned int geom=0; geom<before.size(); ++geom )
+    {
+        ofstr << geom << "," << after[ geom ]._triangles << "," << after[ geom ]._vertices;
+        for( idx=0; idx<configs.size(); ++idx )
+            ofstr << "," << before[ geom ].acmr( idx ) << "," << after[ geom ].acmr( idx ) <<
+                "," << before[ geom ].atvr( idx ) << "," << after[ geom ].atvr( idx );
+        ofstr << std::endl;
+    }
+    return( true );
+}
 
 
 
@@ -15,23 +411,103 @@ int main( int argc, char** argv )
     std::string outFile;
     if( arguments.find( "-o" ) > 0 )
         arguments.read( "-o", outFile );
+
+    // 0 (the default) uses one thread per processor.
+    unsigned int numThreads( 0 );
+    arguments.read( "--threads", numThreads );
+
+    // Optional per-Geometry vertex cache report.
+    std::string cacheCSV;
+    arguments.read( "--cache-csv", cacheCSV );
+
+    // Optional overdraw reordering after the vertex cache stage. The
+    // threshold is the allowed ACMR growth factor; the resolution is
+    // that of the CPU rasterizer used to measure the result.
+    const bool overdraw( arguments.read( "--overdraw" ) );
+    float overdrawThreshold( 1.05f );
+    arguments.read( "--overdraw-threshold", overdrawThreshold );
+    unsigned int overdrawResolution( 256 );
+    arguments.read( "--overdraw-resolution", overdrawResolution );
+
+    // Optional LOD chain: numLevels simplified levels per Geometry, each
+    // with lodRatio of the triangles of the level before.
+    const bool lod( arguments.read( "--lod" ) );
+    unsigned int lodLevels( 3 );
+    arguments.read( "--lod-levels", lodLevels );
+    float lodRatio( .5f ), lodPixelError( 1.f );
+    arguments.read( "--lod-ratio", lodRatio );
+    arguments.read( "--lod-pixel-error", lodPixelError );
+
+    // Optional final stage: split each Geometry into meshlets that
+    // are culled individually against the frustum and by normal cone.
+    const bool meshlets( arguments.read( "--meshlets" ) );
+    unsigned int meshletVertices( 64 ), meshletTriangles( 124 );
+    arguments.read( "--meshlet-vertices", meshletVertices );
+    arguments.read( "--meshlet-triangles", meshletTriangles );
+
+    // Meshlet bounds and cones are user values, which only the
+    // serializer-based formats store.
     if( outFile.empty() )
-        outFile = "out.ive";
+        outFile = meshlets ? "out.osgb" : "out.ive";
+    if( meshlets )
+    {
+        const std::string ext( osgDB::getLowerCaseFileExtension( outFile ) );
+        if( ( ext != "osgb" ) && ( ext != "osgt" ) && ( ext != "osgx" ) )
+        {
+            OSG_FATAL << "--meshlets requires .osgb, .osgt or .osgx output." << std::endl;
+            return( 1 );
+        }
+    }
+
+    // Optional last stage: quantize positions, texcoords and normals,
+    // with normals in one of float, snorm16, oct16 (default) or oct8.
+    const bool quantize( arguments.read( "--quantize" ) );
+    AttributeQuantizer::NormalMode normalMode( AttributeQuantizer::NORMAL_OCT16 );
+    std::string normalModeName;
+    if( arguments.read( "--quantize-normals", normalModeName ) )
+    {
+        if( normalModeName == "float" )
+            normalMode = AttributeQuantizer::NORMAL_FLOAT;
+        else if( normalModeName == "snorm16" )
+            normalMode = AttributeQuantizer::NORMAL_SNORM16;
+        else if( normalModeName == "oct8" )
+            normalMode = AttributeQuantizer::NORMAL_OCT8;
+        else if( normalModeName != "oct16" )
+            OSG_WARN << "Unknown normal format " << normalModeName << ", using oct16." << std::endl;
+    }
 
     osg::ref_ptr< osg::Node > root( osgDB::readNodeFiles( arguments ) );
+    if( !root.valid() )
+    {
+        OSG_FATAL << "No data loaded." << std::endl;
+        return( 1 );
+    }
 
-    OSG_ALWAYS << "Creating tri strips with Optimizer..." << std::endl;
-    osgUtil::Optimizer opt;
-    opt.optimize( root.get(), osgUtil::Optimizer::TRISTRIP_GEOMETRY );
+    // Gather the unique Geometries. The stages up to overdraw don't add
+    // or remove Geometries; the LOD and meshlet stages do, so the pool
+    // collects again after them.
+    GeometryPool pool( numThreads );
+    pool.collect( *root );
+    OSG_ALWAYS << "Processing " << pool.getGeometries().size() << " Geometries (" <<
+        pool.getGroups().size() << " groups with no shared data) on " <<
+        pool.getNumThreads() << " threads." << std::endl;
+    StageTimes times;
+
+    CacheSimulator sim;
+    CacheStatsList cacheBefore;
+    const CacheStats totalBefore( simulateCache( pool, sim, cacheBefore ) );
+
+    OSG_ALWAYS << "Creating tri strips..." << std::endl;
+    TriStripOperation tso;
+    times.push_back( std::make_pair( std::string( "TriStrip" ), pool.run( tso ) ) );
 
     osgwTools::CountsVisitor cv0;
     root->accept( cv0 );
     cv0.dump( osg::notify( osg::ALWAYS ) );
 
     OSG_ALWAYS << "Running IndexMeshVisitor..." << std::endl;
-    osgUtil::IndexMeshVisitor imv;
-    root->accept( imv );
-    imv.makeMesh();
+    IndexMeshOperation imo;
+    times.push_back( std::make_pair( std::string( "IndexMesh" ), pool.run( imo ) ) );
 
     osgwTools::CountsVisitor cv1;
     root->accept( cv1 );
@@ -45,14 +521,76 @@ int main( int argc, char** argv )
     }
 
     OSG_ALWAYS << "Running VertexAccessOrderVisitor..." << std::endl;
-    osgUtil::VertexAccessOrderVisitor vaov;
-    root->accept( vaov );
-    vaov.optimizeOrder();
+    VertexAccessOrderOperation vaoo;
+    times.push_back( std::make_pair( std::string( "VertexAccessOrder" ), pool.run( vaoo ) ) );
 
     OSG_ALWAYS << "Running VertexCacheVisitor..." << std::endl;
-    osgUtil::VertexCacheVisitor vcv;
-    root->accept( vcv );
-    vcv.optimizeVertices();
+    VertexCacheOperation vco;
+    times.push_back( std::make_pair( std::string( "VertexCache" ), pool.run( vco ) ) );
+
+    if( overdraw )
+    {
+        OverdrawEstimateOperation before( overdrawResolution );
+        pool.run( before );
+
+        OSG_ALWAYS << "Running OverdrawOptimizer..." << std::endl;
+        OverdrawOperation odo( overdrawThreshold );
+        times.push_back( std::make_pair( std::string( "Overdraw" ), pool.run( odo ) ) );
+
+        OverdrawEstimateOperation after( overdrawResolution );
+        pool.run( after );
+
+        OSG_ALWAYS << "OverdrawOptimizer results (threshold " << overdrawThreshold << "):" << std::endl;
+        OSG_ALWAYS << "  Clusters: " << odo._clusters << std::endl;
+        OSG_ALWAYS << "  Overdraw before: " << before._stats.overdraw() << std::endl;
+        OSG_ALWAYS << "  Overdraw after: " << after._stats.overdraw() << std::endl;
+    }
+
+    // Simulate before the meshlet split, so the report compares
+    // the same Geometries.
+    CacheStatsList cacheAfter;
+    const CacheStats totalAfter( simulateCache( pool, sim, cacheAfter ) );
+
+    if( lod )
+    {
+        OSG_ALWAYS << "Building LODs..." << std::endl;
+        LodOperation lo( lodLevels, lodRatio );
+        times.push_back( std::make_pair( std::string( "LOD" ), pool.run( lo ) ) );
+        const unsigned int numLODs( lo.buildLODs( lodPixelError ) );
+        lo.dump( osg::notify( osg::ALWAYS ) );
+        OSG_ALWAYS << "  LOD nodes: " << numLODs << std::endl;
+    }
+
+    if( meshlets )
+    {
+        // Pick up the LOD levels, if any.
+        if( lod )
+            pool.collect( *root );
+
+        OSG_ALWAYS << "Building meshlets..." << std::endl;
+        MeshletOperation mo( meshletVertices, meshletTriangles );
+        times.push_back( std::make_pair( std::string( "Meshlets" ), pool.run( mo ) ) );
+        const unsigned int numMeshlets( mo.replace() );
+        OSG_ALWAYS << "Meshlet results (" << meshletVertices << " vertices, " <<
+            meshletTriangles << " triangles max):" << std::endl;
+        OSG_ALWAYS << "  Geometries split: " << mo._meshlets.size() << std::endl;
+        OSG_ALWAYS << "  Meshlets: " << numMeshlets << std::endl;
+        OSG_ALWAYS << "  Load " << outFile << " with a MeshletReadFileCallback to cull them." << std::endl;
+    }
+
+    if( quantize )
+    {
+        // Pick up the LOD levels and meshlet Geometries, if any.
+        if( lod || meshlets )
+            pool.collect( *root );
+
+        OSG_ALWAYS << "Quantizing vertex attributes..." << std::endl;
+        AttributeQuantizer quantizer( normalMode );
+        QuantizeOperation qo( quantizer );
+        times.push_back( std::make_pair( std::string( "Quantize" ), pool.run( qo ) ) );
+        quantizer.apply();
+        quantizer.dump( osg::notify( osg::ALWAYS ) );
+    }
 
     osgDB::writeNodeFile( *root, outFile );
 
@@ -65,7 +603,21 @@ int main( int argc, char** argv )
     root->accept( vcmv );
     OSG_ALWAYS << "VertexCacheMissVisitor results:" << std::endl;
     OSG_ALWAYS << "  Misses: " << vcmv.misses << std::endl;
-    OSG_ALWAYS << "  Triangles: " << vcmv.misses << std::endl;
+    OSG_ALWAYS << "  Triangles: " << vcmv.triangles << std::endl;
+
+    dumpCacheReport( sim, totalBefore, totalAfter );
+    if( !cacheCSV.empty() && !writeCacheCSV( cacheCSV, sim, cacheBefore, cacheAfter ) )
+        OSG_WARN << "Can't write " << cacheCSV << std::endl;
+
+    OSG_ALWAYS << "Stage times (wall clock, " << pool.getNumThreads() << " threads):" << std::endl;
+    double total( 0. );
+    StageTimes::const_iterator it;
+    for( it = times.begin(); it != times.end(); ++it )
+    {
+        OSG_ALWAYS << "  " << it->first << ": " << it->second << " ms" << std::endl;
+        total += it->second;
+    }
+    OSG_ALWAYS << "  Total: " << total << " ms" << std::endl;
 
     return( 0 );
 }
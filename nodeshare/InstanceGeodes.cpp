@@ -0,0 +1,295 @@
+#include "InstanceGeodes.h"
+
+#if( OSGWORKS_OSG_VERSION >= 30200 )
+
+#include "FixedFunctionLighting.h"
+#include <osg/Geometry>
+#include <osg/Image>
+#include <osg/Shader>
+#include <osg/TextureBuffer>
+#include <osg/ref_ptr>
+
+#include <algorithm>
+#include <iostream>
+#include <typeinfo>
+
+
+#ifndef GL_RGBA32F_ARB
+#  define GL_RGBA32F_ARB 0x8814
+#endif
+
+
+
+namespace
+{
+
+const char* instanceVertexSource =
+    "uniform samplerBuffer instanceMatrices;\n"
+    "void main()\n"
+    "{\n"
+    "    int base = gl_InstanceID * 7;\n"
+    "    mat4 instance = mat4( texelFetchBuffer( instanceMatrices, base ),\n"
+    "        texelFetchBuffer( instanceMatrices, base + 1 ),\n"
+    "        texelFetchBuffer( instanceMatrices, base + 2 ),\n"
+    "        texelFetchBuffer( instanceMatrices, base + 3 ) );\n"
+    "    mat3 normalMatrix = mat3( texelFetchBuffer( instanceMatrices, base + 4 ).xyz,\n"
+    "        texelFetchBuffer( instanceMatrices, base + 5 ).xyz,\n"
+    "        texelFetchBuffer( instanceMatrices, base + 6 ).xyz );\n"
+    "    fixedFunctionVertex( instance * gl_Vertex, normalMatrix * gl_Normal, gl_MultiTexCoord0 );\n"
+    "}\n";
+
+// All instances are drawn by one Geometry, so its bound
+// is the union of the instance bounds.
+struct InstanceBoundCallback : public osg::Drawable::ComputeBoundingBoxCallback
+{
+    InstanceBoundCallback( const osg::BoundingBox& bound )
+      : _bound( bound )
+    {}
+
+    virtual osg::BoundingBox computeBound( const osg::Drawable& ) const
+    {
+        return( _bound );
+    }
+
+    osg::BoundingBox _bound;
+};
+
+struct TranslationLess
+{
+    TranslationLess( const std::vector< osg::Vec3 >& translations, const unsigned int axis )
+      : _translations( translations ),
+        _axis( axis )
+    {}
+
+    bool operator()( const unsigned int lhs, const unsigned int rhs ) const
+    {
+        return( _translations[ lhs ][ _axis ] < _translations[ rhs ][ _axis ] );
+    }
+
+    const std::vector< osg::Vec3 >& _translations;
+    const unsigned int _axis;
+};
+
+void splitIndices( const std::vector< osg::Vec3 >& translations, std::vector< unsigned int >& indices,
+    const unsigned int maxSize, std::vector< std::vector< unsigned int > >& chunks )
+{
+    if( indices.size() <= maxSize )
+    {
+        chunks.push_back( indices );
+        return;
+    }
+
+    // Median split on the longest axis of the instance positions.
+    osg::BoundingBox bb;
+    std::vector< unsigned int >::const_iterator it;
+    for( it = indices.begin(); it != indices.end(); ++it )
+        bb.expandBy( translations[ *it ] );
+    const osg::Vec3 extent( bb._max - bb._min );
+    unsigned int axis( ( extent.y() > extent.x() ) ? 1 : 0 );
+    if( extent.z() > extent[ axis ] )
+        axis = 2;
+
+    const unsigned int half( indices.size() / 2 );
+    std::nth_element( indices.begin(), indices.begin() + half, indices.end(),
+        TranslationLess( translations, axis ) );
+    std::vector< unsigned int > lower( indices.begin(), indices.begin() + half );
+    std::vector< unsigned int > upper( indices.begin() + half, indices.end() );
+    splitIndices( translations, lower, maxSize, chunks );
+    splitIndices( translations, upper, maxSize, chunks );
+}
+
+}
+
+
+
+InstanceGeodes::InstanceGeodes()
+    : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ),
+    _minInstances( 8 ),
+    _maxInstancesPerDraw( 1024 )
+{
+    _program = new osg::Program;
+    _program->setName( "InstanceGeodes" );
+    _program->addShader( new osg::Shader( osg::Shader::VERTEX, std::string(
+        "#version 120\n"
+        "#extension GL_EXT_gpu_shader4 : require\n"
+        "#extension GL_EXT_draw_instanced : require\n" ) +
+        FixedFunctionLighting::getVertexSource() + instanceVertexSource ) );
+    _sampler = new osg::Uniform( "instanceMatrices", (int)INSTANCE_TEXTURE_UNIT );
+}
+
+
+void InstanceGeodes::apply( osg::Geode& node )
+{
+    // A shared Geode is reached once per parent.
+    if( ( node.getNumParents() < _minInstances ) || !( _visited.insert( &node ).second ) )
+        return;
+    // The instancing shader replaces fixed-function vertex processing.
+    for( unsigned int idx=0; idx<node.getNumDrawables(); ++idx )
+        if( ( node.getDrawable( idx )->asGeometry() == NULL ) ||
+            !FixedFunctionLighting::isReproducible( *( node.getDrawable( idx ) ) ) )
+            return;
+
+    for( unsigned int idx=0; idx<node.getNumParents(); ++idx )
+    {
+        osg::MatrixTransform* mt( dynamic_cast< osg::MatrixTransform* >( node.getParent( idx ) ) );
+        if( ( mt == NULL ) || !isInstance( *mt ) )
+            continue;
+        // execute() rebuilds the parent's child list, which would lose
+        // the per-child data of an LOD, Switch or Sequence.
+        osg::Group* parent( mt->getParent( 0 ) );
+        if( typeid( *parent ) == typeid( osg::Group ) )
+            _instances[ InstanceKey( &node, parent ) ].push_back( mt );
+    }
+}
+
+bool InstanceGeodes::isInstance( const osg::MatrixTransform& mt ) const
+{
+    // Normals are transformed by the inverse.
+    osg::Matrix inverse;
+    return( inverse.invert( mt.getMatrix() ) &&
+        ( mt.getNumChildren() == 1 ) &&
+        ( mt.getNumParents() == 1 ) &&
+        ( mt.getReferenceFrame() == osg::Transform::RELATIVE_RF ) &&
+        ( mt.getStateSet() == NULL ) &&
+        ( mt.getUpdateCallback() == NULL ) &&
+        ( mt.getEventCallback() == NULL ) &&
+        ( mt.getCullCallback() == NULL ) &&
+        ( mt.getNodeMask() == 0xffffffff ) );
+}
+
+
+void InstanceGeodes::execute( osg::Node* node )
+{
+    if( node != NULL )
+        node->accept( *this );
+
+    unsigned int numTransforms( 0 ), numGeodes( 0 ), numChunks( 0 );
+    InstanceMap::const_iterator it;
+    for( it = _instances.begin(); it != _instances.end(); ++it )
+    {
+        osg::Geode* geode( it->first.first );
+        osg::Group* parent( it->first.second );
+        const TransformList& transforms( it->second );
+        if( transforms.size() < _minInstances )
+            continue;
+
+        std::vector< unsigned int > indices;
+        for( unsigned int idx=0; idx<transforms.size(); ++idx )
+            indices.push_back( idx );
+        std::vector< std::vector< unsigned int > > chunks;
+        split( transforms, indices, chunks );
+
+        // Rebuild the child list once, rather than removing
+        // each MatrixTransform individually.
+        std::set< osg::Node* > removed;
+        TransformList::const_iterator tit;
+        for( tit = transforms.begin(); tit != transforms.end(); ++tit )
+            removed.insert( tit->get() );
+        osg::Group::NodeList children;
+        for( unsigned int idx=0; idx<parent->getNumChildren(); ++idx )
+            if( removed.find( parent->getChild( idx ) ) == removed.end() )
+                children.push_back( parent->getChild( idx ) );
+        for( unsigned int idx=0; idx<chunks.size(); ++idx )
+            children.push_back( createChunk( *geode, transforms, chunks[ idx ] ) );
+
+        parent->removeChildren( 0, parent->getNumChildren() );
+        osg::Group::NodeList::const_iterator cit;
+        for( cit = children.begin(); cit != children.end(); ++cit )
+            parent->addChild( cit->get() );
+
+        numTransforms += transforms.size();
+        ++numGeodes;
+        numChunks += chunks.size();
+    }
+    _instances.clear();
+    _visited.clear();
+
+    std::cout << "Instanced " << numTransforms << " MatrixTransforms of " << numGeodes <<
+        " Geodes into " << numChunks << " instanced Geodes." << std::endl;
+}
+
+void InstanceGeodes::split( const TransformList& transforms, std::vector< unsigned int >& indices,
+    std::vector< std::vector< unsigned int > >& chunks ) const
+{
+    std::vector< osg::Vec3 > translations;
+    TransformList::const_iterator it;
+    for( it = transforms.begin(); it != transforms.end(); ++it )
+        translations.push_back( (*it)->getMatrix().getTrans() );
+    splitIndices( translations, indices, osg::maximum< unsigned int >( _maxInstancesPerDraw, 1 ), chunks );
+}
+
+osg::Geode* InstanceGeodes::createChunk( osg::Geode& geode, const TransformList& transforms,
+    const std::vector< unsigned int >& chunk )
+{
+    const unsigned int numInstances( chunk.size() );
+
+    // Seven texels per instance. The first four are the OSG matrix
+    // rows, which are GLSL mat4 columns. The last three are the columns
+    // of the upper 3x3 of the inverse, which transforms normals
+    // correctly for mirrored and non-uniformly scaled instances.
+    osg::Image* image( new osg::Image );
+    image->allocateImage( numInstances * 7, 1, 1, GL_RGBA, GL_FLOAT );
+    image->setInternalTextureFormat( GL_RGBA32F_ARB );
+    float* data( reinterpret_cast< float* >( image->data() ) );
+    unsigned int idx;
+    for( idx=0; idx<numInstances; ++idx )
+    {
+        const osg::Matrix& m( transforms[ chunk[ idx ] ]->getMatrix() );
+        unsigned int row, col;
+        for( row=0; row<4; ++row )
+            for( col=0; col<4; ++col )
+                *data++ = m( row, col );
+
+        const osg::Matrix inverse( osg::Matrix::inverse( m ) );
+        for( col=0; col<3; ++col )
+        {
+            for( row=0; row<3; ++row )
+                *data++ = inverse( row, col );
+            *data++ = 0.f;
+        }
+    }
+    osg::TextureBuffer* tbo( new osg::TextureBuffer );
+    tbo->setImage( image );
+    tbo->setInternalFormat( GL_RGBA32F_ARB );
+
+    osg::Geode* instanced( new osg::Geode );
+    instanced->setName( geode.getName() );
+    osg::StateSet* stateSet( ( geode.getStateSet() != NULL ) ?
+        new osg::StateSet( *( geode.getStateSet() ) ) : new osg::StateSet );
+    stateSet->setTextureAttribute( INSTANCE_TEXTURE_UNIT, tbo );
+    stateSet->setAttribute( _program.get() );
+    stateSet->addUniform( _sampler.get() );
+    instanced->setStateSet( stateSet );
+
+    for( idx=0; idx<geode.getNumDrawables(); ++idx )
+    {
+        const osg::Geometry* geom( geode.getDrawable( idx )->asGeometry() );
+        // Arrays are shared; primitive sets are copied to
+        // carry this chunk's instance count.
+        osg::Geometry* copy( new osg::Geometry( *geom, osg::CopyOp::DEEP_COPY_PRIMITIVES ) );
+        for( unsigned int pdx=0; pdx<copy->getNumPrimitiveSets(); ++pdx )
+            copy->getPrimitiveSet( pdx )->setNumInstances( numInstances );
+        copy->setUseDisplayList( false );
+        copy->setUseVertexBufferObjects( true );
+
+        const osg::BoundingBox& local( geom->getBoundingBox() );
+        osg::BoundingBox bound;
+        if( local.valid() )
+        {
+            std::vector< unsigned int >::const_iterator it;
+            for( it = chunk.begin(); it != chunk.end(); ++it )
+            {
+                const osg::Matrix& m( transforms[ *it ]->getMatrix() );
+                for( unsigned int corner=0; corner<8; ++corner )
+                    bound.expandBy( local.corner( corner ) * m );
+            }
+        }
+        copy->setComputeBoundingBoxCallback( new InstanceBoundCallback( bound ) );
+        copy->dirtyBound();
+
+        instanced->addDrawable( copy );
+    }
+    return( instanced );
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef __INSTANCE_GEODES_H__
+#define __INSTANCE_GEODES_H__ 1
+
+#include <osgwTools/Version.h>
+
+// Requires osg::TextureBuffer and PrimitiveSet::setNumInstances().
+#if( OSGWORKS_OSG_VERSION >= 30200 )
+
+#include <osg/NodeVisitor>
+#include <osg/Geode>
+#include <osg/MatrixTransform>
+#include <osg/Program>
+#include <osg/Uniform>
+
+#include <map>
+#include <set>
+#include <vector>
+
+
+
+/** InstanceGeodes InstanceGeodes.h
+\brief Convert a shared Geode under many MatrixTransforms to hardware instancing.
+\details Run after ShareNodes. The traversal finds Geodes with at least
+minInstances MatrixTransform parents that share a parent, which must be a
+plain osg::Group rather than a subclass with per-child data. Each such
+MatrixTransform must have only that one child, a single parent, a relative
+reference frame, and no StateSet or callbacks. During execute(), those
+MatrixTransforms are removed and replaced with Geodes that draw every
+instance in one call per Geometry.
+
+Each instance's matrix and normal matrix (the upper 3x3 of its inverse
+transpose) are stored as seven RGBA32F texels in a TextureBuffer on unit
+INSTANCE_TEXTURE_UNIT, so mirrored and non-uniformly scaled instances are
+lit correctly. A vertex shader fetches them by gl_InstanceID, and lights
+and transforms each instance with FixedFunctionLighting. Geodes with a
+Drawable whose inherited state FixedFunctionLighting can't reproduce, and
+MatrixTransforms with a singular matrix, are left alone.
+
+Only the serializer-based formats, such as .osgb, store the TextureBuffer
+image; write the result to one of them.
+
+To preserve culling, instances are split into spatially coherent chunks
+of at most maxInstancesPerDraw. Each chunk is a Geode whose Geometries
+are bounded by the union of their instances' transformed bounding boxes.
+**/
+class InstanceGeodes : public osg::NodeVisitor
+{
+public:
+    InstanceGeodes();
+
+    /** Fewer MatrixTransforms under one parent are left alone. Default: 8. */
+    void setMinInstances( unsigned int minInstances ) { _minInstances = minInstances; }
+    /** Default: 1024. */
+    void setMaxInstancesPerDraw( unsigned int maxInstances ) { _maxInstancesPerDraw = maxInstances; }
+
+    enum { INSTANCE_TEXTURE_UNIT = 7 };
+
+    void execute( osg::Node* node=NULL );
+
+    virtual void apply( osg::Geode& node );
+
+protected:
+    typedef std::vector< osg::ref_ptr< osg::MatrixTransform > > TransformList;
+    typedef std::pair< osg::Geode*, osg::Group* > InstanceKey;
+    typedef std::map< InstanceKey, TransformList > InstanceMap;
+    InstanceMap _instances;
+    std::set< osg::Geode* > _visited;
+
+    bool isInstance( const osg::MatrixTransform& mt ) const;
+    osg::Geode* createChunk( osg::Geode& geode, const TransformList& transforms,
+        const std::vector< unsigned int >& chunk );
+    void split( const TransformList& transforms, std::vector< unsigned int >& indices,
+        std::vector< std::vector< unsigned int > >& chunks ) const;
+
+    unsigned int _minInstances;
+    unsigned int _maxInstancesPerDraw;
+    osg::ref_ptr< osg::Program > _program;
+    osg::ref_ptr< osg::Uniform > _sampler;
+};
+
+
+#endif
+
+// __INSTANCE_GEODES_H__
+#endif
@@ -1,21 +1,283 @@
 #include "ShareNodes.h"
 #include <osg/MatrixTransform>
 #include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/StateSet>
+#include <osg/Notify>
 #include <osgwTools/NodeUtils.h>
+#include <osgwTools/Version.h>
+#if( OSGWORKS_OSG_VERSION >= 30100 )
+#  include <osg/UserDataContainer>
+#endif
 #include <osg/ref_ptr>
 
 #include <iostream>
+#include <cstring>
+
+
+
+namespace
+{
+
+typedef unsigned long long Hash;
+
+// FNV-1a.
+Hash hashBytes( Hash hash, const void* data, unsigned int size )
+{
+    const unsigned char* bytes( static_cast< const unsigned char* >( data ) );
+    for( unsigned int idx=0; idx<size; ++idx )
+    {
+        hash ^= bytes[ idx ];
+        hash *= 1099511628211ULL;
+    }
+    return( hash );
+}
+Hash hashValue( Hash hash, unsigned int value )
+{
+    return( hashBytes( hash, &value, sizeof( value ) ) );
+}
+
+Hash hashArray( Hash hash, const osg::Array* array )
+{
+    if( array == NULL )
+        return( hashValue( hash, 0 ) );
+    hash = hashValue( hash, array->getType() + 1 );
+    hash = hashValue( hash, array->getNumElements() );
+    if( array->getDataPointer() != NULL )
+        hash = hashBytes( hash, array->getDataPointer(), array->getTotalDataSize() );
+    return( hash );
+}
+bool equalArrays( const osg::Array* lhs, const osg::Array* rhs )
+{
+    if( lhs == rhs )
+        return( true );
+    if( ( lhs == NULL ) || ( rhs == NULL ) ||
+        ( lhs->getType() != rhs->getType() ) ||
+        ( lhs->getNumElements() != rhs->getNumElements() ) ||
+        ( lhs->getNormalize() != rhs->getNormalize() ) ||
+        ( lhs->getTotalDataSize() != rhs->getTotalDataSize() ) )
+        return( false );
+    if( ( lhs->getDataPointer() == NULL ) || ( rhs->getDataPointer() == NULL ) )
+        return( lhs->getDataPointer() == rhs->getDataPointer() );
+    return( memcmp( lhs->getDataPointer(), rhs->getDataPointer(), lhs->getTotalDataSize() ) == 0 );
+}
+
+Hash hashPrimitiveSet( Hash hash, const osg::PrimitiveSet* prim )
+{
+    hash = hashValue( hash, prim->getType() );
+    hash = hashValue( hash, prim->getMode() );
+    hash = hashValue( hash, prim->getNumInstances() );
+    const unsigned int numIndices( prim->getNumIndices() );
+    hash = hashValue( hash, numIndices );
+    for( unsigned int idx=0; idx<numIndices; ++idx )
+        hash = hashValue( hash, prim->index( idx ) );
+    return( hash );
+}
+bool equalPrimitiveSets( const osg::PrimitiveSet* lhs, const osg::PrimitiveSet* rhs )
+{
+    if( lhs == rhs )
+        return( true );
+    if( ( lhs->getType() != rhs->getType() ) ||
+        ( lhs->getMode() != rhs->getMode() ) ||
+        ( lhs->getNumInstances() != rhs->getNumInstances() ) ||
+        ( lhs->getNumIndices() != rhs->getNumIndices() ) )
+        return( false );
+    if( lhs->getType() == osg::PrimitiveSet::DrawArrayLengthsPrimitiveType )
+    {
+        // Same indices, but possibly split into different primitives.
+        const osg::DrawArrayLengths* lhsLengths( static_cast< const osg::DrawArrayLengths* >( lhs ) );
+        const osg::DrawArrayLengths* rhsLengths( static_cast< const osg::DrawArrayLengths* >( rhs ) );
+        if( *lhsLengths != *rhsLengths )
+            return( false );
+    }
+    for( unsigned int idx=0; idx<lhs->getNumIndices(); ++idx )
+        if( lhs->index( idx ) != rhs->index( idx ) )
+            return( false );
+    return( true );
+}
+
+// StateSet::compare() decides equality. The hash only uses
+// the list sizes, which equal StateSets always share.
+Hash hashStateSet( Hash hash, const osg::StateSet* stateSet )
+{
+    if( stateSet == NULL )
+        return( hashValue( hash, 0 ) );
+    hash = hashValue( hash, stateSet->getAttributeList().size() + 1 );
+    hash = hashValue( hash, stateSet->getModeList().size() );
+    hash = hashValue( hash, stateSet->getTextureAttributeList().size() );
+    hash = hashValue( hash, stateSet->getTextureModeList().size() );
+    hash = hashValue( hash, stateSet->getUniformList().size() );
+    return( hash );
+}
+bool equalStateSets( const osg::StateSet* lhs, const osg::StateSet* rhs )
+{
+    if( lhs == rhs )
+        return( true );
+    if( ( lhs == NULL ) || ( rhs == NULL ) )
+        return( false );
+    return( lhs->compare( *rhs, true ) == 0 );
+}
+
+// The shared object keeps only the primary's descriptions, user data
+// and callbacks, so duplicates must match in those too. Names don't
+// matter: identical parts usually have unique names.
+bool equalUserData( const osg::Object& lhs, const osg::Object& rhs )
+{
+    if( lhs.getUserData() != rhs.getUserData() )
+        return( false );
+#if( OSGWORKS_OSG_VERSION >= 30100 )
+    // User values can't be compared generically, so objects with
+    // their own are never equal. Descriptions are compared separately.
+    const osg::UserDataContainer* lhsContainer( lhs.getUserDataContainer() );
+    const osg::UserDataContainer* rhsContainer( rhs.getUserDataContainer() );
+    if( ( lhsContainer != rhsContainer ) &&
+        ( ( ( lhsContainer != NULL ) && ( lhsContainer->getNumUserObjects() > 0 ) ) ||
+        ( ( rhsContainer != NULL ) && ( rhsContainer->getNumUserObjects() > 0 ) ) ) )
+        return( false );
+#endif
+    return( true );
+}
+bool equalNodeData( const osg::Node& lhs, const osg::Node& rhs )
+{
+    return( equalUserData( lhs, rhs ) &&
+        ( lhs.getDescriptions() == rhs.getDescriptions() ) &&
+        ( lhs.getUpdateCallback() == rhs.getUpdateCallback() ) &&
+        ( lhs.getEventCallback() == rhs.getEventCallback() ) &&
+        ( lhs.getCullCallback() == rhs.getCullCallback() ) &&
+        ( lhs.getComputeBoundingSphereCallback() == rhs.getComputeBoundingSphereCallback() ) &&
+        ( lhs.getCullingActive() == rhs.getCullingActive() ) );
+}
+bool equalDrawableData( const osg::Drawable& lhs, const osg::Drawable& rhs )
+{
+    return( equalUserData( lhs, rhs ) &&
+        ( lhs.getUpdateCallback() == rhs.getUpdateCallback() ) &&
+        ( lhs.getEventCallback() == rhs.getEventCallback() ) &&
+        ( lhs.getCullCallback() == rhs.getCullCallback() ) &&
+        ( lhs.getDrawCallback() == rhs.getDrawCallback() ) &&
+        ( lhs.getComputeBoundingBoxCallback() == rhs.getComputeBoundingBoxCallback() ) );
+}
+
+Hash hashGeometry( const osg::Geometry& geom )
+{
+    Hash hash( 14695981039346656037ULL );
+    hash = hashArray( hash, geom.getVertexArray() );
+    hash = hashArray( hash, geom.getNormalArray() );
+    hash = hashValue( hash, geom.getNormalBinding() );
+    hash = hashArray( hash, geom.getColorArray() );
+    hash = hashValue( hash, geom.getColorBinding() );
+    hash = hashArray( hash, geom.getSecondaryColorArray() );
+    hash = hashValue( hash, geom.getSecondaryColorBinding() );
+    hash = hashArray( hash, geom.getFogCoordArray() );
+    hash = hashValue( hash, geom.getFogCoordBinding() );
+    unsigned int idx;
+    hash = hashValue( hash, geom.getNumTexCoordArrays() );
+    for( idx=0; idx<geom.getNumTexCoordArrays(); ++idx )
+        hash = hashArray( hash, geom.getTexCoordArray( idx ) );
+    hash = hashValue( hash, geom.getNumVertexAttribArrays() );
+    for( idx=0; idx<geom.getNumVertexAttribArrays(); ++idx )
+    {
+        hash = hashArray( hash, geom.getVertexAttribArray( idx ) );
+        hash = hashValue( hash, geom.getVertexAttribBinding( idx ) );
+    }
+    hash = hashValue( hash, geom.getNumPrimitiveSets() );
+    for( idx=0; idx<geom.getNumPrimitiveSets(); ++idx )
+        hash = hashPrimitiveSet( hash, geom.getPrimitiveSet( idx ) );
+    return( hashStateSet( hash, geom.getStateSet() ) );
+}
+bool equalGeometries( const osg::Geometry& lhs, const osg::Geometry& rhs )
+{
+    if( !equalDrawableData( lhs, rhs ) ||
+        !equalArrays( lhs.getVertexArray(), rhs.getVertexArray() ) ||
+        !equalArrays( lhs.getNormalArray(), rhs.getNormalArray() ) ||
+        ( lhs.getNormalBinding() != rhs.getNormalBinding() ) ||
+        !equalArrays( lhs.getColorArray(), rhs.getColorArray() ) ||
+        ( lhs.getColorBinding() != rhs.getColorBinding() ) ||
+        !equalArrays( lhs.getSecondaryColorArray(), rhs.getSecondaryColorArray() ) ||
+        ( lhs.getSecondaryColorBinding() != rhs.getSecondaryColorBinding() ) ||
+        !equalArrays( lhs.getFogCoordArray(), rhs.getFogCoordArray() ) ||
+        ( lhs.getFogCoordBinding() != rhs.getFogCoordBinding() ) ||
+        ( lhs.getNumTexCoordArrays() != rhs.getNumTexCoordArrays() ) ||
+        ( lhs.getNumVertexAttribArrays() != rhs.getNumVertexAttribArrays() ) ||
+        ( lhs.getNumPrimitiveSets() != rhs.getNumPrimitiveSets() ) )
+        return( false );
+    unsigned int idx;
+    for( idx=0; idx<lhs.getNumTexCoordArrays(); ++idx )
+        if( !equalArrays( lhs.getTexCoordArray( idx ), rhs.getTexCoordArray( idx ) ) )
+            return( false );
+    for( idx=0; idx<lhs.getNumVertexAttribArrays(); ++idx )
+        if( !equalArrays( lhs.getVertexAttribArray( idx ), rhs.getVertexAttribArray( idx ) ) ||
+            ( lhs.getVertexAttribBinding( idx ) != rhs.getVertexAttribBinding( idx ) ) )
+            return( false );
+    for( idx=0; idx<lhs.getNumPrimitiveSets(); ++idx )
+        if( !equalPrimitiveSets( lhs.getPrimitiveSet( idx ), rhs.getPrimitiveSet( idx ) ) )
+            return( false );
+    return( equalStateSets( lhs.getStateSet(), rhs.getStateSet() ) );
+}
+
+// Bytes of unique array and primitive set data in a scene graph.
+class ByteCounter : public osg::NodeVisitor
+{
+public:
+    ByteCounter()
+      : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ),
+        _bytes( 0 )
+    {}
+
+    virtual void apply( osg::Geode& node )
+    {
+        for( unsigned int idx=0; idx<node.getNumDrawables(); ++idx )
+        {
+            const osg::Geometry* geom( node.getDrawable( idx )->asGeometry() );
+            if( ( geom == NULL ) || !( _geometries.insert( geom ).second ) )
+                continue;
+            count( geom->getVertexArray() );
+            count( geom->getNormalArray() );
+            count( geom->getColorArray() );
+            count( geom->getSecondaryColorArray() );
+            count( geom->getFogCoordArray() );
+            unsigned int jdx;
+            for( jdx=0; jdx<geom->getNumTexCoordArrays(); ++jdx )
+                count( geom->getTexCoordArray( jdx ) );
+            for( jdx=0; jdx<geom->getNumVertexAttribArrays(); ++jdx )
+                count( geom->getVertexAttribArray( jdx ) );
+            for( jdx=0; jdx<geom->getNumPrimitiveSets(); ++jdx )
+                count( geom->getPrimitiveSet( jdx ) );
+        }
+        traverse( node );
+    }
+
+    void count( const osg::BufferData* data )
+    {
+        if( ( data != NULL ) && _data.insert( data ).second )
+            _bytes += data->getTotalDataSize();
+    }
+
+    unsigned long long _bytes;
+    std::set< const osg::Geometry* > _geometries;
+    std::set< const osg::BufferData* > _data;
+};
+
+unsigned long long countBytes( osg::Node* node )
+{
+    ByteCounter bc;
+    node->accept( bc );
+    return( bc._bytes );
+}
+
+}
 
 
 ShareNodes::ShareNodes()
-    : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN )
+    : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ),
+    _mode( SHARE_BY_NAME ),
+    _droppedNames( 0 )
 {
 }
 
 
 void ShareNodes::apply( osg::Node& node )
 {
-    if( !( node.getName().empty() ) )
+    if( ( _mode == SHARE_BY_NAME ) && !( node.getName().empty() ) )
     {
         NodeSet& nodeSet( _names[ node.getName() ] );
         nodeSet.insert( &node );
@@ -29,15 +291,27 @@ void ShareNodes::apply( osg::MatrixTransform& node )
 }
 void ShareNodes::apply( osg::Geode& node )
 {
+    if( ( _mode == SHARE_BY_CONTENT ) && _geodeSet.insert( &node ).second )
+        _geodes.push_back( &node );
     traverse( node );
 }
 
 
 void ShareNodes::execute( osg::Node* node )
 {
+    if( _mode == SHARE_BY_CONTENT )
+    {
+        shareByContent( node );
+        return;
+    }
+
     if( node != NULL )
         node->accept( *this );
+    shareByName();
+}
 
+void ShareNodes::shareByName()
+{
     std::cout << "Found " << _names.size() << " non-NULL names." << std::endl;
     if( _names.empty() )
         return;
@@ -66,3 +340,157 @@ void ShareNodes::execute( osg::Node* node )
         }
     }
 }
+
+
+void ShareNodes::shareByContent( osg::Node* node )
+{
+    if( node == NULL )
+        return;
+    const unsigned long long bytesIn( countBytes( node ) );
+    node->accept( *this );
+
+    const unsigned int numGeometries( shareGeometries() );
+    const unsigned int numGeodes( shareGeodes() );
+    _geodes.clear();
+    _geodeSet.clear();
+
+    const unsigned long long bytesOut( countBytes( node ) );
+    std::cout << "Shared " << numGeometries << " duplicate Geometries and " <<
+        numGeodes << " duplicate Geodes." << std::endl;
+    std::cout << "Array and primitive set bytes: " << bytesIn << " -> " << bytesOut <<
+        ", saved " << bytesIn - bytesOut << "." << std::endl;
+    if( _droppedNames > 0 )
+        std::cout << "Dropped " << _droppedNames << " names of shared duplicates." << std::endl;
+}
+
+void ShareNodes::dropName( const osg::Object& primary, const osg::Object& duplicate )
+{
+    if( duplicate.getName().empty() || ( duplicate.getName() == primary.getName() ) )
+        return;
+    OSG_INFO << "ShareNodes: \"" << duplicate.getName() << "\" shared as \"" <<
+        primary.getName() << "\"." << std::endl;
+    ++_droppedNames;
+}
+
+unsigned int ShareNodes::shareGeometries()
+{
+    // Unique Geometries by fingerprint, in traversal order.
+    typedef std::vector< osg::Geometry* > GeometryList;
+    typedef std::map< Hash, GeometryList > HashMap;
+    HashMap candidates;
+    std::set< osg::Geometry* > visited;
+    std::vector< osg::ref_ptr< osg::Geode > >::const_iterator it;
+    for( it = _geodes.begin(); it != _geodes.end(); ++it )
+    {
+        osg::Geode* geode( it->get() );
+        for( unsigned int idx=0; idx<geode->getNumDrawables(); ++idx )
+        {
+            osg::Geometry* geom( geode->getDrawable( idx )->asGeometry() );
+            if( ( geom != NULL ) && visited.insert( geom ).second )
+                candidates[ hashGeometry( *geom ) ].push_back( geom );
+        }
+    }
+
+    unsigned int numShared( 0 );
+    HashMap::const_iterator hit;
+    for( hit = candidates.begin(); hit != candidates.end(); ++hit )
+    {
+        const GeometryList& geometries( hit->second );
+        if( geometries.size() < 2 )
+            continue;
+
+        // Each Geometry is shared with the first equal one before it.
+        GeometryList primaries;
+        GeometryList::const_iterator git;
+        for( git = geometries.begin(); git != geometries.end(); ++git )
+        {
+            osg::ref_ptr< osg::Geometry > geom( *git );
+            GeometryList::const_iterator pit;
+            for( pit = primaries.begin(); pit != primaries.end(); ++pit )
+                if( equalGeometries( **pit, *geom ) )
+                    break;
+            if( pit == primaries.end() )
+            {
+                primaries.push_back( geom.get() );
+                continue;
+            }
+
+            // Copy the parent list; replaceDrawable() modifies it.
+            std::vector< osg::Node* > parents;
+            for( unsigned int idx=0; idx<geom->getNumParents(); ++idx )
+                parents.push_back( geom->getParent( idx ) );
+            std::vector< osg::Node* >::const_iterator nit;
+            for( nit = parents.begin(); nit != parents.end(); ++nit )
+            {
+                osg::Geode* geode( (*nit)->asGeode() );
+                if( geode != NULL )
+                    geode->replaceDrawable( geom.get(), *pit );
+            }
+            dropName( **pit, *geom );
+            ++numShared;
+        }
+    }
+    return( numShared );
+}
+
+unsigned int ShareNodes::shareGeodes()
+{
+    // With Geometries shared, equal Geodes have identical Drawable pointers.
+    typedef std::vector< osg::Geode* > GeodeList;
+    typedef std::map< Hash, GeodeList > HashMap;
+    HashMap candidates;
+    std::vector< osg::ref_ptr< osg::Geode > >::const_iterator it;
+    for( it = _geodes.begin(); it != _geodes.end(); ++it )
+    {
+        osg::Geode* geode( it->get() );
+        if( geode->getNumDrawables() == 0 )
+            continue;
+        Hash hash( 14695981039346656037ULL );
+        for( unsigned int idx=0; idx<geode->getNumDrawables(); ++idx )
+        {
+            const osg::Drawable* draw( geode->getDrawable( idx ) );
+            hash = hashBytes( hash, &draw, sizeof( draw ) );
+        }
+        hash = hashValue( hash, geode->getNodeMask() );
+        candidates[ hashStateSet( hash, geode->getStateSet() ) ].push_back( geode );
+    }
+
+    unsigned int numShared( 0 );
+    HashMap::const_iterator hit;
+    for( hit = candidates.begin(); hit != candidates.end(); ++hit )
+    {
+        const GeodeList& geodes( hit->second );
+        GeodeList primaries;
+        GeodeList::const_iterator git;
+        for( git = geodes.begin(); git != geodes.end(); ++git )
+        {
+            osg::ref_ptr< osg::Geode > geode( *git );
+            GeodeList::const_iterator pit;
+            for( pit = primaries.begin(); pit != primaries.end(); ++pit )
+            {
+                const osg::Geode* primary( *pit );
+                if( ( primary->getNumDrawables() != geode->getNumDrawables() ) ||
+                    ( primary->getNodeMask() != geode->getNodeMask() ) ||
+                    !equalNodeData( *primary, *geode ) ||
+                    !equalStateSets( primary->getStateSet(), geode->getStateSet() ) )
+                    continue;
+                unsigned int idx;
+                for( idx=0; idx<geode->getNumDrawables(); ++idx )
+                    if( primary->getDrawable( idx ) != geode->getDrawable( idx ) )
+                        break;
+                if( idx == geode->getNumDrawables() )
+                    break;
+            }
+            if( pit == primaries.end() )
+            {
+                primaries.push_back( geode.get() );
+                continue;
+            }
+
+            osgwTools::replaceSubgraph( *pit, geode.get() );
+            dropName( **pit, *geode );
+            ++numShared;
+        }
+    }
+    return( numShared );
+}
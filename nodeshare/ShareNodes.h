@@ -3,10 +3,12 @@
 
 
 #include <osg/NodeVisitor>
+#include <osg/Geode>
 
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
 
 
 
@@ -15,24 +17,56 @@
 \details Traverse the scene graph to build a map of node names
 to std::list of nodes with those names. During the execute() call,
 keep only once instance of each named subgraph and share it as
-appropriate. **/
+appropriate.
+
+In SHARE_BY_CONTENT mode, names don't identify duplicates. Instead,
+Geometries are fingerprinted by their arrays, bindings, primitive sets,
+and StateSets. Candidates with matching fingerprints are confirmed with a
+full compare, and duplicates are replaced by a shared reference. Then
+Geodes with the same (now shared) Drawables, node mask and equal
+StateSets are shared the same way. Since a shared object keeps only one
+description list, user data and set of callbacks, duplicates must also
+match in those, and objects with user values are never shared. Names
+don't prevent sharing; the shared object keeps the first one's name.
+execute() reports the array and primitive set bytes saved, and how many
+duplicates' names were dropped. Each one is listed at INFO level. **/
 class ShareNodes : public osg::NodeVisitor
 {
 public:
     ShareNodes();
 
+    enum Mode {
+        SHARE_BY_NAME,
+        SHARE_BY_CONTENT
+    };
+    /** Set before traversal. Default: SHARE_BY_NAME. */
+    void setMode( Mode mode ) { _mode = mode; }
+
     void execute( osg::Node* node=NULL );
 
     virtual void apply( osg::Node& node );
     /* MatrixTransforms will not be considered for sharing. */
     virtual void apply( osg::MatrixTransform& node );
-    /* Geodes will not be considered for sharing. */
+    /* Geodes will not be considered for sharing by name. */
     virtual void apply( osg::Geode& node );
 
 protected:
+    void shareByName();
+    void shareByContent( osg::Node* node );
+    unsigned int shareGeometries();
+    unsigned int shareGeodes();
+    void dropName( const osg::Object& primary, const osg::Object& duplicate );
+
+    Mode _mode;
+    unsigned int _droppedNames;
+
     typedef std::set< osg::ref_ptr< osg::Node > > NodeSet;
     typedef std::map< std::string, NodeSet > NameMap;
     NameMap _names;
+
+    // Unique Geodes, in traversal order.
+    std::vector< osg::ref_ptr< osg::Geode > > _geodes;
+    std::set< osg::Geode* > _geodeSet;
 };
 
 
@@ -2,29 +2,66 @@
 
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
+#include <osgDB/FileNameUtils>
+#include <osg/ArgumentParser>
 
 #include "ShareNodes.h"
+#include "InstanceGeodes.h"
 
 #include <iostream>
 
 
 int main( int argc, char** argv )
 {
+    osg::ArgumentParser arguments( &argc, argv );
+    // Share by Geometry and StateSet content instead of by node name.
+    const bool content( arguments.read( "--content" ) );
+    // Draw shared Geodes under many MatrixTransforms with hardware instancing.
+    const bool instance( arguments.read( "--instance" ) );
+
     if( argc < 2 )
     {
-        std::cerr << "nodeshare <infile> [<outfile>]" << std::endl;
+        std::cerr << "nodeshare [--content] [--instance] <infile> [<outfile>]" << std::endl;
         exit( 1 );
     }
 
 
+    std::string filename = instance ? "output.osgb" : "output.ive";
+    if( argc > 2 )
+        filename = argv[ 2 ];
+    if( instance )
+    {
+#if( OSGWORKS_OSG_VERSION >= 30200 )
+        // The instance matrices live only in a TextureBuffer image, which
+        // older formats such as .ive don't store. Without them, every
+        // instance would draw at the origin.
+        if( osgDB::getLowerCaseFileExtension( filename ) != "osgb" )
+        {
+            std::cerr << "nodeshare: --instance requires .osgb output." << std::endl;
+            exit( 1 );
+        }
+#else
+        std::cerr << "nodeshare: --instance requires OSG 3.2 or later." << std::endl;
+        exit( 1 );
+#endif
+    }
+
+
     osg::ref_ptr< osg::Node > scene( osgDB::readNodeFile( argv[ 1 ] ) );
 
     ShareNodes snv;
+    if( content )
+        snv.setMode( ShareNodes::SHARE_BY_CONTENT );
     snv.execute( scene.get() );
 
-    std::string filename = "output.ive";
-    if( argc > 2 )
-        filename = argv[ 2 ];
+#if( OSGWORKS_OSG_VERSION >= 30200 )
+    if( instance )
+    {
+        InstanceGeodes igv;
+        igv.execute( scene.get() );
+    }
+#endif
+
     osgDB::writeNodeFile( *scene, filename );
     return 0;
 }
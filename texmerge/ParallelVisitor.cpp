@@ -21,16 +21,177 @@
 #include "ParallelVisitor.h"
 #include <osg/Node>
 #include <osg/Group>
+#include <osg/Geode>
+#include <osg/Geometry>
 #include <osg/Notify>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/ScopedLock>
+
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
 
 #include <stdlib.h>
+#include <math.h>
+#include <deque>
+
+
+
+namespace
+{
+
+// MATCH_STRUCTURE identity of a child node.
+struct ChildKey
+{
+    ChildKey( const osg::Node& node, const double tolerance, const bool useBounds )
+      : _name( node.getName() ),
+        _className( node.className() ),
+        _numVertices( 0 )
+    {
+        for( unsigned int idx=0; idx<6; ++idx )
+            _bound[ idx ] = 0.;
+        if( !useBounds )
+            return;
+
+        const osg::Geode* geode( node.asGeode() );
+        if( geode != NULL )
+        {
+            for( unsigned int idx=0; idx<geode->getNumDrawables(); ++idx )
+            {
+                const osg::Geometry* geom( geode->getDrawable( idx )->asGeometry() );
+                if( ( geom != NULL ) && ( geom->getVertexArray() != NULL ) )
+                    _numVertices += geom->getVertexArray()->getNumElements();
+            }
+            const osg::BoundingBox& bb( geode->getBoundingBox() );
+            if( bb.valid() )
+            {
+                _bound[ 0 ] = quantize( bb.xMin(), tolerance );
+                _bound[ 1 ] = quantize( bb.yMin(), tolerance );
+                _bound[ 2 ] = quantize( bb.zMin(), tolerance );
+                _bound[ 3 ] = quantize( bb.xMax(), tolerance );
+                _bound[ 4 ] = quantize( bb.yMax(), tolerance );
+                _bound[ 5 ] = quantize( bb.zMax(), tolerance );
+            }
+        }
+        else
+        {
+            const osg::BoundingSphere& bs( node.getBound() );
+            if( bs.valid() )
+            {
+                _bound[ 0 ] = quantize( bs.center().x(), tolerance );
+                _bound[ 1 ] = quantize( bs.center().y(), tolerance );
+                _bound[ 2 ] = quantize( bs.center().z(), tolerance );
+                _bound[ 3 ] = quantize( bs.radius(), tolerance );
+            }
+        }
+    }
+
+    static double quantize( const double value, const double tolerance )
+    {
+        return( floor( value / tolerance + .5 ) );
+    }
+
+    bool operator==( const ChildKey& rhs ) const
+    {
+        for( unsigned int idx=0; idx<6; ++idx )
+            if( _bound[ idx ] != rhs._bound[ idx ] )
+                return( false );
+        return( ( _numVertices == rhs._numVertices ) &&
+            ( _name == rhs._name ) && ( _className == rhs._className ) );
+    }
+
+    std::string _name;
+    std::string _className;
+    unsigned int _numVertices;
+    double _bound[ 6 ];
+};
+
+std::size_t hash_value( const ChildKey& key )
+{
+    std::size_t seed( 0 );
+    boost::hash_combine( seed, key._name );
+    boost::hash_combine( seed, key._className );
+    boost::hash_combine( seed, key._numVertices );
+    for( unsigned int idx=0; idx<6; ++idx )
+        boost::hash_combine( seed, key._bound[ idx ] );
+    return( seed );
+}
+
+// B's unmatched child indices for each key, in ascending order.
+typedef boost::unordered_map< ChildKey, std::deque< unsigned int >, boost::hash< ChildKey > > ChildMap;
+
+// Pair each unmatched child of A with an unmatched child of B that has
+// the same key, preferring B's children in their original order.
+void matchKeys( osg::Group* grpA, osg::Group* grpB, std::vector< bool >& matchedA,
+    std::vector< bool >& matchedB, ParallelVisitor::NodePairList& children,
+    const double tolerance, const bool useBounds )
+{
+    ChildMap childMap;
+    unsigned int idx;
+    for( idx=0; idx<grpB->getNumChildren(); ++idx )
+    {
+        if( !matchedB[ idx ] )
+            childMap[ ChildKey( *( grpB->getChild( idx ) ), tolerance, useBounds ) ].push_back( idx );
+    }
+    if( childMap.empty() )
+        return;
+
+    for( idx=0; idx<grpA->getNumChildren(); ++idx )
+    {
+        if( matchedA[ idx ] )
+            continue;
+        const ChildKey key( *( grpA->getChild( idx ) ), tolerance, useBounds );
+        ChildMap::iterator it( childMap.find( key ) );
+        if( ( it == childMap.end() ) || it->second.empty() )
+            continue;
+
+        // The front of the queue is the lowest remaining index
+        // among equal keys, so each lookup is constant time.
+        const unsigned int idxB( it->second.front() );
+        it->second.pop_front();
+
+        children.push_back( ParallelVisitor::NodePair( grpA->getChild( idx ), grpB->getChild( idxB ) ) );
+        matchedA[ idx ] = matchedB[ idxB ] = true;
+    }
+}
+
+}
+
+
+class ParallelVisitorThread : public OpenThreads::Thread
+{
+public:
+    ParallelVisitorThread( ParallelVisitor& pv, const ParallelVisitor::NodePairList& work,
+            OpenThreads::Atomic& next, ParallelVisitor::NodePairList& deferred )
+      : _pv( pv ),
+        _work( work ),
+        _next( next ),
+        _deferred( deferred )
+    {}
+
+    virtual void run()
+    {
+        unsigned int idx;
+        while( ( idx = ( ++_next ) - 1 ) < _work.size() )
+            _pv.recurseTraverse( _work[ idx ].first.get(), _work[ idx ].second.get(), &_deferred );
+    }
+
+protected:
+    ParallelVisitor& _pv;
+    const ParallelVisitor::NodePairList& _work;
+    OpenThreads::Atomic& _next;
+    ParallelVisitor::NodePairList& _deferred;
+};
 
 
 
 ParallelVisitor::ParallelVisitor( osg::Node* sgA, osg::Node* sgB )
   : _sgA( sgA ),
     _sgB( sgB ),
-    _pvcb( NULL )
+    _pvcb( NULL ),
+    _numThreads( 1 ),
+    _matchMode( MATCH_INDEX ),
+    _matchTolerance( 1e-3 )
 {
 }
 ParallelVisitor::~ParallelVisitor()
@@ -46,13 +207,122 @@ ParallelVisitor::ParallelVisitorCallback* ParallelVisitor::getCallback() const
     return( _pvcb );
 }
 
+void ParallelVisitor::setNumThreads( unsigned int numThreads )
+{
+    _numThreads = numThreads;
+}
+unsigned int ParallelVisitor::getNumThreads() const
+{
+    return( _numThreads );
+}
+
+void ParallelVisitor::setMatchMode( MatchMode matchMode )
+{
+    _matchMode = matchMode;
+}
+ParallelVisitor::MatchMode ParallelVisitor::getMatchMode() const
+{
+    return( _matchMode );
+}
+void ParallelVisitor::setMatchTolerance( double tolerance )
+{
+    _matchTolerance = tolerance;
+}
+double ParallelVisitor::getMatchTolerance() const
+{
+    return( _matchTolerance );
+}
+
 
 void ParallelVisitor::traverse()
 {
-    recurseTraverse( _sgA.get(), _sgB.get() );
+    unsigned int numThreads( _numThreads );
+    if( numThreads == 0 )
+        numThreads = OpenThreads::GetNumberOfProcessors();
+    if( ( numThreads > 1 ) && ( _pvcb != NULL ) && !( _pvcb->isThreadSafe() ) )
+    {
+        osg::notify( osg::WARN ) << "ParallelVisitor: Callback is not thread-safe. Traversing on one thread." << std::endl;
+        numThreads = 1;
+    }
+
+    if( ( _matchMode == MATCH_STRUCTURE ) && _sgA.valid() && _sgB.valid() )
+    {
+        // Compute and cache all bounds up front, so matching doesn't
+        // compute bounds of shared nodes on several threads at once.
+        _sgA->getBound();
+        _sgB->getBound();
+    }
+
+    if( numThreads > 1 )
+        parallelTraverse( numThreads );
+    else
+        recurseTraverse( _sgA.get(), _sgB.get() );
+}
+
+void ParallelVisitor::parallelTraverse( unsigned int numThreads )
+{
+    // Expand the top of the graphs breadth-first until there are enough
+    // independent subtrees to balance the load across the threads.
+    // The callback runs here for every child pair taken off the top.
+    const unsigned int targetSize( numThreads * 8 );
+    NodePairList work, deferred;
+    work.push_back( NodePair( _sgA, _sgB ) );
+    while( ( work.size() > 0 ) && ( work.size() < targetSize ) )
+    {
+        NodePairList next;
+        NodePairList::const_iterator it;
+        for( it = work.begin(); it != work.end(); ++it )
+        {
+            NodePairList children;
+            matchChildren( it->first.get(), it->second.get(), children );
+
+            NodePairList::const_iterator cit;
+            for( cit = children.begin(); cit != children.end(); ++cit )
+            {
+                const NodePair& child( *cit );
+                if( ( child.first->getNumParents() > 1 ) || ( child.second->getNumParents() > 1 ) )
+                {
+                    deferred.push_back( child );
+                    continue;
+                }
+                if( _pvcb != NULL )
+                    (*_pvcb)( *( child.first ), *( child.second ) );
+                next.push_back( child );
+            }
+        }
+        // Keep descending even if this level is no wider than the last;
+        // exported models often hang everything below a single child.
+        // Pairs without children are done, so an empty level ends the
+        // traversal.
+        work.swap( next );
+    }
+
+    numThreads = osg::minimum< unsigned int >( numThreads, work.size() );
+    OpenThreads::Atomic nextWork;
+    std::vector< ParallelVisitorThread* > threads;
+    unsigned int idx;
+    for( idx=0; idx<numThreads; ++idx )
+    {
+        threads.push_back( new ParallelVisitorThread( *this, work, nextWork, deferred ) );
+        threads.back()->start();
+    }
+    for( idx=0; idx<numThreads; ++idx )
+    {
+        threads[ idx ]->join();
+        delete threads[ idx ];
+    }
+
+    // Shared subtrees, once per parent, as in the serial traversal.
+    NodePairList::const_iterator it;
+    for( it = deferred.begin(); it != deferred.end(); ++it )
+    {
+        if( _pvcb != NULL )
+            (*_pvcb)( *( it->first ), *( it->second ) );
+        recurseTraverse( it->first.get(), it->second.get() );
+    }
 }
 
-bool ParallelVisitor::recurseTraverse( osg::Node* nodeA, osg::Node* nodeB )
+bool ParallelVisitor::matchChildren( osg::Node* nodeA, osg::Node* nodeB, NodePairList& children )
 {
     if( ( nodeA == NULL ) || ( nodeB == NULL ) )
         return( false );
@@ -81,6 +351,15 @@ bool ParallelVisitor::recurseTraverse( osg::Node* nodeA, osg::Node* nodeB )
         osg::notify( osg::WARN ) << "ParallelVisitor: Class name mismatch:";
         osg::notify( osg::WARN ) << "\t\"" << grpA->className() << "\" != \"" << grpB->className() << "\"." << std::endl;
     }
+    if( _matchMode == MATCH_STRUCTURE )
+        matchByStructure( grpA, grpB, children );
+    else
+        matchByIndex( grpA, grpB, children );
+    return( true );
+}
+
+void ParallelVisitor::matchByIndex( osg::Group* grpA, osg::Group* grpB, NodePairList& children )
+{
     const unsigned int minChildren = osg::minimum( grpA->getNumChildren(), grpB->getNumChildren() );
     if( grpA->getNumChildren() != grpB->getNumChildren() )
     {
@@ -92,14 +371,58 @@ bool ParallelVisitor::recurseTraverse( osg::Node* nodeA, osg::Node* nodeB )
 
     unsigned int idx;
     for( idx=0; idx < minChildren; ++idx )
+        children.push_back( NodePair( grpA->getChild( idx ), grpB->getChild( idx ) ) );
+}
+
+void ParallelVisitor::matchByStructure( osg::Group* grpA, osg::Group* grpB, NodePairList& children )
+{
+    std::vector< bool > matchedA( grpA->getNumChildren(), false );
+    std::vector< bool > matchedB( grpB->getNumChildren(), false );
+    matchKeys( grpA, grpB, matchedA, matchedB, children, _matchTolerance, true );
+    if( children.size() < grpA->getNumChildren() )
+        // Geometry changed, but the names might still identify the node.
+        matchKeys( grpA, grpB, matchedA, matchedB, children, _matchTolerance, false );
+
+    unsigned int idx;
+    for( idx=0; idx<matchedA.size(); ++idx )
+    {
+        if( !matchedA[ idx ] )
+            osg::notify( osg::WARN ) << "ParallelVisitor: No match for child " << idx << " of \"" << grpA->getName() <<
+                "\" in model A: \"" << grpA->getChild( idx )->getName() << "\". Skipping; possible loss of geometry." << std::endl;
+    }
+    for( idx=0; idx<matchedB.size(); ++idx )
     {
-        osg::ref_ptr< osg::Node > childA( grpA->getChild( idx ) );
-        osg::ref_ptr< osg::Node > childB( grpB->getChild( idx ) );
+        if( !matchedB[ idx ] )
+            osg::notify( osg::WARN ) << "ParallelVisitor: No match for child " << idx << " of \"" << grpB->getName() <<
+                "\" in model B: \"" << grpB->getChild( idx )->getName() << "\". Skipping." << std::endl;
+    }
+}
+
+
+bool ParallelVisitor::recurseTraverse( osg::Node* nodeA, osg::Node* nodeB, NodePairList* deferred )
+{
+    NodePairList children;
+    if( !matchChildren( nodeA, nodeB, children ) )
+        return( false );
+
+    NodePairList::const_iterator it;
+    for( it = children.begin(); it != children.end(); ++it )
+    {
+        osg::Node* childA( it->first.get() );
+        osg::Node* childB( it->second.get() );
+        if( ( deferred != NULL ) &&
+            ( ( childA->getNumParents() > 1 ) || ( childB->getNumParents() > 1 ) ) )
+        {
+            // Another thread might reach this node through its other parent.
+            OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _deferredMutex );
+            deferred->push_back( *it );
+            continue;
+        }
         if( _pvcb != NULL )
         {
             const bool retVal( (*_pvcb)( *childA, *childB ) );
         }
-        recurseTraverse( childA.get(), childB.get() );
+        recurseTraverse( childA, childB, deferred );
     }
     return( true );
 }
@@ -24,11 +24,27 @@
 
 #include <osg/ref_ptr>
 #include <osg/Node>
+#include <OpenThreads/Mutex>
+
+#include <vector>
+#include <utility>
 
 
 
 /** \brief Simultaneously walks two scene graphs
-and executes a callback for each node. */
+and executes a callback for each node.
+\details By default the traversal is depth-first on the calling thread.
+With setNumThreads() other than 1 and a thread-safe callback, the top of
+the graphs is expanded breadth-first on the calling thread until there
+are enough child pairs to keep the threads busy, and worker threads then
+traverse those independent subtrees concurrently. Nodes with multiple
+parents in either graph are never visited concurrently; they and their
+subtrees are deferred and traversed on the calling thread once the
+workers finish.
+
+By default the children of two Groups are paired by index. MATCH_STRUCTURE
+pairs them by content instead, so reordered, added, or removed children
+in one graph don't misalign the rest. See setMatchMode(). */
 class ParallelVisitor
 {
 public:
@@ -44,17 +60,68 @@ public:
         virtual ~ParallelVisitorCallback() {}
 
         virtual bool operator()( osg::Node& grpA, osg::Node& grpB ) = 0;
+
+        /** Return true only if operator() may be called concurrently
+        from several threads, for different node pairs. The pairs are
+        always disjoint subtrees of nodes with a single parent, but
+        operator() must still guard anything else they can share, such
+        as Drawables, StateSets, and StateAttributes, along with the
+        callback's own state. If false, traverse() runs on the calling
+        thread regardless of setNumThreads(). Default: false. */
+        virtual bool isThreadSafe() const { return( false ); }
     };
     void setCallback( ParallelVisitorCallback* pvcb );
     ParallelVisitor::ParallelVisitorCallback* getCallback() const;
 
+    /** Number of threads used by traverse(). 0 uses one thread per
+    processor. Default: 1, traverse on the calling thread. */
+    void setNumThreads( unsigned int numThreads );
+    unsigned int getNumThreads() const;
+
+    enum MatchMode {
+        /** Pair the i-th child of A with the i-th child of B. Extra
+        children in either Group are ignored. */
+        MATCH_INDEX,
+        /** Pair children by name, class name, vertex count (Geodes), and
+        quantized bounding box (Geodes) or bounding sphere (others). If
+        that fails, pair children with the same name and class name.
+        Children without a match are reported and skipped. Uses hash
+        maps, so it stays linear in the number of children. */
+        MATCH_STRUCTURE
+    };
+    /** Default: MATCH_INDEX. */
+    void setMatchMode( MatchMode matchMode );
+    MatchMode getMatchMode() const;
+    /** MATCH_STRUCTURE bound coordinates are quantized to multiples
+    of this value before hashing. Default: 1e-3. */
+    void setMatchTolerance( double tolerance );
+    double getMatchTolerance() const;
+
+    typedef std::pair< osg::ref_ptr< osg::Node >, osg::ref_ptr< osg::Node > > NodePair;
+    typedef std::vector< NodePair > NodePairList;
+
+    /** Pair the children of \c nodeA and \c nodeB per the match mode,
+    as traverse() does, and append the pairs to \c children.
+    \return false if the nodes are structurally inconsistent. */
+    bool matchChildren( osg::Node* nodeA, osg::Node* nodeB, NodePairList& children );
+
 protected:
-    bool recurseTraverse( osg::Node* nodeA, osg::Node* nodeB );
+    bool recurseTraverse( osg::Node* nodeA, osg::Node* nodeB, NodePairList* deferred=NULL );
+    void matchByIndex( osg::Group* grpA, osg::Group* grpB, NodePairList& children );
+    void matchByStructure( osg::Group* grpA, osg::Group* grpB, NodePairList& children );
+    void parallelTraverse( unsigned int numThreads );
 
     osg::ref_ptr< osg::Node > _sgA;
     osg::ref_ptr< osg::Node > _sgB;
 
     ParallelVisitorCallback* _pvcb;
+
+    unsigned int _numThreads;
+    MatchMode _matchMode;
+    double _matchTolerance;
+    OpenThreads::Mutex _deferredMutex;
+
+    friend class ParallelVisitorThread;
 };
 
 
@@ -3,6 +3,7 @@
 #include "ParallelVisitor.h"
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
+#include <osgDB/FileNameUtils>
 #include <osgViewer/Viewer>
 #include <osgUtil/Optimizer>
 #include <osgwMx/MxCore.h>
@@ -10,8 +11,15 @@
 #include <osg/Geode>
 #include <osg/Geometry>
 #include <osg/TexEnv>
+#include <osg/ProxyNode>
+#include <osg/Texture>
+#include <osg/Image>
+#include <osg/Timer>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
 #include <sstream>
 #include <map>
+#include <set>
 
 struct SourceInfo
 {
@@ -40,34 +48,84 @@ struct MyParallelCallback : public ParallelVisitor::ParallelVisitorCallback
     TexEnvMap _texEnv;
 
     virtual bool operator()( osg::Node& grpA, osg::Node& grpB );
+    virtual bool isThreadSafe() const { return( true ); }
 
+    template< class T >
+    void mergeStateSet( T& objA, osg::StateSet* ssB );
     void processStateSet( osg::StateSet* ssA, osg::StateSet* ssB );
     void processGeometry( osg::Geometry* geomA, osg::Geometry* geomB );
     void processTexEnv( osg::StateSet* ss, osg::Texture* tex, unsigned int unit );
 
     typedef std::vector< osg::ref_ptr< osg::Array > > ArrayVec;
     typedef std::vector< osg::ref_ptr< osg::Texture > > TextureVec;
+
+    // Serializes StateSet changes. Adding a Texture or TexEnv to a
+    // StateSet, or replacing a StateSet, updates the parent lists of
+    // objects shared throughout both graphs.
+    OpenThreads::Mutex _stateMutex;
+
+    // Merged StateSets, keyed by the original A and B StateSets. Every
+    // A object with the same pair of StateSets shares one merge result.
+    typedef std::pair< const osg::StateSet*, const osg::StateSet* > StateSetKey;
+    typedef std::map< StateSetKey, osg::ref_ptr< osg::StateSet > > StateSetCache;
+    StateSetCache _stateSetCache;
+    std::set< const osg::StateSet* > _mergedStateSets;
+    // A Geometry shared by several Geodes is merged only once.
+    std::set< const osg::Geometry* > _mergedGeometries;
+    std::set< const osg::Array* > _uvArrays;
+    unsigned int _stateSetMerges;
+    unsigned int _uvAssignments;
+
+    void dump( std::ostream& ostr ) const;
 };
 
 MyParallelCallback::MyParallelCallback()
+  : _stateSetMerges( 0 ),
+    _uvAssignments( 0 )
+{
+}
+
+void MyParallelCallback::dump( std::ostream& ostr ) const
+{
+    ostr << "StateSets: " << _stateSetMerges << " merged, " << _stateSetCache.size() << " unique";
+    if( _stateSetCache.size() > 0 )
+        ostr << " (" << (double)_stateSetMerges / (double)_stateSetCache.size() << ":1)";
+    ostr << std::endl;
+    ostr << "uv arrays: " << _uvAssignments << " assigned, " << _uvArrays.size() << " unique";
+    if( _uvArrays.size() > 0 )
+        ostr << " (" << (double)_uvAssignments / (double)_uvArrays.size() << ":1)";
+    ostr << std::endl;
+    ostr << "Geometries: " << _mergedGeometries.size() << " merged" << std::endl;
+}
+
+template< class T >
+void MyParallelCallback::mergeStateSet( T& objA, osg::StateSet* ssB )
 {
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _stateMutex );
+
+    osg::StateSet* ssA( objA.getStateSet() );
+    // Reached again through another parent; already merged.
+    if( _mergedStateSets.find( ssA ) != _mergedStateSets.end() )
+        return;
+    ++_stateSetMerges;
+
+    osg::ref_ptr< osg::StateSet >& merged( _stateSetCache[ StateSetKey( ssA, ssB ) ] );
+    if( !merged.valid() )
+    {
+        // Never modify ssA in place; other A objects might share it
+        // with a different B StateSet.
+        merged = ( ssA != NULL ) ? new osg::StateSet( *ssA ) : new osg::StateSet;
+        processStateSet( merged.get(), ssB );
+        _mergedStateSets.insert( merged.get() );
+    }
+    objA.setStateSet( merged.get() );
 }
 
 bool MyParallelCallback::operator()( osg::Node& grpA, osg::Node& grpB )
 {
     if( ( grpA.getStateSet() != NULL ) ||
         ( grpB.getStateSet() != NULL ) )
-    {
-        if( grpA.getStateSet() != NULL )
-        {
-            // Make a shallow copy of grpA's StateSet to ensure there is
-            // no StateSet sharing in the grpA model. Otherwise we might
-            // process a StateSet that has already been processed.
-            grpA.setStateSet( new osg::StateSet( *( grpA.getStateSet() ) ) );
-        }
-
-        processStateSet( grpA.getOrCreateStateSet(), grpB.getOrCreateStateSet() );
-    }
+        mergeStateSet( grpA, grpB.getStateSet() );
 
     if( ( grpA.className() != std::string( "Geode" ) ) ||
         ( grpB.className() != std::string( "Geode" ) ) )
@@ -113,7 +171,7 @@ void MyParallelCallback::processStateSet( osg::StateSet* ssA, osg::StateSet* ssB
         if( it->second._modelID == 0 )
             srcTex = ssAtex[ it->second._unit ].get();
         else
-            srcTex = static_cast< osg::Texture* >(
+            srcTex = ( ssB == NULL ) ? NULL : static_cast< osg::Texture* >(
                 ssB->getTextureAttribute( it->second._unit, osg::StateAttribute::TEXTURE ) );
         if( srcTex != NULL )
         {
@@ -144,19 +202,21 @@ void MyParallelCallback::processTexEnv( osg::StateSet* ss, osg::Texture* tex, un
 }
 void MyParallelCallback::processGeometry( osg::Geometry* geomA, osg::Geometry* geomB )
 {
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _stateMutex );
+        if( !( _mergedGeometries.insert( geomA ).second ) )
+            return;
+    }
+
     if( ( geomA->getStateSet() != NULL ) ||
         ( geomB->getStateSet() != NULL ) )
-    {
-        if( geomA->getStateSet() != NULL )
-        {
-            // Make a shallow copy of grpA's StateSet to ensure there is
-            // no StateSet sharing in the grpA model. Otherwise we might
-            // process a StateSet that has already been processed.
-            geomA->setStateSet( new osg::StateSet( *( geomA->getStateSet() ) ) );
-        }
+        mergeStateSet( *geomA, geomB->getStateSet() );
 
-        processStateSet( geomA->getOrCreateStateSet(), geomB->getOrCreateStateSet() );
-    }
+    // The rest only touches geomA, unless assigning an array
+    // also assigns it a buffer object.
+    const bool locked( geomA->getUseVertexBufferObjects() );
+    if( locked )
+        _stateMutex.lock();
 
     ArrayVec geomAuv;
     geomAuv.resize( 16 );
@@ -165,6 +225,7 @@ void MyParallelCallback::processGeometry( osg::Geometry* geomA, osg::Geometry* g
         geomAuv[ idx ] = geomA->getTexCoordArray( idx );
 
     const unsigned int vertexSize = geomA->getVertexArray()->getNumElements();
+    std::vector< const osg::Array* > srcArrays;
     UnitMap::const_iterator it;
     for( it = _uvMap.begin(); it != _uvMap.end(); it++ )
     {
@@ -174,6 +235,8 @@ void MyParallelCallback::processGeometry( osg::Geometry* geomA, osg::Geometry* g
             srcArray = geomAuv[ it->second._unit ].get();
         else
             srcArray = geomB->getTexCoordArray( it->second._unit );
+        if( srcArray == NULL )
+            continue;
         if( srcArray->getNumElements() != vertexSize )
         {
             osg::notify( osg::WARN ) << "MyParallelCallback: processGeometry: Unexpected uv array size." << std::endl;
@@ -182,11 +245,170 @@ void MyParallelCallback::processGeometry( osg::Geometry* geomA, osg::Geometry* g
         }
 
         geomA->setTexCoordArray( destUnit, srcArray );
+        srcArrays.push_back( srcArray );
     }
+
+    if( !locked )
+        _stateMutex.lock();
+    _uvAssignments += srcArrays.size();
+    _uvArrays.insert( srcArrays.begin(), srcArrays.end() );
+    _stateMutex.unlock();
 }
 
 
 
+// Counts the Images without a file name. Stream mode writes Images by
+// file name, so these would be missing from the output.
+struct UnnamedImages : public osg::NodeVisitor
+{
+    UnnamedImages()
+      : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN )
+    {}
+
+    virtual void apply( osg::Node& node )
+    {
+        apply( node.getStateSet() );
+        traverse( node );
+    }
+    virtual void apply( osg::Geode& node )
+    {
+        apply( node.getStateSet() );
+        for( unsigned int idx=0; idx<node.getNumDrawables(); ++idx )
+            apply( node.getDrawable( idx )->getStateSet() );
+        traverse( node );
+    }
+    void apply( const osg::StateSet* ss )
+    {
+        if( ss == NULL )
+            return;
+        const osg::StateSet::TextureAttributeList& tal( ss->getTextureAttributeList() );
+        for( unsigned int unit=0; unit<tal.size(); ++unit )
+        {
+            osg::StateSet::AttributeList::const_iterator it;
+            for( it = tal[ unit ].begin(); it != tal[ unit ].end(); ++it )
+            {
+                const osg::Texture* tex( dynamic_cast< const osg::Texture* >( it->second.first.get() ) );
+                if( tex == NULL )
+                    continue;
+                for( unsigned int idx=0; idx<tex->getNumImages(); ++idx )
+                {
+                    const osg::Image* image( tex->getImage( idx ) );
+                    if( ( image != NULL ) && image->getFileName().empty() )
+                        _images.insert( image );
+                }
+            }
+        }
+    }
+
+    std::set< const osg::Image* > _images;
+};
+
+// Merge and write one top-level subtree at a time. Each child of A's root
+// Group is merged, written to its own file next to outFile, and released.
+// outFile gets A's root Group with a ProxyNode for each child.
+//
+// Both models are still read whole, so peak memory is at least both
+// inputs; streaming only avoids holding a merged copy and serializing it
+// in one piece. Each subtree file is standalone, so objects shared across
+// subtrees are written once per file. To keep B's lightmaps from being
+// embedded in every file, Images are written by file name rather than
+// inline (.ive and .osgb); Images without a file name are reported.
+//
+// mpc's caches hold raw pointers to released objects. That's safe: both
+// models are loaded before anything is released, and the merged StateSets
+// are kept alive by the cache, so no new object can reuse an address.
+bool streamMerge( osg::Group* grpA, osg::ref_ptr< osg::Node >& sgB, MyParallelCallback& mpc,
+    unsigned int numThreads, ParallelVisitor::MatchMode matchMode, const std::string& outFile )
+{
+    osg::Group* grpB( sgB->asGroup() );
+    if( grpB == NULL )
+    {
+        osg::notify( osg::FATAL ) << "Streaming needs a Group at the root of both models." << std::endl;
+        return( false );
+    }
+
+    {
+        UnnamedImages unnamed;
+        grpA->accept( unnamed );
+        sgB->accept( unnamed );
+        if( !( unnamed._images.empty() ) )
+            osg::notify( osg::WARN ) << unnamed._images.size() << " images have no file name and "
+                "won't be in the streamed output." << std::endl;
+    }
+
+    typedef std::map< osg::Node*, osg::ref_ptr< osg::Node > > MatchMap;
+    MatchMap matches;
+    {
+        ParallelVisitor top( grpA, grpB );
+        top.setMatchMode( matchMode );
+        ParallelVisitor::NodePairList pairs;
+        top.matchChildren( grpA, grpB, pairs );
+        ParallelVisitor::NodePairList::const_iterator it;
+        for( it = pairs.begin(); it != pairs.end(); ++it )
+            matches[ it->first.get() ] = it->second;
+    }
+
+    // From here on, these are the only references to the top-level
+    // subtrees, so each is freed as soon as it's written.
+    std::vector< osg::ref_ptr< osg::Node > > childrenA;
+    unsigned int idx;
+    for( idx=0; idx<grpA->getNumChildren(); ++idx )
+        childrenA.push_back( grpA->getChild( idx ) );
+    grpA->removeChildren( 0, grpA->getNumChildren() );
+    sgB = NULL;
+
+    osg::ref_ptr< osgDB::ReaderWriter::Options > options = new osgDB::ReaderWriter::Options;
+    options->setOptionString( "noTexturesInIVEFile WriteImageHint=UseExternal" );
+
+    const std::string path( osgDB::getFilePath( outFile ) );
+    const std::string base( osgDB::getSimpleFileName( osgDB::getNameLessExtension( outFile ) ) );
+    const std::string ext( osgDB::getFileExtension( outFile ) );
+    osgUtil::Optimizer optimizer;
+    for( idx=0; idx<childrenA.size(); ++idx )
+    {
+        osg::ref_ptr< osg::Node > childA( childrenA[ idx ] );
+        childrenA[ idx ] = NULL;
+
+        MatchMap::iterator it( matches.find( childA.get() ) );
+        if( it != matches.end() )
+        {
+            osg::ref_ptr< osg::Node > childB( it->second );
+            matches.erase( it );
+
+            mpc( *childA, *childB );
+            ParallelVisitor pv( childA.get(), childB.get() );
+            pv.setCallback( &mpc );
+            pv.setNumThreads( numThreads );
+            pv.setMatchMode( matchMode );
+            pv.traverse();
+        }
+        optimizer.optimize( childA.get(),
+            osgUtil::Optimizer::SHARE_DUPLICATE_STATE );
+
+        std::ostringstream ostr;
+        ostr << base << "_" << idx << "." << ext;
+        if( !osgDB::writeNodeFile( *childA, osgDB::concatPaths( path, ostr.str() ), options.get() ) )
+        {
+            osg::notify( osg::FATAL ) << "Can't write \"" << ostr.str() << "\"." << std::endl;
+            return( false );
+        }
+
+        osg::ProxyNode* proxy = new osg::ProxyNode;
+        proxy->setName( childA->getName() );
+        proxy->setFileName( 0, ostr.str() );
+        grpA->addChild( proxy );
+    }
+
+    if( !osgDB::writeNodeFile( *grpA, outFile ) )
+    {
+        osg::notify( osg::FATAL ) << "Can't write \"" << outFile << "\"." << std::endl;
+        return( false );
+    }
+    osg::notify( osg::ALWAYS ) << "Wrote " << childrenA.size() << " subtrees and \"" << outFile << "\"." << std::endl;
+    return( true );
+}
+
+
 // -u 0=a.0 -u 1=a.0 -u 2=b.1
 // -t 0=a.0 -t 1=a.1 -t 2=b.1
 // -e Diffuse=REPLACE -e Shadow=MODULATE
@@ -198,12 +420,24 @@ int main( int argc, char** argv )
     {
         osg::notify( osg::ALWAYS ) <<
             "texmerge <fileA> <fileB> [options]\n" <<
-            "Texture information from fileB is merged into fileA and written to \"out.osg\".\n" <<
+            "Texture information from fileB is merged into fileA and written to \"out.osg\",\n" <<
+            "or the -o file.\n" <<
             "Use options to control how texture information merges into the output file:\n" <<
             "\t-u <outUnit>=\"a\"|\"b\".<srcUnit>\n" <<
             "\t-t <outUnit>=\"a\"|\"b\".<srcUnit>\n" <<
             "\t-e <string>=<mode>|\"OFF\"\n" <<
+            "\t-o <file>\tOutput file. Any writable format, such as .osgb or .ive.\n" <<
+            "\t--stream\tMerge, write, and release each child of fileA's root\n" <<
+            "\t\tin turn. Each goes to <file>_<n>.<ext>, and <file> references\n" <<
+            "\t\tthem with ProxyNodes. Images are written by file name, not\n" <<
+            "\t\tembedded, so keep the image files with the output. Both input\n" <<
+            "\t\tmodels are still loaded whole; streaming only saves the merged\n" <<
+            "\t\tcopy and the single large write.\n" <<
             "\t--view\tIf present, display the resulting model.\n" <<
+            "\t--threads <n>\tMerge independent subtrees on <n> threads. 0 uses one\n" <<
+            "\t\tthread per processor. Default: 1.\n" <<
+            "\t--match-structure\tPair children by name and geometry instead of\n" <<
+            "\t\tby index, for graphs with reordered or missing children.\n" <<
             "\n" <<
             "\t-u Specify uv texcoord array mappings. Example:\n" <<
             "\t\t\"-u 1=b.0\" means \"take the uv array from fileB's unit 0\n" <<
@@ -287,6 +521,39 @@ int main( int argc, char** argv )
         arguments.remove( viewPos, 1 );
     }
 
+    unsigned int numThreads( 1 );
+    int threadsPos;
+    if( ( threadsPos = arguments.find( "--threads" ) ) > 0 )
+    {
+        std::istringstream istr( arguments[ threadsPos + 1 ] );
+        istr >> numThreads;
+        arguments.remove( threadsPos, 2 );
+    }
+
+    ParallelVisitor::MatchMode matchMode( ParallelVisitor::MATCH_INDEX );
+    int matchPos;
+    if( ( matchPos = arguments.find( "--match-structure" ) ) > 0 )
+    {
+        matchMode = ParallelVisitor::MATCH_STRUCTURE;
+        arguments.remove( matchPos, 1 );
+    }
+
+    std::string outFile( "out.osg" );
+    int outPos;
+    if( ( outPos = arguments.find( "-o" ) ) > 0 )
+    {
+        outFile = arguments[ outPos + 1 ];
+        arguments.remove( outPos, 2 );
+    }
+
+    bool stream( false );
+    int streamPos;
+    if( ( streamPos = arguments.find( "--stream" ) ) > 0 )
+    {
+        stream = true;
+        arguments.remove( streamPos, 1 );
+    }
+
     if( arguments.argc() != 3 )
     {
         osg::notify( osg::FATAL ) << "Must specify two model files on the command line." << std::endl;
@@ -301,22 +568,53 @@ int main( int argc, char** argv )
         return( 1 );
     }
 
+    if( stream && ( sgA->asGroup() == NULL ) )
+    {
+        osg::notify( osg::WARN ) << "fileA root is not a Group; can't stream." << std::endl;
+        stream = false;
+    }
+    if( stream )
+    {
+        osg::Timer timer;
+        const osg::Timer_t start( timer.tick() );
+        if( !streamMerge( sgA->asGroup(), sgB, mpc, numThreads, matchMode, outFile ) )
+            return( 1 );
+        osg::notify( osg::ALWAYS ) << "Merge: " << timer.delta_m( start, timer.tick() ) << " ms." << std::endl;
+        mpc.dump( osg::notify( osg::ALWAYS ) );
+
+        if( view )
+            // The merged subtrees are gone; view what was written.
+            sgA = osgDB::readNodeFile( outFile );
+    }
+    else
     {
         ParallelVisitor pv( sgA.get(), sgB.get() );
         pv.setCallback( &mpc );
+        pv.setNumThreads( numThreads );
+        pv.setMatchMode( matchMode );
+
+        osg::Timer timer;
+        const osg::Timer_t start( timer.tick() );
         pv.traverse();
+        osg::notify( osg::ALWAYS ) << "Merge: " << timer.delta_m( start, timer.tick() ) << " ms." << std::endl;
+        mpc.dump( osg::notify( osg::ALWAYS ) );
 
-        // We made shallow copies of all the StateSets so that the merge
-        // process didn't overwrite any previously processed state.
-        // Now run the optimizer to share state again.
+        // Merges of the same StateSet pair are already shared. Different
+        // pairs can still produce identical state, so run the optimizer
+        // to share those too.
         osgUtil::Optimizer optimizer;
         optimizer.optimize( sgA.get(),
             osgUtil::Optimizer::SHARE_DUPLICATE_STATE );
-    }
 
-    osgDB::writeNodeFile( *sgA, "out.osg" );
+        sgB = NULL;
+        if( !osgDB::writeNodeFile( *sgA, outFile ) )
+        {
+            osg::notify( osg::FATAL ) << "Can't write \"" << outFile << "\"." << std::endl;
+            return( 1 );
+        }
+    }
 
-    if( !view )
+    if( !view || !( sgA.valid() ) )
         return( 0 );
 
 
@@ -0,0 +1,595 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#include "AtlasBuilder.h"
+#include "MaxRectsPacker.h"
+#include "FixedFunctionLighting.h"
+#include <osg/Image>
+#include <osg/Shader>
+#include <osg/Notify>
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef GL_BGR
+#define GL_BGR 0x80E0
+#endif
+#ifndef GL_BGRA
+#define GL_BGRA 0x80E1
+#endif
+
+
+
+namespace
+{
+
+osg::Texture2D* getTexture2D( osg::StateSet* stateSet )
+{
+    if( stateSet == NULL )
+        return( NULL );
+    return( dynamic_cast< osg::Texture2D* >(
+        stateSet->getTextureAttribute( 0, osg::StateAttribute::TEXTURE ) ) );
+}
+
+bool isSupportedImage( const osg::Image* image )
+{
+    if( ( image == NULL ) || ( image->data() == NULL ) || ( image->r() != 1 ) ||
+        ( image->getDataType() != GL_UNSIGNED_BYTE ) )
+        return( false );
+    switch( image->getPixelFormat() )
+    {
+    case GL_RGB:
+    case GL_RGBA:
+    case GL_BGR:
+    case GL_BGRA:
+    case GL_LUMINANCE:
+    case GL_LUMINANCE_ALPHA:
+    case GL_ALPHA:
+        return( true );
+    default:
+        return( false );
+    }
+}
+
+// Convert one texel of image to RGBA.
+void readRGBA( const osg::Image* image, int s, int t, unsigned char* rgba )
+{
+    const unsigned char* src( image->data( s, t ) );
+    switch( image->getPixelFormat() )
+    {
+    case GL_RGB:
+        rgba[ 0 ] = src[ 0 ]; rgba[ 1 ] = src[ 1 ]; rgba[ 2 ] = src[ 2 ]; rgba[ 3 ] = 255;
+        break;
+    case GL_RGBA:
+        rgba[ 0 ] = src[ 0 ]; rgba[ 1 ] = src[ 1 ]; rgba[ 2 ] = src[ 2 ]; rgba[ 3 ] = src[ 3 ];
+        break;
+    case GL_BGR:
+        rgba[ 0 ] = src[ 2 ]; rgba[ 1 ] = src[ 1 ]; rgba[ 2 ] = src[ 0 ]; rgba[ 3 ] = 255;
+        break;
+    case GL_BGRA:
+        rgba[ 0 ] = src[ 2 ]; rgba[ 1 ] = src[ 1 ]; rgba[ 2 ] = src[ 0 ]; rgba[ 3 ] = src[ 3 ];
+        break;
+    case GL_LUMINANCE:
+        rgba[ 0 ] = rgba[ 1 ] = rgba[ 2 ] = src[ 0 ]; rgba[ 3 ] = 255;
+        break;
+    case GL_LUMINANCE_ALPHA:
+        rgba[ 0 ] = rgba[ 1 ] = rgba[ 2 ] = src[ 0 ]; rgba[ 3 ] = src[ 1 ];
+        break;
+    case GL_ALPHA:
+        rgba[ 0 ] = rgba[ 1 ] = rgba[ 2 ] = 255; rgba[ 3 ] = src[ 0 ];
+        break;
+    }
+}
+
+const char* arrayVertexSource =
+    "attribute float atlas_layer;\n"
+    "varying float layer;\n"
+    "void main()\n"
+    "{\n"
+    "    fixedFunctionVertex( gl_Vertex, gl_Normal, gl_MultiTexCoord0 );\n"
+    "    layer = atlas_layer;\n"
+    "}\n";
+
+const char* arrayFragmentSource =
+    "#version 120\n"
+    "#extension GL_EXT_texture_array : require\n"
+    "uniform sampler2DArray atlas_textureArray;\n"
+    "varying float layer;\n"
+    "void main()\n"
+    "{\n"
+    "    gl_FragColor = gl_Color * texture2DArray( atlas_textureArray, vec3( gl_TexCoord[ 0 ].st, layer ) );\n"
+    "}\n";
+
+// The array shader replaces fixed-function vertex and fragment processing,
+// so it must reproduce the state of every Geometry the texture is on.
+bool isShaderReproducible( const std::set< osg::Geometry* >& geometries )
+{
+    std::set< osg::Geometry* >::const_iterator it;
+    for( it = geometries.begin(); it != geometries.end(); ++it )
+        if( !FixedFunctionLighting::isReproducible( **it, true ) )
+            return( false );
+    return( true );
+}
+
+// TEXTURE_ARRAY layers must match in everything but their image data.
+std::vector< unsigned int > arrayKey( const osg::Texture2D* texture )
+{
+    const osg::Image* image( texture->getImage() );
+    std::vector< unsigned int > key;
+    key.push_back( image->s() );
+    key.push_back( image->t() );
+    key.push_back( image->getPixelFormat() );
+    key.push_back( image->getDataType() );
+    key.push_back( image->getInternalTextureFormat() );
+    key.push_back( texture->getWrap( osg::Texture::WRAP_S ) );
+    key.push_back( texture->getWrap( osg::Texture::WRAP_T ) );
+    key.push_back( texture->getFilter( osg::Texture::MIN_FILTER ) );
+    key.push_back( texture->getFilter( osg::Texture::MAG_FILTER ) );
+    return( key );
+}
+
+int nextPowerOfTwo( int value )
+{
+    int result( 1 );
+    while( result < value )
+        result <<= 1;
+    return( result );
+}
+
+// Sort order for packing: tallest, then widest, first.
+struct LargerFirst
+{
+    bool operator()( const osg::Texture2D* lhs, const osg::Texture2D* rhs ) const
+    {
+        const osg::Image* l( lhs->getImage() );
+        const osg::Image* r( rhs->getImage() );
+        if( l->t() != r->t() )
+            return( l->t() > r->t() );
+        return( l->s() > r->s() );
+    }
+};
+
+}
+
+
+
+AtlasBuilder::TextureInfo::TextureInfo()
+  : _eligible( true ),
+    _atlas( -1 ),
+    _x( 0 ),
+    _y( 0 ),
+    _array( NULL )
+{
+}
+
+
+AtlasBuilder::AtlasBuilder()
+  : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ),
+    _mode( ATLAS ),
+    _maxAtlasSize( 2048 ),
+    _maxTextureSize( 512 ),
+    _padding( 2 ),
+    _mipmap( true ),
+    _maxLayers( 256 ),
+    _atlased( 0 ),
+    _bytesIn( 0 ),
+    _bytesOut( 0 )
+{
+}
+
+void AtlasBuilder::apply( osg::Node& node )
+{
+    // Geometries below a Group's texture can't be remapped.
+    osg::Texture2D* texture( getTexture2D( node.getStateSet() ) );
+    if( texture != NULL )
+        _textures[ texture ]._eligible = false;
+    traverse( node );
+}
+
+void AtlasBuilder::apply( osg::Geode& node )
+{
+    osg::Texture2D* geodeTexture( getTexture2D( node.getStateSet() ) );
+    for( unsigned int idx=0; idx<node.getNumDrawables(); ++idx )
+    {
+        osg::Drawable* draw( node.getDrawable( idx ) );
+        if( geodeTexture != NULL )
+            _geodeDrawables[ node.getStateSet() ].insert( draw );
+        osg::StateSet* stateSet( draw->getStateSet() );
+        osg::Texture2D* texture( getTexture2D( stateSet ) );
+        if( texture == NULL )
+        {
+            texture = geodeTexture;
+            stateSet = node.getStateSet();
+        }
+        if( texture == NULL )
+            continue;
+
+        osg::Geometry* geom( draw->asGeometry() );
+        if( geom == NULL )
+        {
+            _textures[ texture ]._eligible = false;
+            continue;
+        }
+        record( texture, geom, stateSet );
+    }
+    traverse( node );
+}
+
+void AtlasBuilder::record( osg::Texture2D* texture, osg::Geometry* geom, osg::StateSet* stateSet )
+{
+    TextureInfo& info( _textures[ texture ] );
+    info._geometries.insert( geom );
+    info._stateSets[ stateSet ].insert( geom );
+
+    // A Geometry textured by two different textures (in two
+    // Geodes) can't be remapped for both.
+    std::map< osg::Geometry*, osg::Texture2D* >::iterator it( _geometryTextures.find( geom ) );
+    if( it == _geometryTextures.end() )
+        _geometryTextures[ geom ] = texture;
+    else if( it->second != texture )
+    {
+        info._eligible = false;
+        _textures[ it->second ]._eligible = false;
+    }
+}
+
+unsigned int AtlasBuilder::execute()
+{
+    if( _mode == TEXTURE_ARRAY )
+        return( executeArrays() );
+
+    std::vector< osg::Texture2D* > candidates;
+    TextureMap::iterator it;
+    for( it = _textures.begin(); it != _textures.end(); ++it )
+    {
+        if( it->second._eligible && isEligible( it->first, it->second ) )
+            candidates.push_back( it->first );
+        else
+            it->second._eligible = false;
+    }
+    std::sort( candidates.begin(), candidates.end(), LargerFirst() );
+
+    // Pack into as many atlases as needed.
+    std::vector< MaxRectsPacker > packers;
+    std::vector< Atlas > atlases;
+    std::vector< osg::Texture2D* >::const_iterator cit;
+    for( cit = candidates.begin(); cit != candidates.end(); ++cit )
+    {
+        TextureInfo& info( _textures[ *cit ] );
+        const int width( (*cit)->getImage()->s() + _padding * 2 );
+        const int height( (*cit)->getImage()->t() + _padding * 2 );
+        unsigned int idx;
+        for( idx=0; idx<packers.size(); ++idx )
+        {
+            if( packers[ idx ].insert( width, height, info._x, info._y ) )
+                break;
+        }
+        if( idx == packers.size() )
+        {
+            packers.push_back( MaxRectsPacker( _maxAtlasSize, _maxAtlasSize ) );
+            atlases.push_back( Atlas() );
+            packers.back().insert( width, height, info._x, info._y );
+        }
+        atlases[ idx ]._members.push_back( *cit );
+    }
+
+    unsigned int numAtlased( 0 );
+    for( unsigned int idx=0; idx<atlases.size(); ++idx )
+    {
+        Atlas& atlas( atlases[ idx ] );
+        // Nothing to gain from an atlas of one.
+        if( atlas._members.size() < 2 )
+            continue;
+
+        createAtlasImage( atlas, nextPowerOfTwo( packers[ idx ].getUsedWidth() ),
+            nextPowerOfTwo( packers[ idx ].getUsedHeight() ) );
+        _atlases.push_back( atlas );
+
+        std::vector< osg::Texture2D* >::const_iterator mit;
+        for( mit = atlas._members.begin(); mit != atlas._members.end(); ++mit )
+        {
+            TextureInfo& info( _textures[ *mit ] );
+            info._atlas = _atlases.size() - 1;
+            remap( *mit, info, atlas );
+            _bytesIn += (*mit)->getImage()->getTotalSizeInBytes();
+            ++numAtlased;
+        }
+        _bytesOut += atlas._texture->getImage()->getTotalSizeInBytes();
+    }
+    _atlased += numAtlased;
+    _texCoords.clear();
+    return( numAtlased );
+}
+
+void AtlasBuilder::dump( std::ostream& ostr ) const
+{
+    unsigned int eligible( 0 );
+    TextureMap::const_iterator it;
+    for( it = _textures.begin(); it != _textures.end(); ++it )
+    {
+        if( it->second._eligible )
+            ++eligible;
+    }
+
+    ostr << "AtlasBuilder results:" << std::endl;
+    ostr << "  Textures found: " << _textures.size() << ", eligible: " << eligible << std::endl;
+    if( _mode == TEXTURE_ARRAY )
+    {
+        ostr << "  Textures moved to arrays: " << _atlased << " into " << _arrays.size() << " arrays" << std::endl;
+        std::vector< osg::ref_ptr< osg::Texture2DArray > >::const_iterator arit;
+        for( arit = _arrays.begin(); arit != _arrays.end(); ++arit )
+            ostr << "    " << (*arit)->getImage( 0 )->s() << "x" << (*arit)->getImage( 0 )->t() <<
+                ": " << (*arit)->getTextureDepth() << " layers" << std::endl;
+        return;
+    }
+    ostr << "  Textures atlased: " << _atlased << " into " << _atlases.size() << " atlases" << std::endl;
+    std::vector< Atlas >::const_iterator ait;
+    for( ait = _atlases.begin(); ait != _atlases.end(); ++ait )
+        ostr << "    " << ait->_texture->getImage()->s() << "x" << ait->_texture->getImage()->t() <<
+            ": " << ait->_members.size() << " textures" << std::endl;
+    ostr << "  Image bytes: " << _bytesIn << " -> " << _bytesOut << std::endl;
+}
+
+
+bool AtlasBuilder::isEligible( osg::Texture2D* texture, const TextureInfo& info ) const
+{
+    const osg::Image* image( texture->getImage() );
+    if( !isSupportedImage( image ) || ( image->s() > _maxTextureSize ) ||
+        ( image->t() > _maxTextureSize ) ||
+        ( image->s() + _padding * 2 > _maxAtlasSize ) ||
+        ( image->t() + _padding * 2 > _maxAtlasSize ) )
+        return( false );
+
+    // Texture coordinates must stay inside the sub-image. Allow a
+    // little slop, which the padding absorbs.
+    const float slop( .001f );
+    std::set< osg::Geometry* >::const_iterator it;
+    for( it = info._geometries.begin(); it != info._geometries.end(); ++it )
+    {
+        const osg::Vec2Array* tc( dynamic_cast< const osg::Vec2Array* >( (*it)->getTexCoordArray( 0 ) ) );
+        if( tc == NULL )
+            return( false );
+        osg::Vec2Array::const_iterator tcit;
+        for( tcit = tc->begin(); tcit != tc->end(); ++tcit )
+        {
+            if( ( tcit->x() < -slop ) || ( tcit->x() > 1.f + slop ) ||
+                ( tcit->y() < -slop ) || ( tcit->y() > 1.f + slop ) )
+                return( false );
+        }
+    }
+    return( true );
+}
+
+void AtlasBuilder::createAtlasImage( Atlas& atlas, int width, int height )
+{
+    osg::ref_ptr< osg::Image > image( new osg::Image );
+    image->allocateImage( width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+    memset( image->data(), 0, image->getTotalSizeInBytes() );
+
+    std::vector< osg::Texture2D* >::const_iterator it;
+    for( it = atlas._members.begin(); it != atlas._members.end(); ++it )
+    {
+        const TextureInfo& info( _textures[ *it ] );
+        const osg::Image* source( (*it)->getImage() );
+        const int s( source->s() ), t( source->t() );
+
+        // Copy the image and replicate its edge texels into the padding.
+        for( int y=-_padding; y<t+_padding; ++y )
+        {
+            const int sy( osg::clampBetween( y, 0, t-1 ) );
+            for( int x=-_padding; x<s+_padding; ++x )
+            {
+                const int sx( osg::clampBetween( x, 0, s-1 ) );
+                readRGBA( source, sx, sy,
+                    image->data( info._x + _padding + x, info._y + _padding + y ) );
+            }
+        }
+    }
+
+    osg::Texture2D* texture( new osg::Texture2D( image.get() ) );
+    texture->setWrap( osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE );
+    texture->setWrap( osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE );
+    texture->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
+    texture->setFilter( osg::Texture::MIN_FILTER,
+        _mipmap ? osg::Texture::LINEAR_MIPMAP_LINEAR : osg::Texture::LINEAR );
+    atlas._texture = texture;
+}
+
+void AtlasBuilder::remap( osg::Texture2D* texture, const TextureInfo& info, const Atlas& atlas )
+{
+    const osg::Image* source( texture->getImage() );
+    const osg::Image* image( atlas._texture->getImage() );
+    const osg::Vec2 offset( (float)( info._x + _padding ) / (float)image->s(),
+        (float)( info._y + _padding ) / (float)image->t() );
+    const osg::Vec2 scale( (float)source->s() / (float)image->s(),
+        (float)source->t() / (float)image->t() );
+
+    std::set< osg::Geometry* >::const_iterator it;
+    for( it = info._geometries.begin(); it != info._geometries.end(); ++it )
+    {
+        const osg::Vec2Array* tc( static_cast< const osg::Vec2Array* >( (*it)->getTexCoordArray( 0 ) ) );
+
+        // Geometries sharing a texture coordinate array and a texture
+        // keep sharing the remapped array.
+        osg::ref_ptr< osg::Vec2Array >& remapped( _texCoords[ TexCoordKey( tc, texture ) ] );
+        if( !remapped.valid() )
+        {
+            remapped = new osg::Vec2Array;
+            remapped->reserve( tc->size() );
+            osg::Vec2Array::const_iterator tcit;
+            for( tcit = tc->begin(); tcit != tc->end(); ++tcit )
+                remapped->push_back( osg::Vec2( offset.x() + tcit->x() * scale.x(),
+                    offset.y() + tcit->y() * scale.y() ) );
+        }
+        (*it)->setTexCoordArray( 0, remapped.get() );
+        (*it)->dirtyDisplayList();
+    }
+
+    TextureInfo::StateSetUsers::const_iterator sit;
+    for( sit = info._stateSets.begin(); sit != info._stateSets.end(); ++sit )
+        sit->first->setTextureAttribute( 0, atlas._texture.get() );
+}
+
+
+unsigned int AtlasBuilder::executeArrays()
+{
+    // Group the textures that can share an array.
+    typedef std::map< std::vector< unsigned int >, std::vector< osg::Texture2D* > > GroupMap;
+    GroupMap groups;
+    TextureMap::iterator it;
+    for( it = _textures.begin(); it != _textures.end(); ++it )
+    {
+        const osg::Image* image( it->first->getImage() );
+        if( !it->second._eligible || ( image == NULL ) || ( image->data() == NULL ) || ( image->r() != 1 ) ||
+            !isShaderReproducible( it->second._geometries ) )
+        {
+            it->second._eligible = false;
+            continue;
+        }
+        groups[ arrayKey( it->first ) ].push_back( it->first );
+    }
+
+    if( !_arrayProgram.valid() )
+    {
+        _arrayProgram = new osg::Program;
+        _arrayProgram->setName( "atlas texture array" );
+        _arrayProgram->addShader( new osg::Shader( osg::Shader::VERTEX, std::string( "#version 120\n" ) +
+            FixedFunctionLighting::getVertexSource() + arrayVertexSource ) );
+        _arrayProgram->addShader( new osg::Shader( osg::Shader::FRAGMENT, arrayFragmentSource ) );
+        _arrayProgram->addBindAttribLocation( "atlas_layer", LAYER_ATTRIB );
+        _arraySampler = new osg::Uniform( "atlas_textureArray", 0 );
+    }
+
+    unsigned int numMoved( 0 );
+    GroupMap::const_iterator git;
+    for( git = groups.begin(); git != groups.end(); ++git )
+    {
+        const std::vector< osg::Texture2D* >& members( git->second );
+        for( unsigned int start=0; start<members.size(); start+=_maxLayers )
+        {
+            const unsigned int count( osg::minimum< unsigned int >( _maxLayers, members.size() - start ) );
+            // Nothing to gain from an array of one.
+            if( count < 2 )
+                continue;
+
+            const osg::Texture2D* first( members[ start ] );
+            osg::Texture2DArray* array( new osg::Texture2DArray );
+            array->setTextureSize( first->getImage()->s(), first->getImage()->t(), count );
+            array->setWrap( osg::Texture::WRAP_S, first->getWrap( osg::Texture::WRAP_S ) );
+            array->setWrap( osg::Texture::WRAP_T, first->getWrap( osg::Texture::WRAP_T ) );
+            array->setFilter( osg::Texture::MIN_FILTER, first->getFilter( osg::Texture::MIN_FILTER ) );
+            array->setFilter( osg::Texture::MAG_FILTER, first->getFilter( osg::Texture::MAG_FILTER ) );
+            _arrays.push_back( array );
+
+            for( unsigned int layer=0; layer<count; ++layer )
+            {
+                osg::Texture2D* texture( members[ start + layer ] );
+                addLayer( texture, _textures[ texture ], array, layer );
+                _bytesIn += texture->getImage()->getTotalSizeInBytes();
+                ++numMoved;
+            }
+        }
+    }
+    applyArrayState();
+
+    _atlased += numMoved;
+    _bytesOut = _bytesIn;
+    _layerArrays.clear();
+    return( numMoved );
+}
+
+void AtlasBuilder::addLayer( osg::Texture2D* texture, TextureInfo& info,
+    osg::Texture2DArray* array, unsigned int layer )
+{
+    array->setImage( layer, texture->getImage() );
+    info._array = array;
+
+    std::set< osg::Geometry* >::const_iterator it;
+    for( it = info._geometries.begin(); it != info._geometries.end(); ++it )
+    {
+        osg::Geometry* geom( *it );
+        const unsigned int numVerts( ( geom->getVertexArray() != NULL ) ?
+            geom->getVertexArray()->getNumElements() : 0 );
+
+        // Geometries with the same vertex count and layer share a layer array.
+        osg::ref_ptr< osg::FloatArray >& layers( _layerArrays[ LayerKey( numVerts, layer ) ] );
+        if( !layers.valid() )
+            layers = new osg::FloatArray( numVerts, (float)layer );
+        geom->setVertexAttribArray( LAYER_ATTRIB, layers.get() );
+        geom->setVertexAttribBinding( LAYER_ATTRIB, osg::Geometry::BIND_PER_VERTEX );
+        geom->dirtyDisplayList();
+    }
+}
+
+void AtlasBuilder::applyArrayState()
+{
+    // Runs once every layer is assigned, so it's known
+    // which Drawables below a Geode were converted.
+    TextureMap::const_iterator it;
+    for( it = _textures.begin(); it != _textures.end(); ++it )
+    {
+        osg::Texture2DArray* array( it->second._array );
+        if( array == NULL )
+            continue;
+
+        TextureInfo::StateSetUsers::const_iterator sit;
+        for( sit = it->second._stateSets.begin(); sit != it->second._stateSets.end(); ++sit )
+        {
+            osg::StateSet* stateSet( sit->first );
+            std::map< osg::StateSet*, std::set< osg::Drawable* > >::const_iterator dit(
+                _geodeDrawables.find( stateSet ) );
+            bool allConverted( true );
+            if( dit != _geodeDrawables.end() )
+            {
+                std::set< osg::Drawable* >::const_iterator drit;
+                for( drit = dit->second.begin(); allConverted && ( drit != dit->second.end() ); ++drit )
+                    allConverted = isConverted( *drit );
+            }
+            if( allConverted )
+            {
+                setArrayState( stateSet, array );
+                continue;
+            }
+
+            // Other Drawables inherit this Geode StateSet but keep their own
+            // Texture2D, so they must not inherit the array Program. Leave
+            // it alone and push the array state down to each converted
+            // Geometry. A StateSet shared with other Drawables is copied.
+            std::set< osg::Geometry* >::const_iterator git;
+            for( git = sit->second.begin(); git != sit->second.end(); ++git )
+            {
+                osg::Geometry* geom( *git );
+                osg::StateSet* own( geom->getStateSet() );
+                if( own == NULL )
+                    own = geom->getOrCreateStateSet();
+                else if( own->getNumParents() > 1 )
+                {
+                    own = new osg::StateSet( *own );
+                    geom->setStateSet( own );
+                }
+                setArrayState( own, array );
+            }
+        }
+    }
+}
+
+bool AtlasBuilder::isConverted( const osg::Drawable* draw ) const
+{
+    const osg::Geometry* geom( draw->asGeometry() );
+    if( geom == NULL )
+        return( false );
+    std::map< osg::Geometry*, osg::Texture2D* >::const_iterator it(
+        _geometryTextures.find( const_cast< osg::Geometry* >( geom ) ) );
+    if( it == _geometryTextures.end() )
+        return( false );
+    TextureMap::const_iterator tit( _textures.find( it->second ) );
+    return( ( tit != _textures.end() ) && ( tit->second._array != NULL ) );
+}
+
+void AtlasBuilder::setArrayState( osg::StateSet* stateSet, osg::Texture2DArray* array )
+{
+    stateSet->removeTextureAttribute( 0, osg::StateAttribute::TEXTURE );
+    stateSet->removeTextureMode( 0, GL_TEXTURE_2D );
+    stateSet->setTextureAttribute( 0, array );
+    stateSet->setAttribute( _arrayProgram.get() );
+    stateSet->addUniform( _arraySampler.get() );
+}
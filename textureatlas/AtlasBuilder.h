@@ -0,0 +1,158 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __ATLAS_BUILDER_H__
+#define __ATLAS_BUILDER_H__ 1
+
+
+#include <osg/NodeVisitor>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Texture2D>
+#include <osg/Texture2DArray>
+#include <osg/Program>
+#include <osg/Uniform>
+#include <osg/StateSet>
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+
+
+
+/** AtlasBuilder AtlasBuilder.h
+\brief Packs unit 0 Texture2Ds into texture atlases and remaps texture coordinates.
+\details Traverse the scene graph to collect the Texture2Ds on unit 0 of
+Geode and Drawable StateSets, and the Geometries they texture. execute()
+then packs the eligible textures with MaxRectsPacker. It copies them into
+RGBA atlas images, remaps the unit 0 texture coordinates of their
+Geometries, and replaces the texture in each StateSet with its atlas.
+StateSets that differ only in texture become identical, so run
+osgUtil::Optimizer's SHARE_DUPLICATE_STATE afterwards to merge them.
+
+A texture is eligible if:
+\li its image is uncompressed 8-bit RGB(A), BGR(A), luminance(-alpha) or alpha;
+\li it is at most maxTextureSize in both dimensions;
+\li it only textures Geometries with Vec2Array unit 0 coordinates in [0,1],
+since wrap modes other than clamping can't work in an atlas;
+\li it isn't on a Group's StateSet, where the Geometries below
+couldn't be remapped.
+
+Each sub-image is surrounded by padding texels copied from its edges. This
+stops filtering, and mipmap levels while the padding lasts, from bleeding
+in neighboring images.
+
+In TEXTURE_ARRAY mode, textures with the same size, format, wrap and
+filter modes become layers of one Texture2DArray instead. Texture
+coordinates are untouched, so REPEAT still works, and the coordinate and
+pixel format restrictions above don't apply. Each Geometry gets a
+per-vertex layer index in vertex attribute LAYER_ATTRIB, and each StateSet
+gets a shader that samples the array. A Geode StateSet gets the shader only
+if every Drawable below it was converted; otherwise the shader goes on the
+converted Drawables' own StateSets. The shader lights with
+FixedFunctionLighting and modulates the array texel by the lit color, so
+textures on Geometries whose inherited state that can't reproduce stay
+Texture2Ds.
+**/
+class AtlasBuilder : public osg::NodeVisitor
+{
+public:
+    AtlasBuilder();
+
+    enum Mode {
+        ATLAS,
+        TEXTURE_ARRAY
+    };
+    /** Default: ATLAS. */
+    void setMode( Mode mode ) { _mode = mode; }
+
+    /** Generic vertex attribute holding the TEXTURE_ARRAY layer index. */
+    enum { LAYER_ATTRIB = 7 };
+
+    /** Atlas width and height limit. Default: 2048. */
+    void setMaxAtlasSize( int size ) { _maxAtlasSize = size; }
+    /** Larger textures are left alone. Default: 512. */
+    void setMaxTextureSize( int size ) { _maxTextureSize = size; }
+    /** Edge texels replicated around each sub-image. Default: 2. */
+    void setPadding( int padding ) { _padding = padding; }
+    /** If false, atlases don't use mipmapping, so nothing can
+    bleed at any distance. Default: true. */
+    void setMipmap( bool mipmap ) { _mipmap = mipmap; }
+    /** TEXTURE_ARRAY layer limit. Default: 256, the
+    OpenGL 3.0 minimum for GL_MAX_ARRAY_TEXTURE_LAYERS. */
+    void setMaxLayers( unsigned int layers ) { _maxLayers = layers; }
+
+    /** \return The number of textures moved into atlases or arrays. */
+    unsigned int execute();
+
+    void dump( std::ostream& ostr ) const;
+
+    virtual void apply( osg::Node& node );
+    virtual void apply( osg::Geode& node );
+
+protected:
+    struct TextureInfo
+    {
+        TextureInfo();
+
+        std::set< osg::Geometry* > _geometries;
+        /** Each StateSet holding the texture, with the Geometries it textures. */
+        typedef std::map< osg::StateSet*, std::set< osg::Geometry* > > StateSetUsers;
+        StateSetUsers _stateSets;
+        bool _eligible;
+
+        int _atlas;
+        int _x, _y;
+
+        osg::Texture2DArray* _array;
+    };
+    typedef std::map< osg::Texture2D*, TextureInfo > TextureMap;
+
+    struct Atlas
+    {
+        osg::ref_ptr< osg::Texture2D > _texture;
+        std::vector< osg::Texture2D* > _members;
+    };
+
+    void record( osg::Texture2D* texture, osg::Geometry* geom, osg::StateSet* stateSet );
+    bool isEligible( osg::Texture2D* texture, const TextureInfo& info ) const;
+    void createAtlasImage( Atlas& atlas, int width, int height );
+    void remap( osg::Texture2D* texture, const TextureInfo& info, const Atlas& atlas );
+
+    unsigned int executeArrays();
+    void addLayer( osg::Texture2D* texture, TextureInfo& info,
+        osg::Texture2DArray* array, unsigned int layer );
+    void applyArrayState();
+    bool isConverted( const osg::Drawable* draw ) const;
+    void setArrayState( osg::StateSet* stateSet, osg::Texture2DArray* array );
+
+    Mode _mode;
+    int _maxAtlasSize;
+    int _maxTextureSize;
+    int _padding;
+    bool _mipmap;
+    unsigned int _maxLayers;
+
+    TextureMap _textures;
+    std::map< osg::Geometry*, osg::Texture2D* > _geometryTextures;
+    /** Drawables below each textured Geode StateSet. */
+    std::map< osg::StateSet*, std::set< osg::Drawable* > > _geodeDrawables;
+    std::vector< Atlas > _atlases;
+
+    typedef std::pair< const osg::Array*, osg::Texture2D* > TexCoordKey;
+    std::map< TexCoordKey, osg::ref_ptr< osg::Vec2Array > > _texCoords;
+
+    typedef std::pair< unsigned int, unsigned int > LayerKey;
+    std::map< LayerKey, osg::ref_ptr< osg::FloatArray > > _layerArrays;
+    osg::ref_ptr< osg::Program > _arrayProgram;
+    osg::ref_ptr< osg::Uniform > _arraySampler;
+    std::vector< osg::ref_ptr< osg::Texture2DArray > > _arrays;
+
+    unsigned int _atlased;
+    unsigned long long _bytesIn;
+    unsigned long long _bytesOut;
+};
+
+
+// __ATLAS_BUILDER_H__
+#endif
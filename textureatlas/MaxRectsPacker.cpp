@@ -0,0 +1,108 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#include "MaxRectsPacker.h"
+
+#include <algorithm>
+#include <climits>
+
+
+
+bool MaxRectsPacker::Rect::contains( const Rect& rhs ) const
+{
+    return( ( rhs._x >= _x ) && ( rhs._y >= _y ) &&
+        ( rhs._x + rhs._w <= _x + _w ) && ( rhs._y + rhs._h <= _y + _h ) );
+}
+
+
+MaxRectsPacker::MaxRectsPacker( int width, int height )
+  : _usedWidth( 0 ),
+    _usedHeight( 0 )
+{
+    _free.push_back( Rect( 0, 0, width, height ) );
+}
+MaxRectsPacker::~MaxRectsPacker()
+{
+}
+
+bool MaxRectsPacker::insert( int width, int height, int& x, int& y )
+{
+    // Best short side fit; ties go to the best long side fit.
+    int bestShort( INT_MAX ), bestLong( INT_MAX );
+    int bestIndex( -1 );
+    for( unsigned int idx=0; idx<_free.size(); ++idx )
+    {
+        const Rect& r( _free[ idx ] );
+        if( ( r._w < width ) || ( r._h < height ) )
+            continue;
+        const int dw( r._w - width ), dh( r._h - height );
+        const int shortSide( std::min( dw, dh ) ), longSide( std::max( dw, dh ) );
+        if( ( shortSide < bestShort ) || ( ( shortSide == bestShort ) && ( longSide < bestLong ) ) )
+        {
+            bestShort = shortSide;
+            bestLong = longSide;
+            bestIndex = idx;
+        }
+    }
+    if( bestIndex < 0 )
+        return( false );
+
+    const Rect used( _free[ bestIndex ]._x, _free[ bestIndex ]._y, width, height );
+    split( used );
+    prune();
+
+    x = used._x;
+    y = used._y;
+    _usedWidth = std::max( _usedWidth, used._x + used._w );
+    _usedHeight = std::max( _usedHeight, used._y + used._h );
+    return( true );
+}
+
+void MaxRectsPacker::split( const Rect& used )
+{
+    RectList result;
+    result.reserve( _free.size() + 4 );
+    RectList::const_iterator it;
+    for( it = _free.begin(); it != _free.end(); ++it )
+    {
+        const Rect& r( *it );
+        if( ( used._x >= r._x + r._w ) || ( used._x + used._w <= r._x ) ||
+            ( used._y >= r._y + r._h ) || ( used._y + used._h <= r._y ) )
+        {
+            result.push_back( r );
+            continue;
+        }
+
+        // Replace r with the maximal free rectangles around used.
+        if( used._x > r._x )
+            result.push_back( Rect( r._x, r._y, used._x - r._x, r._h ) );
+        if( used._x + used._w < r._x + r._w )
+            result.push_back( Rect( used._x + used._w, r._y, r._x + r._w - ( used._x + used._w ), r._h ) );
+        if( used._y > r._y )
+            result.push_back( Rect( r._x, r._y, r._w, used._y - r._y ) );
+        if( used._y + used._h < r._y + r._h )
+            result.push_back( Rect( r._x, used._y + used._h, r._w, r._y + r._h - ( used._y + used._h ) ) );
+    }
+    _free.swap( result );
+}
+
+void MaxRectsPacker::prune()
+{
+    // Remove free rectangles contained in another.
+    for( unsigned int idx=0; idx<_free.size(); ++idx )
+    {
+        for( unsigned int jdx=idx+1; jdx<_free.size(); ++jdx )
+        {
+            if( _free[ jdx ].contains( _free[ idx ] ) )
+            {
+                _free.erase( _free.begin() + idx );
+                --idx;
+                break;
+            }
+            if( _free[ idx ].contains( _free[ jdx ] ) )
+            {
+                _free.erase( _free.begin() + jdx );
+                --jdx;
+            }
+        }
+    }
+}
@@ -0,0 +1,52 @@
+// Copyright (c) 2013 Skew Matrix Software LLC. All rights reserved.
+
+#ifndef __MAX_RECTS_PACKER_H__
+#define __MAX_RECTS_PACKER_H__ 1
+
+
+#include <vector>
+
+
+
+/** MaxRectsPacker MaxRectsPacker.h
+\brief Packs rectangles into a fixed-size bin.
+\details Keeps the list of maximal free rectangles and places each new
+rectangle with the best short side fit heuristic, as described in Jukka
+Jylanki, "A Thousand Ways to Pack the Bin". Rectangles are not rotated.
+For the tightest packing, insert the largest rectangles first.
+**/
+class MaxRectsPacker
+{
+public:
+    MaxRectsPacker( int width, int height );
+    ~MaxRectsPacker();
+
+    /** Places a width x height rectangle.
+    \return false, leaving x and y unchanged, if it doesn't fit. */
+    bool insert( int width, int height, int& x, int& y );
+
+    /** Extent of everything placed so far. */
+    int getUsedWidth() const { return( _usedWidth ); }
+    int getUsedHeight() const { return( _usedHeight ); }
+
+protected:
+    struct Rect
+    {
+        Rect( int x, int y, int w, int h )
+          : _x( x ), _y( y ), _w( w ), _h( h ) {}
+        bool contains( const Rect& rhs ) const;
+
+        int _x, _y, _w, _h;
+    };
+    typedef std::vector< Rect > RectList;
+
+    void split( const Rect& used );
+    void prune();
+
+    RectList _free;
+    int _usedWidth, _usedHeight;
+};
+
+
+// __MAX_RECTS_PACKER_H__
+#endif
@@ -1,15 +1,91 @@
 // Copyright (c) 2011 Skew Matrix Software LLC. All rights reserved.
 
+#include "AtlasBuilder.h"
 #include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
 #include <osgViewer/Viewer>
 #include <osgwTools/CountsVisitor.h>
 #include <osgUtil/Optimizer>
 
+#include <set>
+
+
+// textureatlas [options] <files>
+//
+//   --max-size <n>     Atlas width and height limit. Default: 2048.
+//   --max-texture <n>  Don't atlas textures larger than this. Default: 512.
+//   --padding <n>      Edge texels replicated around each image. Default: 2.
+//   --no-mipmap        Disable mipmapping on the atlases.
+//   --array            Build Texture2DArrays of same-sized textures instead
+//                      of atlases.
+//   --max-layers <n>   Texture2DArray layer limit. Default: 256.
+//   -o <file>          Write the result.
+//   --view             View the result.
+
+
+// Unique StateSets and textures, i.e. the state changes and texture
+// binds a draw traversal can't avoid.
+class StateCounter : public osg::NodeVisitor
+{
+public:
+    StateCounter()
+      : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN )
+    {}
+
+    virtual void apply( osg::Node& node )
+    {
+        addStateSet( node.getStateSet() );
+        traverse( node );
+    }
+    virtual void apply( osg::Geode& node )
+    {
+        addStateSet( node.getStateSet() );
+        for( unsigned int idx=0; idx<node.getNumDrawables(); ++idx )
+            addStateSet( node.getDrawable( idx )->getStateSet() );
+        traverse( node );
+    }
+
+    std::set< osg::StateSet* > _stateSets;
+    std::set< osg::StateAttribute* > _textures;
+
+protected:
+    void addStateSet( osg::StateSet* stateSet )
+    {
+        if( ( stateSet == NULL ) || !_stateSets.insert( stateSet ).second )
+            return;
+        const osg::StateSet::TextureAttributeList& tal( stateSet->getTextureAttributeList() );
+        for( unsigned int unit=0; unit<tal.size(); ++unit )
+        {
+            osg::StateAttribute* sa( stateSet->getTextureAttribute( unit, osg::StateAttribute::TEXTURE ) );
+            if( sa != NULL )
+                _textures.insert( sa );
+        }
+    }
+};
+
 
 int main( int argc, char** argv )
 {
     osg::ArgumentParser arguments( &argc, argv );
 
+    AtlasBuilder builder;
+    int value;
+    if( arguments.read( "--max-size", value ) )
+        builder.setMaxAtlasSize( value );
+    if( arguments.read( "--max-texture", value ) )
+        builder.setMaxTextureSize( value );
+    if( arguments.read( "--padding", value ) )
+        builder.setPadding( value );
+    if( arguments.read( "--no-mipmap" ) )
+        builder.setMipmap( false );
+    if( arguments.read( "--array" ) )
+        builder.setMode( AtlasBuilder::TEXTURE_ARRAY );
+    if( arguments.read( "--max-layers", value ) )
+        builder.setMaxLayers( value );
+    std::string outFile;
+    arguments.read( "-o", outFile );
+    const bool view( arguments.read( "--view" ) );
+
     osg::ref_ptr< osg::Group > root = new osg::Group;
     root->addChild( osgDB::readNodeFiles( arguments ) );
     if( root->getNumChildren() == 0 )
@@ -21,19 +97,34 @@ int main( int argc, char** argv )
     osgwTools::CountsVisitor counts;
     root->accept( counts );
     counts.dump( osg::notify( osg::ALWAYS ) );
+    StateCounter before;
+    root->accept( before );
 
+    root->accept( builder );
+    builder.execute();
+    builder.dump( osg::notify( osg::ALWAYS ) );
+
+    // Merge the StateSets that now differ in nothing.
     osgUtil::Optimizer opt;
-    unsigned int flags = osgUtil::Optimizer::TEXTURE_ATLAS_BUILDER |
-        osgUtil::Optimizer::DEFAULT_OPTIMIZATIONS;
-    opt.optimize( root.get(), flags );
+    opt.optimize( root.get(), osgUtil::Optimizer::SHARE_DUPLICATE_STATE );
 
     counts.reset();
     root->accept( counts );
     counts.dump( osg::notify( osg::ALWAYS ) );
+    StateCounter after;
+    root->accept( after );
+
+    OSG_ALWAYS << "Unique StateSets: " << before._stateSets.size() << " -> " << after._stateSets.size() <<
+        " (" << (int)before._stateSets.size() - (int)after._stateSets.size() << " state changes eliminated)" << std::endl;
+    OSG_ALWAYS << "Unique textures: " << before._textures.size() << " -> " << after._textures.size() <<
+        " (" << (int)before._textures.size() - (int)after._textures.size() << " texture binds eliminated)" << std::endl;
 
-    return( 0 );
+    if( !outFile.empty() )
+        osgDB::writeNodeFile( *root, outFile );
+    if( !view )
+        return( 0 );
 
     osgViewer::Viewer viewer;
     viewer.setSceneData( root.get() );
     return( viewer.run() );
-}
\ No newline at end of file
+}